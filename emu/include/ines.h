@@ -1,7 +1,9 @@
 #pragma once
 
 #include <memory.h>
+#include <romimage.h>
 #include <nes/ppu.h>
+#include <nes/apu.h>
 #include <reset_manager.h>
 #include <mos6502/mos6502.h>
 
@@ -19,20 +21,26 @@ typedef struct rominfo {
 	ppu_t * nonnull /*unowned*/ ppu;
 	ines_mirroring_t mirroring;
 
+	// The volatile and battery-backed parts of WRAM, either of which may be
+	// missing
 	memory_t * nullable /*unowned*/ wram;
+	memory_t * nullable /*unowned*/ sram;
 	memory_t * nullable /*unowned*/ prgrom;
 	memory_t * nullable /*unowned*/ chrom;
 	memory_t * nullable /*unowned*/ chram;
 	memory_t * nullable /*unowned*/ vram;
 } rominfo_t;
 
-// Loads an ines-formatted ROM given a `FILE` object opened at `path`, setting
-// up both the CPU and PPU memory maps in the process. Returns a nonzero exit
-// code if an error occurs.
-int inesrom_load (FILE * nonnull f,
+// Loads an ines-formatted ROM from the image `rom` of the file at `path`,
+// setting up both the CPU and PPU memory maps in the process. The PRG and CHR
+// ROMs are used in place, and keep `rom` alive. `ppu_opts` and `apu_opts`
+// are passed on to the newly-created PPU and APU. Returns a nonzero exit code
+// if an error occurs.
+int inesrom_load (romimage_t * nonnull rom,
 		  const char * nonnull path,
 		  reset_manager_t * nonnull rm,
 		  mos6502_t * nonnull cpu,
 		  const char * nonnull palette_path,
 		  const char * nonnull cscheme_path,
-		  int scale);
+		  const ppu_options_t * nonnull ppu_opts,
+		  const apu_options_t * nonnull apu_opts);
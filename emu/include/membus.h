@@ -97,3 +97,7 @@ void membus_set_write_memory (membus_t * nonnull bus,
 			      size_t pagenum,
 			      void * nonnull obj,
 			      void * nonnull data);
+
+// Returns the native memory region that reads from `pagenum` are redirected
+// to, or NULL if reads from `pagenum` are unmapped or handled by a handler
+uint8_t * nullable membus_read_memory (membus_t * nonnull bus, size_t pagenum);
@@ -7,11 +7,15 @@
 #include <stdint.h>
 #include <stdbool.h>
 
-// A virtual memory device, implemented as a byte vector
+// A virtual memory device, implemented as a byte vector. The bytes are either
+// allocated along with the device, or belong to some other object (e.g. a
+// mapped ROM image), which the device keeps alive.
 typedef struct memory {
 	size_t size;
 	bool writeable;
-	uint8_t bytes[];
+	uint8_t * nonnull bytes;
+	void * nullable /*strong*/ owner;
+	uint8_t storage[];
 } memory_t;
 
 // Allocates and initializes a new reference-counted memory object
@@ -19,6 +23,21 @@ memory_t * nullable memory_new (reset_manager_t * nonnull rm,
 				size_t size,
 				bool writeable);
 
+// Creates a read-only memory object over `size` bytes at `bytes`, which
+// belong to the reference-counted object `owner`. The bytes are never copied
+// or written to, and `owner` is retained for as long as the memory is.
+memory_t * nullable memory_new_external (const uint8_t * nonnull bytes,
+					 size_t size,
+					 void * nonnull owner);
+
+// Creates a writeable memory object over `size` bytes at `bytes`, which belong
+// to the reference-counted object `owner` as with `memory_new_external()`.
+// Unlike `memory_new()`'s memories, it isn't cleared on reset, since its bytes
+// are meant to persist (e.g. battery-backed RAM).
+memory_t * nullable memory_new_persistent (uint8_t * nonnull bytes,
+					   size_t size,
+					   void * nonnull owner);
+
 // Maps a `size` region of `mem` (starting at `start`) to `bus` (starting at
 // `bus_start`)
 void memory_map (memory_t * nonnull mem,
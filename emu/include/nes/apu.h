@@ -1,6 +1,32 @@
+#pragma once
+
+#include <reset_manager.h>
+#include <mos6502/mos6502.h>
+#include <nes/audiosink.h>
+
+// The rate (in Hz) of the mono, 32-bit float samples that the APU produces,
+// unless it's given another
+#define APU_SAMPLE_RATE 44100
+
 typedef struct apu apu_t;
 
+// The type of the routine that the APU hands each batch of samples to, as
+// they're queued for playback. The samples are only valid for the duration of
+// the call.
+typedef void apu_sample_callback_t (void * nullable ctx, const float * nonnull samples, size_t nsamples);
+
+typedef struct apu_options {
+	// Where samples go once they're synthesized
+	audiosink_t * nonnull /*unowned*/ sink;
+
+	apu_sample_callback_t * nullable tap;
+	void * nullable /*unowned*/ tap_ctx;
+
+	// The rate (in Hz) to produce samples at, or 0 for `APU_SAMPLE_RATE`
+	uint32_t sample_rate;
+} apu_options_t;
+
 uint8_t apu_mem_read(apu_t *apu, uint16_t addr, uint8_t *lane_mask);
 void apu_mem_write(apu_t *apu, uint16_t addr, uint8_t data);
 
-apu_t * apu_new(reset_manager_t *rm, mos6502_t *cpu);
+apu_t * apu_new(reset_manager_t *rm, mos6502_t *cpu, const apu_options_t *opts);
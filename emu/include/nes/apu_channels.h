@@ -12,10 +12,15 @@ typedef struct apu_envelope {
 	uint8_t decay;
 } apu_envelope_t;
 
+// Each channel's timer is kept as the master cycle number of its next edge
+// (when it reaches 0, is reloaded, and clocks the channel's sequencer). The APU
+// advances it by the channel's period (in CPU cycles, as given by the
+// channel's `_period()` routine) rather than ticking it, and skips edges in
+// bulk when they can't change what the channel outputs.
+
 typedef struct apu_channel_pulse {
-	uint8_t sequence[8];
+	uint64_t next_edge;
 	uint8_t sequence_pos;
-	uint16_t timer;
 	uint8_t length_counter;
 	uint8_t sweep_counter;
 	bool reload_sweep;
@@ -24,8 +29,8 @@ typedef struct apu_channel_pulse {
 } apu_channel_pulse_t;
 
 typedef struct apu_channel_triangle {
+	uint64_t next_edge;
 	uint8_t sequence_pos;
-	uint16_t timer;
 	uint8_t length_counter;
 	uint8_t linear_counter;
 	bool reload_linear_counter;
@@ -34,12 +39,17 @@ typedef struct apu_channel_triangle {
 typedef struct apu_channel_noise {
 	apu_envelope_t envelope;
 	uint8_t length_counter;
-	uint16_t timer;
+	uint64_t next_edge;
 	uint16_t shift_reg;
 } apu_channel_noise_t;
 
+// The routine that the DMC fetches each sample byte with, as the CPU would
+// read it from `addr`
+typedef uint8_t apu_dmc_fetch_t (void * nullable ctx, uint16_t addr);
+
 typedef struct apu_dmc_mem_reader {
-	struct membus * nonnull /*unowned*/ bus;
+	apu_dmc_fetch_t * nonnull fetch;
+	void * nullable /*unowned*/ fetch_ctx;
 	uint16_t sample_start;
 	uint16_t addr;
 	uint16_t sample_len;
@@ -58,7 +68,7 @@ typedef struct apu_channel_dmc {
 	apu_dmc_mem_reader_t mem_reader;
 	apu_dmc_output_unit_t output_unit;
 	uint8_t sample_buffer;
-	uint8_t timer;
+	uint64_t next_edge;
 } apu_channel_dmc_t;
 
 void apu_envelope_quarter_frame(apu_envelope_t *evl, bool loop_flag, uint8_t period);
@@ -70,7 +80,11 @@ void apu_pulse_deactivate(apu_channel_pulse_t *ch);
 void apu_pulse_set_lc(apu_channel_pulse_t *ch, uint8_t val);
 void apu_pulse_quarter_frame(apu_channel_pulse_t *ch, const apu_reg_pulse_t *reg);
 void apu_pulse_half_frame(apu_channel_pulse_t *ch, apu_reg_pulse_t *reg);
-void apu_pulse_tick(apu_channel_pulse_t *ch, const apu_reg_pulse_t *reg);
+void apu_pulse_skip_half_frames(apu_channel_pulse_t *ch, const apu_reg_pulse_t *reg, uint64_t nhalves);
+uint16_t apu_pulse_period(const apu_reg_pulse_t *reg);
+bool apu_pulse_is_audible(const apu_channel_pulse_t *ch, const apu_reg_pulse_t *reg);
+void apu_pulse_step(apu_channel_pulse_t *ch, const apu_reg_pulse_t *reg);
+void apu_pulse_skip(apu_channel_pulse_t *ch, const apu_reg_pulse_t *reg, uint64_t nsteps);
 uint8_t apu_pulse_sample(const apu_channel_pulse_t *ch, const apu_reg_pulse_t *reg);
 
 bool apu_triangle_is_active(const apu_channel_triangle_t *ch);
@@ -78,7 +92,10 @@ void apu_triangle_deactivate(apu_channel_triangle_t *ch);
 void apu_triangle_set_lc(apu_channel_triangle_t *ch, uint8_t val);
 void apu_triangle_quarter_frame(apu_channel_triangle_t *ch, const apu_reg_triangle_t *reg);
 void apu_triangle_half_frame(apu_channel_triangle_t *ch, apu_reg_triangle_t *reg);
-void apu_triangle_tick(apu_channel_triangle_t *ch, const apu_reg_triangle_t *reg);
+void apu_triangle_skip_half_frames(apu_channel_triangle_t *ch, const apu_reg_triangle_t *reg, uint64_t nhalves);
+uint16_t apu_triangle_period(const apu_reg_triangle_t *reg);
+bool apu_triangle_is_stepping(const apu_channel_triangle_t *ch, const apu_reg_triangle_t *reg);
+void apu_triangle_step(apu_channel_triangle_t *ch, const apu_reg_triangle_t *reg);
 uint8_t apu_triangle_sample(const apu_channel_triangle_t *ch, const apu_reg_triangle_t *reg);
 
 bool apu_noise_is_active(const apu_channel_noise_t *ch);
@@ -86,10 +103,16 @@ void apu_noise_deactivate(apu_channel_noise_t *ch);
 void apu_noise_set_lc(apu_channel_noise_t *ch, uint8_t val);
 void apu_noise_quarter_frame(apu_channel_noise_t *ch, const apu_reg_noise_t *reg);
 void apu_noise_half_frame(apu_channel_noise_t *ch, apu_reg_noise_t *reg);
-void apu_noise_tick(apu_channel_noise_t *ch, const apu_reg_noise_t *reg);
+void apu_noise_skip_half_frames(apu_channel_noise_t *ch, const apu_reg_noise_t *reg, uint64_t nhalves);
+uint16_t apu_noise_period(const apu_reg_noise_t *reg);
+bool apu_noise_is_audible(const apu_channel_noise_t *ch, const apu_reg_noise_t *reg);
+void apu_noise_step(apu_channel_noise_t *ch, const apu_reg_noise_t *reg);
+void apu_noise_skip(apu_channel_noise_t *ch, const apu_reg_noise_t *reg, uint64_t nsteps);
 uint8_t apu_noise_sample(const apu_channel_noise_t *ch, const apu_reg_noise_t *reg);
 
 void apu_dmc_restart(apu_channel_dmc_t *ch);
 bool apu_dmc_is_active(const apu_channel_dmc_t *ch);
-void apu_dmc_tick(apu_channel_dmc_t *ch, const apu_reg_dmc_t *reg);
+uint16_t apu_dmc_period(const apu_reg_dmc_t *reg);
+void apu_dmc_step(apu_channel_dmc_t *ch, const apu_reg_dmc_t *reg);
+void apu_dmc_skip(apu_channel_dmc_t *ch, const apu_reg_dmc_t *reg, uint64_t nsteps);
 uint8_t apu_dmc_sample(const apu_channel_dmc_t *ch, const apu_reg_dmc_t *reg);
\ No newline at end of file
@@ -0,0 +1,67 @@
+#pragma once
+
+// The registers and channels of an APU, as they're changed by writes to the
+// registers and by the frame counter's steps. Time only comes into it through
+// the channels' edges, which the owner runs (or skips) up to each change. This
+// lets more than one thread keep a copy: the emulation thread keeps one to
+// answer the CPU with, and the synthesis thread keeps another, fed with the
+// same writes, to synthesize samples from.
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <base.h>
+#include <mos6502/mos6502.h>
+#include <nes/apu_regs.h>
+#include <nes/apu_channels.h>
+
+// The master cycles between the frame counter's steps, which are counted from
+// reset
+#define APU_QUARTER_FRAME (358000 / 4)
+
+typedef struct apu_frame_counter {
+	uint8_t step;
+	bool irq_flag;
+} apu_frame_counter_t;
+
+typedef struct apu_state {
+	union {
+		apu_regs_t regs;
+		uint8_t reg_bytes[0x18];
+	};
+
+	apu_channel_pulse_t pulse1;
+	apu_channel_pulse_t pulse2;
+	apu_channel_triangle_t triangle;
+	apu_channel_noise_t noise;
+	apu_channel_dmc_t dmc;
+
+	apu_frame_counter_t frame_counter;
+} apu_state_t;
+
+// Moves a timer's next edge past `clk`, and returns how many edges that
+// skipped
+static inline uint64_t apu_skip_edges(uint64_t *next_edge, uint16_t period, uint64_t clk) {
+	if (*next_edge > clk) {
+		return 0;
+	}
+	uint64_t period_clks = (uint64_t)period * MOS6502_CLKDIVISOR;
+	uint64_t nedges = (clk - *next_edge) / period_clks + 1;
+	*next_edge += nedges * period_clks;
+	return nedges;
+}
+
+// Puts everything back to its power-up state, except for where the DMC
+// fetches its sample bytes from
+void apu_state_reset(apu_state_t *state);
+
+// Writes `data` to the register at `addr` (an offset from $4000)
+void apu_state_write(apu_state_t *state, uint16_t addr, uint8_t data);
+
+// Moves the frame counter on a step, clocking the channels' envelopes,
+// counters and sweeps
+void apu_state_frame_step(apu_state_t *state);
+
+// Moves the frame counter on `nsteps` steps at once, keeping up only what the
+// CPU can see: the length counters and the frame IRQ flag
+void apu_state_skip_frame_steps(apu_state_t *state, uint64_t nsteps);
@@ -0,0 +1,40 @@
+#pragma once
+
+// APU synthesis runs on a thread of its own. The emulation thread logs every
+// write to the APU's registers, stamped with the master cycle it happened on,
+// along with every byte that the DMC fetches, and marks how far emulation has
+// got once every frame counter step. The synthesis thread replays the log
+// through its own copy of the APU's state, running the channels edge by edge
+// in between, and hands each step's block of samples to the audio sink (and
+// the tap).
+//
+// The log is a lock-free ring with one producer and one consumer. Entries
+// can't be dropped, so the emulation thread waits for room if the synthesis
+// thread ever falls a whole ring behind.
+
+#include <stdint.h>
+
+#include <base.h>
+#include <nes/apu.h>
+
+typedef struct apu_synth apu_synth_t;
+
+// Starts a synthesis thread for an APU clocked at `clk_rate` Hz, which sends
+// its samples where `opts` says
+apu_synth_t * nullable apu_synth_new(const apu_options_t * nonnull opts, double clk_rate);
+
+// Logs a write of `data` to the register at `addr` (an offset from $4000) at
+// master cycle `clk`
+void apu_synth_write(apu_synth_t * nonnull synth, uint64_t clk, uint16_t addr, uint8_t data);
+
+// Logs the next byte that the DMC fetched. The synthesis thread's DMC takes
+// its bytes from these rather than from memory, which the emulation thread
+// may have changed (e.g. by switching banks) by the time they're needed.
+void apu_synth_fetch(apu_synth_t * nonnull synth, uint8_t data);
+
+// Logs that emulation has got as far as master cycle `clk`, and wakes the
+// synthesis thread to catch up
+void apu_synth_sync(apu_synth_t * nonnull synth, uint64_t clk);
+
+// Logs a reset, after which master cycles count from 0 again
+void apu_synth_reset(apu_synth_t * nonnull synth);
@@ -0,0 +1,40 @@
+#pragma once
+
+// An audio ring passes samples from one producer thread (the APU synthesis
+// thread) to one consumer thread (an audio device's callback) without locks. The
+// producer only ever advances `head` and the consumer only `tail`, so each
+// side only has to wait on the other's progress, never on a lock it holds.
+
+#include <base.h>
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+typedef struct audio_ring {
+	float * nullable /*owned*/ samples;
+	size_t capacity;
+
+	// The two indices are kept a cache line apart, so that the threads
+	// don't fight over one
+	atomic_size_t head;
+	char pad[64 - sizeof(atomic_size_t)];
+	atomic_size_t tail;
+} audio_ring_t;
+
+// Allocates room for `capacity` samples, which must be a power of two
+int audio_ring_init (audio_ring_t * nonnull ring, size_t capacity);
+
+// Frees the ring's samples
+void audio_ring_deinit (audio_ring_t * nonnull ring);
+
+// Returns how many samples are waiting to be read. The other thread may change
+// this right away, so it's only exact for the side that's calling.
+size_t audio_ring_fill (audio_ring_t * nonnull ring);
+
+// Appends as many of `samples` as there is room for, and returns how many that
+// was. Only to be called by the producer.
+size_t audio_ring_write (audio_ring_t * nonnull ring, const float * nonnull samples, size_t nsamples);
+
+// Takes up to `nsamples` of the oldest samples into `samples`, and returns how
+// many there were. Only to be called by the consumer.
+size_t audio_ring_read (audio_ring_t * nonnull ring, float * nonnull samples, size_t nsamples);
@@ -0,0 +1,67 @@
+#pragma once
+
+// Audio sinks are where the APU sends each block of samples once it's
+// synthesized them. Whether samples are played on a sound device, thrown away
+// (e.g. on machines without one), or streamed to a file is decided by which
+// sink the APU was given.
+
+#include <base.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// How a sound device has kept up with the samples it's given. Samples are
+// passed to the device through a ring, which is kept near a target latency by
+// nudging the rate that the device plays samples at.
+typedef struct audiosink_stats {
+	// How many times the device found the ring empty, and how many times the
+	// ring was too full to take all of a batch of samples (dropping the rest)
+	size_t nunderruns;
+	size_t noverruns;
+
+	// How far (in milliseconds) the device is playing behind emulation, on
+	// average, and what it's being kept near
+	double latency_ms;
+	double target_latency_ms;
+
+	// How much faster than the sample rate the device is playing samples
+	double rate_ratio;
+} audiosink_stats_t;
+
+// The common part of every audio sink. Sinks are reference-counted objects
+// that begin with this struct.
+typedef struct audiosink {
+	void (* nonnull push)(struct audiosink * nonnull sink, const float * nonnull samples, size_t nsamples);
+	int (* nullable get_stats)(struct audiosink * nonnull sink, audiosink_stats_t * nonnull stats);
+
+	// Set by sinks that throw every sample away, so that the APU can skip
+	// synthesizing them
+	bool discards;
+} audiosink_t;
+
+// Creates a sink that plays samples at `sample_rate` on the default sound
+// device, initializing the SDL audio subsystem for the lifetime of the sink.
+// The device pulls samples on its own thread, so pushing them never blocks.
+audiosink_t * nullable audiosink_new_sdl (uint32_t sample_rate);
+
+// Creates a sink that discards every sample
+audiosink_t * nullable audiosink_new_null (void);
+
+// Creates a sink that streams samples at `sample_rate` to the WAV file at
+// `path`, through a buffer. The header is filled in once the sink is released
+// (and every second or so before that).
+audiosink_t * nullable audiosink_new_wav (const char * nonnull path, uint32_t sample_rate);
+
+// Hands a block of samples to `sink`. The samples are only read during the
+// call.
+void audiosink_push (audiosink_t * nonnull sink, const float * nonnull samples, size_t nsamples);
+
+// Fills in `stats` for a sink that plays samples on a device. Returns -1 for
+// any other sink.
+int audiosink_get_stats (audiosink_t * nonnull sink, audiosink_stats_t * nonnull stats);
+
+// Writes a WAV header to the start of `f` for `data_size` bytes of mono 32-bit
+// float samples at `sample_rate`, and goes back to the end of the file
+int audiosink_write_wav_header (FILE * nonnull f, uint32_t sample_rate, size_t data_size);
@@ -0,0 +1,51 @@
+#pragma once
+
+// A chain of up to `BIQUAD_NSTAGES` biquad filters, run over whole blocks of
+// samples. A biquad's output depends on its previous outputs, so a stage can't
+// be vectorized across samples. Instead the stages are pipelined, one per
+// vector lane: in each step, every stage takes the sample that the stage
+// before it produced in the last step. The chain's output lags its input by
+// `BIQUAD_NSTAGES - 1` samples in exchange.
+
+#include <base.h>
+
+#include <stddef.h>
+
+#define BIQUAD_NSTAGES 4
+
+// The coefficients of y[n] = b0 x[n] + b1 x[n-1] + b2 x[n-2]
+//                            - a1 y[n-1] - a2 y[n-2]
+typedef struct biquad_coeffs {
+	float b0, b1, b2;
+	float a1, a2;
+} biquad_coeffs_t;
+
+typedef struct biquad_chain {
+	// The coefficients of each stage, one lane per stage
+	float b0[BIQUAD_NSTAGES];
+	float b1[BIQUAD_NSTAGES];
+	float b2[BIQUAD_NSTAGES];
+	float a1[BIQUAD_NSTAGES];
+	float a2[BIQUAD_NSTAGES];
+
+	// Each stage's last two inputs and outputs
+	float x1[BIQUAD_NSTAGES];
+	float x2[BIQUAD_NSTAGES];
+	float y1[BIQUAD_NSTAGES];
+	float y2[BIQUAD_NSTAGES];
+} biquad_chain_t;
+
+// A first-order RC high-pass or low-pass filter with its corner at `cutoff`
+// Hz, as a biquad
+biquad_coeffs_t biquad_highpass1 (double cutoff, double sample_rate);
+biquad_coeffs_t biquad_lowpass1 (double cutoff, double sample_rate);
+
+// Sets up a chain of `nstages` filters, applied in order. The stages past
+// those pass samples through unchanged.
+void biquad_chain_init (biquad_chain_t * nonnull chain, const biquad_coeffs_t * nonnull stages, size_t nstages);
+
+// Clears the filters' state, as if they had only ever been given silence
+void biquad_chain_reset (biquad_chain_t * nonnull chain);
+
+// Filters `nsamples` samples in place
+void biquad_chain_process (biquad_chain_t * nonnull chain, float * nonnull samples, size_t nsamples);
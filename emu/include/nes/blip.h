@@ -0,0 +1,70 @@
+#pragma once
+
+// A blip buffer turns a signal given as a series of steps (changes in
+// amplitude at points in time) into samples, without the aliasing that comes
+// from point-sampling it. Each step is added to the buffer as a band-limited
+// step: the difference between consecutive samples of a windowed-sinc step
+// response, starting at the step's position between two samples. Summing up
+// the buffer then gives the band-limited signal, so that the cost is in the
+// number of steps rather than in the number of clock cycles.
+//
+// Time is measured in cycles of a source clock, as absolute cycle numbers.
+// Steps are added in any order up to the end of the current block, which
+// `blip_end_block()` then makes available to be read. Within a block, steps
+// are placed in 32.32 fixed point, but where each block ends is worked out from
+// the exact ratio between the two rates, so that the samples never drift from
+// the source clock.
+
+#include <base.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The number of samples that each step is spread over, and the number of
+// positions between two samples that a step can start at
+#define BLIP_KERNEL_WIDTH 16
+#define BLIP_NPHASES 64
+
+// The most samples the buffer holds before they have to be read
+#define BLIP_NSAMPLES 4096
+
+typedef struct blip {
+	// A source clock cycle is exactly `num / den` samples long
+	uint64_t num;
+	uint64_t den;
+
+	// The length of a source clock cycle in samples, and the position of
+	// `clk_start` in the buffer, as 32.32 fixed-point numbers. The fraction of
+	// `pos_start` is exactly `rem / den`, rounded down.
+	uint64_t factor;
+	uint64_t pos_start;
+	uint64_t clk_start;
+	uint64_t rem;
+
+	// The running sum of the samples read so far
+	double integrator;
+
+	float kernels[BLIP_NPHASES][BLIP_KERNEL_WIDTH];
+	float buf[BLIP_NSAMPLES + BLIP_KERNEL_WIDTH];
+} blip_t;
+
+// Sets up a blip buffer that samples at `sample_rate` a signal timed by a
+// clock running at `clock_rate`. The ratio between the two is taken to be the
+// simplest fraction that they give to within double precision.
+void blip_init (blip_t * nonnull blip, double clock_rate, double sample_rate);
+
+// Empties the buffer, and starts the next block at cycle `clk`. The signal
+// starts at 0.
+void blip_reset (blip_t * nonnull blip, uint64_t clk);
+
+// Adds a step of `delta` at cycle `clk`, which must be within the current
+// block. Steps past the end of the buffer are dropped.
+void blip_add_delta (blip_t * nonnull blip, uint64_t clk, float delta);
+
+// Ends the current block at cycle `clk` and starts the next there. Returns the
+// number of samples that can now be read.
+size_t blip_end_block (blip_t * nonnull blip, uint64_t clk);
+
+// Reads up to `nsamples` finished samples into `samples`, and returns how many
+// were read
+size_t blip_read_samples (blip_t * nonnull blip, float * nonnull samples, size_t nsamples);
@@ -0,0 +1,6 @@
+#pragma once
+
+#include <ines.h>
+
+// Sets up a CNROM
+int cnrom_setup (rominfo_t * nonnull info);
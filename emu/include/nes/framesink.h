@@ -0,0 +1,46 @@
+#pragma once
+
+// Frame sinks are where the PPU sends each frame once it's finished. The PPU
+// itself only ever draws into its own indexed frame buffer, so whether frames
+// end up in a window, nowhere at all (e.g. on headless machines), or somewhere
+// else entirely is decided by which sink it was given.
+
+#include <base.h>
+
+struct ppu;
+struct ntsc_filter;
+
+// The common part of every frame sink. Sinks are reference-counted objects
+// that begin with this struct.
+typedef struct framesink {
+	void (* nonnull present)(struct framesink * nonnull sink, const struct ppu * nonnull ppu);
+
+	// Called instead of `present` for each frame the PPU skipped drawing
+	// (e.g. with frame skipping), for sinks that need to account for the
+	// time it covered
+	void (* nullable skip)(struct framesink * nonnull sink, const struct ppu * nonnull ppu);
+} framesink_t;
+
+// The type of the routine that callback sinks hand frames to. The frame is
+// only valid for the duration of the call.
+typedef void framesink_callback_t (void * nullable ctx, const struct ppu * nonnull ppu);
+
+// Creates a sink that displays frames in an SDL window, upscaled by `scale`,
+// after putting them through `filter` if it's given. The window lives on its
+// own render thread, which initializes the SDL video subsystem, filters frames,
+// and polls events (publishing the keyboard state for the controllers) for the
+// lifetime of the sink. Presenting a frame only copies
+// it for that thread, dropping any it hasn't displayed yet.
+framesink_t * nullable framesink_new_sdl (int scale, struct ntsc_filter * nullable filter);
+
+// Creates a sink that discards every frame
+framesink_t * nullable framesink_new_null (void);
+
+// Creates a sink that passes every frame to `callback`, along with `ctx`
+framesink_t * nullable framesink_new_callback (framesink_callback_t * nonnull callback, void * nullable ctx);
+
+// Hands a finished frame from `ppu` to `sink`
+void framesink_present (framesink_t * nonnull sink, const struct ppu * nonnull ppu);
+
+// Tells `sink` that `ppu` skipped a frame
+void framesink_skip (framesink_t * nonnull sink, const struct ppu * nonnull ppu);
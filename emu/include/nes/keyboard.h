@@ -0,0 +1,18 @@
+#pragma once
+
+// SDL only lets the thread that initialized video pump its event queue, which
+// is what keeps its keyboard state up to date. That thread (the render thread)
+// publishes a copy of the keyboard state each time it polls events, which any
+// other thread can then take a consistent snapshot of. Until the first
+// publish (e.g. when running headless), no key reads as held.
+
+#include <SDL2/SDL.h>
+
+#include <stdint.h>
+
+// Publishes SDL's current keyboard state. Only the thread that pumps SDL's
+// events may call this.
+void keyboard_publish (void);
+
+// Copies the last published keyboard state into `state`, indexed by scancode
+void keyboard_snapshot (uint8_t state[SDL_NUM_SCANCODES]);
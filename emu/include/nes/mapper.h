@@ -0,0 +1,103 @@
+#pragma once
+
+#include <base.h>
+#include <ines.h>
+#include <memory.h>
+#include <nes/ppu.h>
+#include <mos6502/mos6502.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The most bank windows a mapper can divide PRGROM ($8000-$FFFF) and CHR
+// ($0000-$1FFF) into, at the smallest window sizes it can pick (8K and 1K)
+#define MAPPER_MAX_PRG_WINDOWS 4
+#define MAPPER_MAX_CHR_WINDOWS 8
+
+// How the two nametables in VRAM are laid out over the four nametable slots
+typedef enum mapper_mirroring {
+	MAPPER_MIRRORING_HORIZONTAL = 0,
+	MAPPER_MIRRORING_VERTICAL = 1,
+	MAPPER_MIRRORING_ONE_SCREEN_LOW = 2,
+	MAPPER_MIRRORING_ONE_SCREEN_HIGH = 3,
+} mapper_mirroring_t;
+
+struct mapper;
+
+// What a mapper declares about itself: how it divides PRGROM and CHR into
+// bank windows, and the routines that the framework calls on reset, on writes
+// to its registers, and on rises of the PPU's A12 address line
+typedef struct mapper_ops {
+	const char * nonnull name;
+
+	// The size of each PRG bank window (from $8000 on) and CHR bank window
+	// (from $0000 on)
+	uint16_t prg_window_size;
+	uint16_t chr_window_size;
+
+	// Called on every reset, once every window has been forgotten. This
+	// must map every window again.
+	void (* nonnull reset)(struct mapper * nonnull mapper);
+
+	// Called on every CPU write to $8000-$FFFF, with the full address. The
+	// PPU has been brought up to date beforehand, so banks can be switched
+	// right away.
+	void (* nullable write)(struct mapper * nonnull mapper, uint16_t addr, uint8_t val);
+
+	// Called on each rendered scanline at the dot that the PPU's A12
+	// address line rises on, if the pattern tables it fetches from make it
+	// rise at all
+	void (* nullable a12_rise)(struct mapper * nonnull mapper);
+} mapper_ops_t;
+
+// The common part of every mapper. Mappers are reference-counted objects that
+// begin with this struct. The framework keeps track of which bank is in each
+// window, and only remaps (and has the PPU re-decode CHR) when one changes.
+// Banks are mapped straight into the CPU's and PPU's memory buses, so reads
+// from them never go through the mapper.
+typedef struct mapper {
+	const mapper_ops_t * nonnull ops;
+
+	mos6502_t * nonnull /*unowned*/ cpu;
+	ppu_t * nonnull /*unowned*/ ppu;
+
+	// CHR is either CHRROM or CHRRAM, whichever the ROM has. WRAM at
+	// $6000-$7FFF is the volatile part (`wram`) followed by the
+	// battery-backed part (`sram`), mirrored to fill the 8K.
+	memory_t * nonnull /*strong*/ prgrom;
+	memory_t * nonnull /*strong*/ chr;
+	memory_t * nullable /*strong*/ wram;
+	memory_t * nullable /*strong*/ sram;
+	memory_t * nonnull /*strong*/ vram;
+
+	// The offsets mapped into each window, or `SIZE_MAX` for none
+	size_t prg_offsets[MAPPER_MAX_PRG_WINDOWS];
+	size_t chr_offsets[MAPPER_MAX_CHR_WINDOWS];
+
+	// The mirroring as set up at power-on (from the ROM's header), and as
+	// currently mapped (or -1 for none)
+	mapper_mirroring_t default_mirroring;
+	int mirroring;
+} mapper_t;
+
+// Checks that `info` has the memories that a mapper with `ops` can use, and
+// creates a reference-counted mapper of `size` bytes (a struct beginning with
+// `mapper_t`) with them. The mapper is registered for resets, CPU writes, and
+// (if `ops` has `a12_rise`) A12 rises, and its memory maps are set up as they
+// are after a reset. Returns NULL if the ROM can't be used.
+mapper_t * nullable mapper_new (rominfo_t * nonnull info, const mapper_ops_t * nonnull ops, size_t size);
+
+// The total size of WRAM, volatile and battery-backed
+size_t mapper_wram_size (const mapper_t * nonnull mapper);
+
+// The number of banks of PRGROM and CHR, in units of the window size
+size_t mapper_prg_nbanks (const mapper_t * nonnull mapper);
+size_t mapper_chr_nbanks (const mapper_t * nonnull mapper);
+
+// Maps bank number `bank` (wrapped around the number of banks) into PRG
+// window `window` or CHR window `window`
+void mapper_map_prg (mapper_t * nonnull mapper, size_t window, size_t bank);
+void mapper_map_chr (mapper_t * nonnull mapper, size_t window, size_t bank);
+
+// Lays out the nametables with `mirroring`
+void mapper_set_mirroring (mapper_t * nonnull mapper, mapper_mirroring_t mirroring);
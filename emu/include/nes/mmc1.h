@@ -1,7 +1,6 @@
 #pragma once
 
 #include <base.h>
-#include <memory.h>
 
 #include <stdint.h>
 #include <stdbool.h>
@@ -92,8 +91,3 @@ void mmc1_reg_write (mmc1_t * nonnull mmc1,
 		     size_t regnum,
 		     uint8_t val,
 		     uint64_t cpu_cyclenum);
-
-// Sets up VRAM mappings to a memory bus based on an MMC1's mapping state
-void mmc1_map_vram (mmc1_t * nonnull mmc1,
-		    membus_t * nonnull bus,
-		    memory_t * nonnull vram);
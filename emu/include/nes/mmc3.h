@@ -0,0 +1,6 @@
+#pragma once
+
+#include <ines.h>
+
+// Sets up an MMC3
+int mmc3_setup (rominfo_t * nonnull info);
@@ -0,0 +1,57 @@
+#pragma once
+
+// The NTSC filter turns indexed frames into what they'd look like through a
+// composite video connection: each pixel is turned into the NES's video
+// signal, eight samples of a square wave at twelve phases per color subcarrier
+// cycle, and the signal is then decoded back into luma and chroma the way a
+// television would. This blurs sharp edges, fringes them with color, and makes
+// the dithering that many games relied on blend into solid colors.
+//
+// Since both steps are linear, the filter doesn't generate any signal while
+// running. Instead, it precomputes how each color at each subcarrier phase
+// contributes to the nearby output pixels, and then only sums those
+// contributions for each pixel of a frame. Flat areas come out in the colors
+// of the palette in use, so only the artifacts come from the signal model.
+//
+// Each row only depends on its own pixels and its subcarrier phase, which
+// alternates between two values from frame to frame. Rows that are unchanged
+// since the last frame with the same phase aren't filtered again.
+
+#include <base.h>
+#include <nes/ppu.h>
+
+#include <stdint.h>
+
+// Every input pixel becomes two output pixels
+#define NTSC_OUTPUT_WIDTH (PPU_OUTPUT_WIDTH * 2)
+#define NTSC_OUTPUT_HEIGHT PPU_OUTPUT_HEIGHT
+
+typedef struct ntsc_options {
+	// How sharp luma is decoded, from 0 (blurred over a whole subcarrier
+	// cycle, which is about three input pixels) to 1 (about one input pixel)
+	float sharpness;
+
+	// How much luma and chroma bleed into each other, from 0 (not at all,
+	// like S-Video) to 1 (as much as through composite video)
+	float artifacts;
+
+	// The number of worker threads that filter bands of rows alongside the
+	// caller, or 0 for one less than the number of CPUs
+	unsigned nthreads;
+} ntsc_options_t;
+
+typedef struct ntsc_filter ntsc_filter_t;
+
+// Allocates a new reference-counted NTSC filter, and starts its workers. The
+// filter can't be used until it has been given a palette.
+ntsc_filter_t * nullable ntsc_filter_new (const ntsc_options_t * nonnull opts);
+
+// Makes flat areas come out in the colors of `palette_rgba` (laid out like
+// `ppu->palette_rgba`)
+void ntsc_filter_set_palette (ntsc_filter_t * nonnull ntsc, const uint32_t * nonnull palette_rgba);
+
+// Filters `frame` (laid out like `ppu->frame`), which is frame number
+// `framenum`, into RGBA32 pixels. The result is `NTSC_OUTPUT_WIDTH` by
+// `NTSC_OUTPUT_HEIGHT` pixels with no gaps between rows, and is valid until
+// the next call.
+const uint32_t * nonnull ntsc_filter_frame (ntsc_filter_t * nonnull ntsc, const uint16_t * nonnull frame, uint64_t framenum);
@@ -2,5 +2,6 @@
 
 #include <reset_manager.h>
 #include <mos6502/mos6502.h>
+#include <nes/apu.h>
 
-int pageforty_setup (reset_manager_t * nonnull rm, mos6502_t * nonnull cpu, const char * nonnull cscheme_path);
+int pageforty_setup (reset_manager_t * nonnull rm, mos6502_t * nonnull cpu, const char * nonnull cscheme_path, const apu_options_t * nonnull apu_opts);
@@ -2,6 +2,7 @@
 
 #include <membus.h>
 #include <timekeeper.h>
+#include <nes/framesink.h>
 #include <mos6502/mos6502.h>
 
 #include <stdbool.h>
@@ -10,6 +11,22 @@
 #define PPU_OUTPUT_HEIGHT 240
 #define PPU_CLKDIVISOR 4
 
+// The number of distinct output colors: 64 palette colors, each with every
+// combination of the three color emphasis bits
+#define PPU_NCOLORS 512
+
+// The value of pixels in `ppu->frame` that haven't been drawn since the PPU was
+// created, which are output as transparent black
+#define PPU_PIXEL_BLANK PPU_NCOLORS
+
+// The number of 16-byte CHR tiles in the two pattern tables ($0000-$1FFF)
+#define PPU_CHR_NTILES 512
+
+// The size of a CHR window or nametable slot, and how many of them there are
+// ($0000-$2FFF)
+#define PPU_WINDOW_SIZE 0x400
+#define PPU_NWINDOWS 12
+
 typedef enum ppu_vram_addr_inc {
 	PPU_VRAM_ADDR_INC_1 = 0,
 	PPU_VRAM_ADDR_INC_32 = 1,
@@ -47,6 +64,70 @@ typedef struct ppu_sprite {
 	uint8_t xpos;
 } ppu_sprite_t;
 
+// How the PPU produces the visible part of each scanline
+typedef enum ppu_renderer {
+	// Every dot is run through the full per-dot state machine
+	PPU_RENDERER_DOT = 0,
+
+	// Visible scanlines are rendered in one go, unless the CPU interacts
+	// with the PPU partway through, in which case the remainder of that
+	// scanline falls back to the per-dot state machine
+	PPU_RENDERER_SCANLINE = 1,
+
+	// Like `PPU_RENDERER_SCANLINE`, but every scanline rendered in one go
+	// is also run through the per-dot state machine, and each frame's
+	// hash is compared between the two
+	PPU_RENDERER_VERIFY = 2,
+
+	// Like `PPU_RENDERER_SCANLINE`, but scanlines rendered in one go are
+	// only timed in-line (so that status flags come out right), and their
+	// pixels are drawn in batches by worker threads, from a log of what
+	// each scanline was rendered with
+	PPU_RENDERER_PARALLEL = 3,
+} PACKED ppu_renderer_t;
+
+// The most frames in a row that adaptive frame skipping will skip
+#define PPU_MAX_SKIPPED_FRAMES 4
+
+// Options given to `ppu_new()`
+typedef struct ppu_options {
+	framesink_t * nonnull /*unowned*/ sink;
+	ppu_renderer_t renderer;
+
+	// Frame skipping: only every `frame_interval`th frame is drawn (0 and
+	// 1 both meaning every frame), and if `adaptive_skip` is set, frames
+	// are also skipped while emulation is behind real time. Skipped frames
+	// still produce every status flag and interrupt that a drawn frame
+	// would, but aren't drawn or presented.
+	unsigned frame_interval;
+	bool adaptive_skip;
+
+	// The number of worker threads for `PPU_RENDERER_PARALLEL`, or 0 for
+	// one less than the number of CPUs
+	unsigned nrender_threads;
+} ppu_options_t;
+
+// What made the PPU catch up with virtual time partway through a scanline it
+// had deferred, for `ppu_print_stats()`
+typedef enum ppu_sync_cause {
+	PPU_SYNC_STATUS_READ = 0,  // PPUSTATUS ($2002)
+	PPU_SYNC_OAMDATA_READ = 1, // OAMDATA ($2004)
+	PPU_SYNC_PPUDATA_READ = 2, // PPUDATA ($2007)
+	PPU_SYNC_OTHER_READ = 3,   // Any other register
+	PPU_SYNC_WRITE = 4,        // Any register
+	PPU_SYNC_MAPPER = 5,       // `ppu_sync()`
+	PPU_NSYNC_CAUSES = 6,
+} ppu_sync_cause_t;
+
+// A CHR tile, pre-decoded into rows of eight one-byte pixels (0 through 3),
+// with the leftmost pixel in the least significant byte. Each row is also kept
+// horizontally flipped, for sprites.
+typedef struct ppu_chr_tile {
+	uint64_t rows[8];
+	uint64_t flipped_rows[8];
+	bool valid;
+} ppu_chr_tile_t;
+
 typedef struct ppu_pixel {
 	uint8_t palette_color : 6;
 	bool emph_red         : 1;
@@ -65,12 +146,75 @@ typedef struct ppu {
 	size_t dotnum;
 	size_t overflow_dotnum;
 
-	struct SDL_Window * nonnull /*owned*/ win;
-	struct SDL_Renderer * nonnull /*owned*/ rend;
-	struct SDL_Texture * nonnull /*owned*/ tex;
-
-	uint8_t * nonnull /*unowned*/ texdata;
-	size_t texpitch;
+	ppu_renderer_t renderer;
+
+	// Frame skipping, as given in `ppu_options_t`, along with whether the
+	// current frame is being skipped and how many frames in a row have
+	// been so far
+	unsigned frame_interval;
+	bool adaptive_skip;
+	bool skip_frame;
+	unsigned nskipped;
+
+	// How many dots, starting at the cursor, the timer is currently set to
+	// pass over, since nothing happens on them
+	size_t nidle_dots;
+
+	// Set while the visible part of the current scanline has been skipped
+	// over in virtual time, and has yet to be rendered
+	bool scanline_deferred;
+
+	// How many scanlines have been deferred, and how many of those had to
+	// be caught up with early, by cause
+	size_t ndeferred_scanlines;
+	size_t nsyncs[PPU_NSYNC_CAUSES];
+
+	// The dot of the deferred scanline with its sprite 0 hit (or 0 if it
+	// has none), once `sprite0_hit_predicted` is set. PPUSTATUS reads are
+	// answered from this without catching up; `npredicted_reads` counts
+	// how many have been.
+	size_t sprite0_hit_dotnum;
+	bool sprite0_hit_predicted;
+	size_t npredicted_reads;
+
+	// The worker threads and scanline log for `PPU_RENDERER_PARALLEL`
+	struct ppu_workers * nullable /*owned*/ workers;
+
+	// State for `PPU_RENDERER_VERIFY`: the frame as produced by the per-dot
+	// state machine, which of its rows were actually rendered by both
+	// renderers, and how many frames have failed verification
+	uint16_t * nullable /*owned*/ verify_frame;
+	bool verify_rows[PPU_OUTPUT_HEIGHT];
+	size_t verify_nmismatches;
+
+	// Every tile in the pattern tables as currently mapped, pre-decoded.
+	// Tiles are decoded again when mappers switch CHR banks, and lazily
+	// after being written to through PPUDATA.
+	ppu_chr_tile_t * nonnull /*owned*/ chr_tiles;
+
+	// Direct pointers to the memory behind each 1K window of the PPU's
+	// memory bus below $3000: the eight CHR windows, then the four
+	// nametable slots. Rendering reads through these rather than the bus. A
+	// window is NULL unless it is mapped straight to contiguous memory (e.g.
+	// when a mapper handles reads itself to watch the PPU address lines),
+	// and is then read through the bus instead.
+	const uint8_t * nullable /*unowned*/ windows[PPU_NWINDOWS];
+
+	// The mapper watching for rises of the A12 address line (e.g. to count
+	// scanlines), and the routine that it's told of each one with. Rather
+	// than the address of every fetch being watched, the rise is scheduled
+	// once per rendered scanline, on the dot worked out from which pattern
+	// tables the background and sprites are fetched from.
+	void * nullable /*strong*/ a12_obj;
+	void (* nullable a12_rise)(void * nonnull obj);
+
+	// Where each frame goes once it's finished
+	framesink_t * nonnull /*strong*/ sink;
+
+	// The frame being drawn, as one index into `palette_rgba` per pixel: the
+	// 6-bit palette color, with the red, green, and blue emphasis bits
+	// above it (the same layout as `ppu_pixel_t`)
+	uint16_t * nonnull /*owned*/ frame;
 
 	// Mask register
 	union {
@@ -130,13 +274,17 @@ typedef struct ppu {
 
 	uint8_t fine_xscroll;
 
-	uint8_t bmp_latch[2], nt_latch, attr_latch;
+	uint64_t bmp_latch;
+	uint8_t nt_latch, attr_latch;
 
-	uint16_t bg_bmp_shiftregs[2];
+	// The background bitmap shiftregs hold 16 pre-decoded pixels, in the
+	// same layout as `ppu_chr_tile_t` rows: pixels 0 through 7 (the next to
+	// be drawn) in [0], and pixels 8 through 15 in [1]
+	uint64_t bg_bmp_shiftregs[2];
 	uint8_t bg_attr_shiftregs[2];
 	uint8_t bg_palette;
 
-	uint8_t sprite_bmp_shiftregs[8][2];
+	uint64_t sprite_bmp_shiftregs[8];
 	ppu_spriteattr_t sprite_attrs[8];
 	uint8_t sprite_xs[8];
 
@@ -149,12 +297,66 @@ typedef struct ppu {
 		uint8_t oam[sizeof(ppu_sprite_t) * 64];
 	};
 
+	// Which sprites overlap each visible scanline, as a bitmask over sprite
+	// numbers (bit 0 being sprite 0), at the current sprite size. This is
+	// kept up to date with OAM and PPUCTRL writes, so that sprite evaluation
+	// doesn't have to look at every sprite on every scanline.
+	uint64_t sprite_lines[PPU_OUTPUT_HEIGHT];
+
 	uint8_t palette_mem[32];
-	uint8_t palette_srgb[512][3];
+	uint8_t palette_srgb[PPU_NCOLORS][3];
+
+	// The `frame` pixel for each palette address: `palette_mem` with
+	// mirroring resolved and the current color emphasis applied. This is
+	// refreshed whenever either changes.
+	uint16_t palette_cache[32];
+
+	// `palette_srgb` as RGBA32 pixels, plus one for `PPU_PIXEL_BLANK`
+	uint32_t palette_rgba[PPU_NCOLORS + 1];
 } ppu_t;
 
 // Allocates and initializes a new reference-counted PPU
-ppu_t * nullable ppu_new (reset_manager_t * nonnull rm, mos6502_t * nonnull cpu, int scale);
+ppu_t * nullable ppu_new (reset_manager_t * nonnull rm,
+			  mos6502_t * nonnull cpu,
+			  const ppu_options_t * nonnull opts);
 
 // Creates the page mappings on the CPU's memory bus for the PPU registers
 void ppu_map (ppu_t * nonnull ppu);
+
+// Rebuilds `palette_rgba` from `palette_srgb`. This must be called after
+// loading `palette_srgb`.
+void ppu_load_palette_rgba (ppu_t * nonnull ppu);
+
+// Converts `frame` (laid out like `ppu->frame`) into RGBA32 pixels at `dst`,
+// with rows `pitch` bytes apart, through `palette_rgba` (like
+// `ppu->palette_rgba`)
+void ppu_frame_to_rgba (const uint32_t * nonnull palette_rgba,
+			const uint16_t * nonnull frame,
+			uint8_t * nonnull dst,
+			size_t pitch);
+
+// Decodes the CHR tiles in the `size` bytes starting at `addr` on the PPU's
+// memory bus into `chr_tiles` again, after refreshing `windows` for them.
+// Mappers must call this after changing what is mapped into the pattern
+// tables.
+void ppu_chr_rebuild (ppu_t * nonnull ppu, uint16_t addr, uint16_t size);
+
+// Refreshes `windows` for the `size` bytes starting at
+// `addr` on the PPU's memory bus, which must be whole 1K windows below $3000.
+// Mappers must call this after changing what is mapped into the nametables.
+void ppu_remap_windows (ppu_t * nonnull ppu, uint16_t addr, uint16_t size);
+
+// Arranges for `handler` to be called with `obj` whenever the PPU's A12
+// address line rises while rendering. `obj` is strongly referenced for the
+// lifetime of the PPU.
+void ppu_set_a12_handler (ppu_t * nonnull ppu, void * nonnull obj, void * nonnull handler);
+
+// Brings the PPU up to date with virtual time if it has deferred rendering of
+// the current scanline. Anything that changes state the PPU observes while
+// rendering (e.g. mapper bank switches) must call this before doing so; the
+// PPU's own registers do this automatically.
+void ppu_sync (ppu_t * nonnull ppu);
+
+// Prints how often the CPU had to wait for the PPU to catch up partway through
+// a deferred scanline, and why
+void ppu_print_stats (const ppu_t * nonnull ppu);
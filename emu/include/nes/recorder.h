@@ -0,0 +1,31 @@
+#pragma once
+
+// The recorder captures video and audio to disk for later inspection (e.g. as
+// evidence in bug reports). Frames are written to `<path>.y4m` as uncompressed
+// 4:4:4 YUV4MPEG2 and samples to `<path>.wav` as mono 32-bit float PCM.
+//
+// Emulation never waits on the disk: frames and samples are copied into
+// preallocated slots of bounded queues, and a writer thread empties them. When
+// a queue is full, whatever didn't fit is dropped and counted instead, and the
+// gap is filled in on disk by repeating the last frame or with silence, so
+// that video and audio stay in step however far behind the disk falls. Frames
+// that the PPU skips drawing are filled in the same way.
+
+#include <base.h>
+#include <nes/apu.h>
+#include <nes/framesink.h>
+
+typedef struct recorder recorder_t;
+
+// Starts recording to files named after `path`, with samples at `sample_rate`.
+// Every frame is recorded and then passed on to `next`. Returns NULL if either
+// file can't be created.
+recorder_t * nullable recorder_new (const char * nonnull path, uint32_t sample_rate, framesink_t * nonnull next);
+
+// The frame sink that records frames and passes them on. It stays valid for as
+// long as `recorder` does.
+framesink_t * nonnull recorder_sink (recorder_t * nonnull recorder);
+
+// Records a batch of samples. This is an `apu_sample_callback_t`, to be used
+// as an APU tap with `recorder` as its context.
+void recorder_push_samples (void * nullable recorder, const float * nonnull samples, size_t nsamples);
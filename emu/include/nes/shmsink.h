@@ -0,0 +1,79 @@
+#pragma once
+
+// The shared memory sink publishes every frame into a POSIX shared memory
+// object, so that other processes (stream overlays, viewers, analysis tools)
+// can read frames as they come without any copies or syscalls on the
+// emulator's side. The object holds a `shm_frames_t`: a header followed by a
+// ring of `SHM_FRAMES_NSLOTS` frame slots, which are filled in turn.
+//
+// Each slot is guarded by a seqlock. Its `seq` is odd while the emulator is
+// writing to it, and goes up by two with every frame written. To read the
+// latest frame, a reader:
+//
+//   1. Loads `npublished` (with acquire semantics). If it's 0, there is no
+//      frame yet; otherwise the latest frame is in slot
+//      `(npublished - 1) % nslots`.
+//   2. Loads that slot's `seq` (acquire), and retries if it's odd.
+//   3. Reads whatever it needs from the slot.
+//   4. Issues an acquire fence and loads `seq` again. If it changed, the
+//      emulator wrote over the slot in the meantime, and the reader retries.
+//
+// All fields are native-endian, and the layout is fixed for a given
+// `SHM_FRAMES_VERSION`.
+
+#include <base.h>
+#include <nes/ppu.h>
+#include <nes/framesink.h>
+
+#include <stdint.h>
+
+#define SHM_FRAMES_MAGIC 0x52464E48 // "HNFR"
+#define SHM_FRAMES_VERSION 1
+#define SHM_FRAMES_NSLOTS 4
+
+// Which forms of each frame are published, as a bitmask
+#define SHM_FRAMES_INDEXED 0x1
+#define SHM_FRAMES_RGBA    0x2
+
+typedef struct shm_frame_slot {
+	uint32_t seq;
+	uint32_t reserved;
+
+	// The PPU's frame number, and when the frame was published (from
+	// `CLOCK_MONOTONIC`, in nanoseconds)
+	uint64_t framenum;
+	uint64_t timestamp_ns;
+
+	// The frame as indexes into `palette_rgba`, laid out like `ppu_t`'s
+	// `frame` (valid with `SHM_FRAMES_INDEXED`)
+	uint16_t indexed[PPU_OUTPUT_WIDTH * PPU_OUTPUT_HEIGHT];
+
+	// The frame as RGBA32 pixels, row by row (valid with `SHM_FRAMES_RGBA`)
+	uint32_t rgba[PPU_OUTPUT_WIDTH * PPU_OUTPUT_HEIGHT];
+} shm_frame_slot_t;
+
+typedef struct shm_frames {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	uint32_t nslots;
+	uint32_t formats;
+
+	// How many frames have been published so far
+	uint64_t npublished;
+
+	// The colors that indexed pixels refer to, as RGBA32 (valid once a
+	// frame has been published)
+	uint32_t palette_rgba[PPU_NCOLORS + 1];
+
+	shm_frame_slot_t slots[SHM_FRAMES_NSLOTS];
+} shm_frames_t;
+
+// Creates a sink that publishes every frame, in the forms given by `formats`,
+// to the shared memory object `name` (as passed to `shm_open()`, with a leading
+// slash added if it has none), and then passes it on to `next`. The object is
+// created (or truncated) here, and unlinked when the sink is released. If the
+// emulator exits without releasing it, the object is left behind holding the
+// last frames, and is reused by the next run with the same name.
+framesink_t * nullable shmsink_new (const char * nonnull name, uint32_t formats, framesink_t * nonnull next);
@@ -0,0 +1,6 @@
+#pragma once
+
+#include <ines.h>
+
+// Sets up a UxROM
+int uxrom_setup (rominfo_t * nonnull info);
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <base.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A ROM file, mapped read-only into memory, so that its bytes are only read
+// from disk when they're touched and can be shared instead of copied. ROMs
+// with identical contents that are opened while another is still alive share
+// its mapping, whatever their paths. Memory objects wrap the image's bytes
+// (see `memory_new_external()`) and keep it alive.
+//
+// The mapping is only as constant as the file: ROM files must not be written
+// to or truncated while they're open. Writes in place show up in the emulated
+// ROM (and leave the image's hash, which the cache matches ROMs on, stale), and
+// fetches from past the end of a truncated file kill the process with SIGBUS.
+// Replacing a ROM file by renaming a new one over it is safe, since the mapping
+// keeps the old file alive.
+//
+// Like every reference-counted object, images (and the cache that finds them)
+// must only be used by one thread at a time.
+typedef struct romimage {
+	const uint8_t * nonnull bytes;
+	size_t size;
+
+	// A hash of the contents, which the cache is keyed on
+	uint64_t hash;
+
+	struct romimage * nullable /*unowned*/ next;
+} romimage_t;
+
+// Maps the ROM at `path`, or retains an open image with the same contents
+romimage_t * nullable romimage_open (const char * nonnull path);
@@ -0,0 +1,28 @@
+#pragma once
+
+// Battery-backed cartridge RAM, kept in a save file that's mapped shared into
+// memory. The RAM is the file's page cache, so writes to it need no copying
+// and outlive the process however it ends. A background thread syncs the
+// mapping to disk periodically, so that little is lost if the machine goes
+// down, and it's synced once more when the save is closed or the process
+// exits.
+//
+// Nothing else should write to or truncate a save file while it's open: the
+// emulated RAM sees any writes, and accesses to RAM past the end of a
+// truncated file kill the process with SIGBUS.
+
+#include <base.h>
+#include <memory.h>
+
+#include <stddef.h>
+
+// How often the background thread syncs each save file to disk
+#define SAVEFILE_SYNC_INTERVAL_MS 1000
+
+// Maps `size` bytes of the save file at `path` as a writeable memory object.
+// The file is created if it doesn't exist, and any part of it that's new reads
+// as $FF. A file of the wrong size is warned about, and a longer one has only
+// its first `size` bytes used. Unlike memories from `memory_new()`, the RAM
+// isn't cleared on reset. The file is synced and unmapped when the memory is
+// released.
+memory_t * nullable savefile_open (const char * nonnull path, size_t size);
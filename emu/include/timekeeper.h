@@ -43,6 +43,10 @@ void timekeeper_advance_clk (timekeeper_t * nonnull tk, uint64_t ncycles);
 // correspond. Otherwise, does nothing.
 void timekeeper_sync (timekeeper_t * nonnull tk);
 
+// Returns how far (in milliseconds) virtual time has fallen behind real time,
+// or 0 if it hasn't.
+uint32_t timekeeper_lag_ms (timekeeper_t * nonnull tk);
+
 // All real time that passes in-between calls to `timekeeper_pause()` and
 // `timekeeper_resume()` is ignored by the timekeeper when later calculating
 // how long to `timekeeper_sync()`. The behavior of unbalanced calls to these
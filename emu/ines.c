@@ -2,11 +2,16 @@
 #include <base.h>
 #include <ines.h>
 #include <fileio.h>
+#include <savefile.h>
 #include <nes/nrom.h>
 #include <nes/sxrom.h>
+#include <nes/uxrom.h>
+#include <nes/cnrom.h>
+#include <nes/mmc3.h>
 #include <nes/pageforty.h>
 
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
 
@@ -17,7 +22,7 @@ typedef enum tv_type {
 
 typedef struct flags6 {
 	ines_mirroring_t mirroring : 1;
-	bool wram_present : 1;
+	bool battery : 1;
 	bool trainer_present : 1;
 	bool four_screen_vram : 1;
 	uint8_t mapper_nib_low : 4;
@@ -97,6 +102,48 @@ decode_ram_size (size_t encoded_size)
 	}
 }
 
+typedef struct mapper_entry {
+	size_t number;
+	const char * nonnull name;
+	int (* nonnull setup)(rominfo_t * nonnull info);
+} mapper_entry_t;
+
+// The mappers that ROMs can use, by iNES mapper number
+static const mapper_entry_t mappers[] = {
+	{0, "NROM",  nrom_setup},
+	{1, "SxROM", sxrom_setup},
+	{2, "UxROM", uxrom_setup},
+	{3, "CNROM", cnrom_setup},
+	{4, "MMC3",  mmc3_setup},
+};
+
+// Opens the save file for the ROM at `path` as `size` bytes of battery-backed
+// WRAM. The save file is next to the ROM, with the ROM's extension replaced by
+// ".sav".
+static memory_t * nullable
+battery_wram_new (const char * nonnull path, size_t size)
+{
+	const char * name = strrchr(path, '/');
+	name = name ? name + 1 : path;
+	const char * ext = strrchr(name, '.');
+	size_t stem_len = (ext && ext != name) ? (size_t)(ext - path) : strlen(path);
+
+	char * save_path = malloc(stem_len + sizeof(".sav"));
+	if (!save_path) {
+		ERROR_PRINT("Could not allocate the save file's path");
+		return NULL;
+	}
+	memcpy(save_path, path, stem_len);
+	memcpy(save_path + stem_len, ".sav", sizeof(".sav"));
+
+	memory_t * wram = savefile_open(save_path, size);
+	if (wram) {
+		INFO_PRINT("Battery-backed WRAM is saved to %s", save_path);
+	}
+	free(save_path);
+	return wram;
+}
+
 // Sets up the common, mapper-independent parts of the NES memory map, and
 // returns a newly-created PPU instance
 static inline ppu_t * nullable
@@ -104,7 +151,8 @@ setup_common (reset_manager_t * nonnull rm,
 	      mos6502_t * nonnull cpu,
 	      const char * nonnull palette_path,
 	      const char * cscheme_path,
-	      int scale)
+	      const ppu_options_t * nonnull ppu_opts,
+	      const apu_options_t * nonnull apu_opts)
 {
 	ppu_t * retval = NULL;
 
@@ -118,11 +166,11 @@ setup_common (reset_manager_t * nonnull rm,
 	// was mirrored at 0x800, 0x1000, and 0x1800
 	memory_map_mirroring(ram, cpu->bus, 0x0800, 0x0800, 0x0000, 3);
 
-	if (pageforty_setup(rm, cpu, cscheme_path)) {
+	if (pageforty_setup(rm, cpu, cscheme_path, apu_opts)) {
 		goto release_ram;
 	}
 
-	ppu_t * ppu = ppu_new(rm, cpu, scale);
+	ppu_t * ppu = ppu_new(rm, cpu, ppu_opts);
 	if (!ppu) {
 		goto release_ram;
 	}
@@ -136,6 +184,7 @@ setup_common (reset_manager_t * nonnull rm,
 	if (try_fread(f, palette_path, ppu->palette_srgb, sizeof(ppu->palette_srgb))) {
 		goto close_f;
 	}
+	ppu_load_palette_rgba(ppu);
 
 	retval = rc_retain(ppu);
 
@@ -150,24 +199,28 @@ ret:
 }
 
 int
-inesrom_load (FILE * f,
+inesrom_load (romimage_t * rom,
 	      const char * path,
 	      reset_manager_t * rm,
 	      mos6502_t * cpu,
 	      const char * palette_path,
 	      const char * cscheme_path,
-	      int scale)
+	      const ppu_options_t * ppu_opts,
+	      const apu_options_t * apu_opts)
 {
 	int retcode = -1;
 
-	uint8_t header[sizeof(common_header_t) + sizeof(ines1_header_t)];
-	if (try_fread(f, path, header, sizeof(header))) {
+	// The header follows the 4-byte magic number, and the ROMs follow the
+	// header
+	size_t offset = 4 + sizeof(common_header_t) + sizeof(ines1_header_t);
+	if (rom->size < offset) {
+		ERROR_PRINT("Unexpected EOF while reading %s", path);
 		goto ret;
 	}
 
-	common_header_t * common = (common_header_t *)header;
-	ines1_header_t * ines1 = (ines1_header_t *)(common + 1);
-	ines2_header_t * ines2 = (ines2_header_t *)(common + 1);
+	const common_header_t * common = (const common_header_t *)(rom->bytes + 4);
+	const ines1_header_t * ines1 = (const ines1_header_t *)(common + 1);
+	const ines2_header_t * ines2 = (const ines2_header_t *)(common + 1);
 
 	uint8_t version = common->flags7.version;
 
@@ -191,19 +244,30 @@ inesrom_load (FILE * f,
 		chrom_size += (size_t)(ines2->flags9.chrom_size_nib << 8u) * 8192u;
 	}
 
-	size_t wram_size, chram_size;
+	// The volatile and battery-backed parts of WRAM
+	size_t wram_size, sram_size, chram_size;
 	if (version == 2) {
-		wram_size = decode_ram_size(ines2->flags10.nbb_wram_size) + decode_ram_size(ines2->flags10.bb_wram_size);
+		wram_size = decode_ram_size(ines2->flags10.nbb_wram_size);
+		sram_size = decode_ram_size(ines2->flags10.bb_wram_size);
+		if (!common->flags6.battery) {
+			wram_size += sram_size;
+			sram_size = 0;
+		}
 		chram_size = decode_ram_size(ines2->flags11.nbb_chram_size) + decode_ram_size(ines2->flags11.bb_chram_size);
 	} else {
-		if (common->flags6.wram_present) {
+		// iNES 1.0 ROMs only say that they have WRAM by saying that
+		// it's battery-backed. MMC1 and MMC3 boards almost always have
+		// 8K of it either way, so they get that (volatile) by default.
+		wram_size = 0;
+		sram_size = 0;
+		if (common->flags6.battery) {
 			if (ines1->wram_size) {
-				wram_size = 8192 * ines1->wram_size;
+				sram_size = 8192 * ines1->wram_size;
 			} else {
-				wram_size = 8192;
+				sram_size = 8192;
 			}
-		} else {
-			wram_size = 0;
+		} else if (mapper == 1 || mapper == 4) {
+			wram_size = 8192;
 		}
 
 		if (chrom_size == 0) {
@@ -236,8 +300,14 @@ inesrom_load (FILE * f,
 		WARNING_PRINT("%s expects a PAL system", path);
 	}
 
+	if (rom->size - offset < prgrom_size + chrom_size) {
+		ERROR_PRINT("Unexpected EOF while reading %s", path);
+		retcode = -1;
+		goto ret;
+	}
+
 	// Temporary nullable binding
-	ppu_t * ppu = setup_common(rm, cpu, palette_path, cscheme_path, scale);
+	ppu_t * ppu = setup_common(rm, cpu, palette_path, cscheme_path, ppu_opts, apu_opts);
 	if (!ppu) {
 		goto ret;
 	}
@@ -250,15 +320,27 @@ inesrom_load (FILE * f,
 		}
 	}
 
+	if (sram_size) {
+		info.sram = battery_wram_new(path, sram_size);
+		if (!info.sram) {
+			WARNING_PRINT("Saves from %s will be lost on exit", path);
+			info.sram = memory_new(rm, sram_size, true);
+			if (!info.sram) {
+				goto release_wram;
+			}
+		}
+	}
+
+	// The ROMs are used where they're mapped, rather than copied
 	if (prgrom_size) {
-		info.prgrom = memory_new(rm, prgrom_size, false);
+		info.prgrom = memory_new_external(rom->bytes + offset, prgrom_size, rom);
 		if (!info.prgrom) {
-			goto release_wram;
+			goto release_sram;
 		}
 	}
 
 	if (chrom_size) {
-		info.chrom = memory_new(rm, chrom_size, false);
+		info.chrom = memory_new_external(rom->bytes + offset + prgrom_size, chrom_size, rom);
 		if (!info.chrom) {
 			goto release_prgrom;
 		}
@@ -276,30 +358,25 @@ inesrom_load (FILE * f,
 		goto release_chram;
 	}
 
-	if (info.prgrom &&
-	    try_fread(f, path, info.prgrom->bytes, info.prgrom->size)) {
-		goto release_vram;
+	const mapper_entry_t * entry = NULL;
+	for (size_t i = 0; i < sizeof(mappers) / sizeof(*mappers); i++) {
+		if (mappers[i].number == mapper) {
+			entry = &mappers[i];
+			break;
+		}
 	}
 
-	if (info.chrom &&
-	    try_fread(f, path, info.chrom->bytes, info.chrom->size)) {
-		goto release_vram;
+	if (entry) {
+		retcode = entry->setup(&info);
 	}
-
-	switch (mapper) {
-	case 0:
-		retcode = nrom_setup(&info);
-		break;
-	case 1:
-		retcode = sxrom_setup(&info);
-		break;
-	default:
+	else {
 		ERROR_PRINT("%s requires mapper #%zu", path, mapper);
-		INFO_PRINT("  Only mappers #0 and #1 are supported");
-		break;
+		INFO_PRINT("  Supported mappers are:");
+		for (size_t i = 0; i < sizeof(mappers) / sizeof(*mappers); i++) {
+			INFO_PRINT("    #%zu (%s)", mappers[i].number, mappers[i].name);
+		}
 	}
 
-release_vram:
 	rc_release((memory_t * nonnull)info.vram);
 release_chram:
 	if (info.chram) {
@@ -313,6 +390,10 @@ release_prgrom:
 	if (info.prgrom) {
 		rc_release((memory_t * nonnull)info.prgrom);
 	}
+release_sram:
+	if (info.sram) {
+		rc_release((memory_t * nonnull)info.sram);
+	}
 release_wram:
 	if (info.wram) {
 		rc_release((memory_t * nonnull)info.wram);
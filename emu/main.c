@@ -2,15 +2,21 @@
 #include <base.h>
 #include <ines.h>
 #include <shell.h>
-#include <fileio.h>
 #include <memory.h>
+#include <romimage.h>
 #include <nes/ppu.h>
 #include <nes/io_reg.h>
+#include <nes/framesink.h>
+#include <nes/audiosink.h>
+#include <nes/recorder.h>
+#include <nes/shmsink.h>
+#include <nes/ntsc.h>
 
 #include <SDL2/SDL.h>
 
 #include <stddef.h>
 #include <stdint.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdnoreturn.h>
@@ -25,19 +31,31 @@
 static const uint8_t hawknest_magic[4] = {'H', 'K', 'N', 'S'};
 static const uint8_t ines_magic[4] = {0x4E, 0x45, 0x53, 0x1A};
 
+// Where audio goes, as picked with `--audio`. By default, it's played on the
+// sound device if there is one.
+typedef enum audio_output {
+	AUDIO_OUTPUT_DEFAULT,
+	AUDIO_OUTPUT_SDL,
+	AUDIO_OUTPUT_NULL,
+	AUDIO_OUTPUT_WAV,
+} audio_output_t;
+
 static inline int
-hawknest_rom_load (FILE * nonnull f, const char * nonnull path, reset_manager_t * nonnull rm, mos6502_t * nonnull cpu)
+hawknest_rom_load (romimage_t * nonnull rom, const char * nonnull path, reset_manager_t * nonnull rm, mos6502_t * nonnull cpu)
 {
 	int retcode = 0;
 
-	memory_t * cartrom = memory_new(rm, 0x6000, false);
-	if (!cartrom) {
+	// The cartridge ROM follows the 4-byte magic number, and is used where
+	// it's mapped
+	if (rom->size < 4 + 0x6000) {
+		ERROR_PRINT("Unexpected EOF while reading %s", path);
 		retcode = -1;
 		goto ret;
 	}
-	if ((retcode = try_fread(f, path, cartrom->bytes, cartrom->size))) {
+	memory_t * cartrom = memory_new_external(rom->bytes + 4, 0x6000, rom);
+	if (!cartrom) {
 		retcode = -1;
-		goto release_cartrom;
+		goto ret;
 	}
 	memory_map(cartrom, cpu->bus, 0xA000, (uint16_t)cartrom->size, 0);
 
@@ -61,27 +79,29 @@ load_rom (const char * nonnull path,
 	  mos6502_t * nonnull cpu,
 	  const char * nonnull palette_path,
 	  const char * nonnull cscheme_path,
-	  int scale)
+	  const ppu_options_t * nonnull ppu_opts,
+	  const apu_options_t * nonnull apu_opts)
 {
 	int retcode = 0;
 
-	FILE * f = try_fopen(path, "rb");
-	if (!f) {
+	romimage_t * rom = romimage_open(path);
+	if (!rom) {
 		retcode = -1;
 		goto ret0;
 	}
 
-	uint8_t magic[4];
-	if ((retcode = try_fread(f, path, magic, sizeof(magic)))) {
+	if (rom->size < 4) {
+		retcode = -1;
+		ERROR_PRINT("Unexpected EOF while reading %s", path);
 		goto ret1;
 	}
 
-	if (!memcmp(magic, hawknest_magic, sizeof(magic))) {
-		retcode = hawknest_rom_load(f, path, rm, cpu);
+	if (!memcmp(rom->bytes, hawknest_magic, sizeof(hawknest_magic))) {
+		retcode = hawknest_rom_load(rom, path, rm, cpu);
 		goto ret1;
 	}
-	else if (!memcmp(magic, ines_magic, sizeof(magic))) {
-		retcode = inesrom_load(f, path, rm, cpu, palette_path, cscheme_path, scale);
+	else if (!memcmp(rom->bytes, ines_magic, sizeof(ines_magic))) {
+		retcode = inesrom_load(rom, path, rm, cpu, palette_path, cscheme_path, ppu_opts, apu_opts);
 		goto ret1;
 	}
 
@@ -89,7 +109,7 @@ load_rom (const char * nonnull path,
 	ERROR_PRINT("%s does not appear to be in a valid ROM format", path);
 
 ret1:
-	fclose(f);
+	rc_release(rom);
 ret0:
 	return retcode;
 }
@@ -110,15 +130,219 @@ print_usage (char ** argv)
 	SUGGESTION_PRINT("  " UNBOLD("--palette     ") "or " UNBOLD("-p <path> ") ": Use the NES palette at " UNBOLD("<path>"));
 	SUGGESTION_PRINT("  " UNBOLD("--cscheme     ") "or " UNBOLD("-c <path> ") ": Use the NES controller scheme at " UNBOLD("<path>"));
 	SUGGESTION_PRINT("  " UNBOLD("--scale       ") "or " UNBOLD("-s <int>  ") ": Scale NES output by " UNBOLD("<int>"));
+	SUGGESTION_PRINT("  " UNBOLD("--renderer    ") "or " UNBOLD("-r <name> ") ": Render video with " UNBOLD("scanline") " (default), " UNBOLD("dot") ", " UNBOLD("verify") ", or " UNBOLD("parallel"));
+	SUGGESTION_PRINT("  " UNBOLD("--threads     ") "or " UNBOLD("-j <n>    ") ": Use " UNBOLD("<n>") " worker threads with the " UNBOLD("parallel") " renderer");
+	SUGGESTION_PRINT("  " UNBOLD("--filter      ") "or " UNBOLD("-F <name> ") ": Filter video through " UNBOLD("ntsc") ", optionally suffixed " UNBOLD(":sharpness=<x>") " and " UNBOLD(":artifacts=<x>"));
+	SUGGESTION_PRINT("  " UNBOLD("--headless    ") "or " UNBOLD("-H        ") ": Run without a window, discarding video output");
+	SUGGESTION_PRINT("  " UNBOLD("--frame-skip  ") "or " UNBOLD("-f <n>    ") ": Only draw every " UNBOLD("<n>") "th frame, or with " UNBOLD("auto") ", skip frames while running behind");
+	SUGGESTION_PRINT("  " UNBOLD("--record      ") "or " UNBOLD("-R <path> ") ": Record video and audio to " UNBOLD("<path>.y4m") " and " UNBOLD("<path>.wav"));
+	SUGGESTION_PRINT("  " UNBOLD("--shm         ") "or " UNBOLD("-S <name> ") ": Publish frames to shared memory " UNBOLD("<name>") ", optionally suffixed " UNBOLD(":indexed") " or " UNBOLD(":rgba"));
+	SUGGESTION_PRINT("  " UNBOLD("--audio       ") "or " UNBOLD("-a <name> ") ": Send audio to " UNBOLD("sdl") " (default), " UNBOLD("null") " (default when headless), or " UNBOLD("wav:<path>"));
+	SUGGESTION_PRINT("  " UNBOLD("--sample-rate ") "or " UNBOLD("-A <hz>   ") ": Produce audio at " UNBOLD("44100") " (default) or " UNBOLD("48000") " Hz");
 	SUGGESTION_PRINT("  " UNBOLD("--help        ") "or " UNBOLD("-h        ") ": Print this message");
 	SUGGESTION_PRINT("  " UNBOLD("--version     ") "or " UNBOLD("-V        ") ": Print version information");
 }
 
+static inline int
+parse_renderer (const char * nonnull name, ppu_renderer_t * nonnull renderer)
+{
+	if (!strcmp(name, "dot")) {
+		*renderer = PPU_RENDERER_DOT;
+	}
+	else if (!strcmp(name, "scanline")) {
+		*renderer = PPU_RENDERER_SCANLINE;
+	}
+	else if (!strcmp(name, "verify")) {
+		*renderer = PPU_RENDERER_VERIFY;
+	}
+	else if (!strcmp(name, "parallel")) {
+		*renderer = PPU_RENDERER_PARALLEL;
+	}
+	else {
+		ERROR_PRINT("Unknown renderer '%s'", name);
+		return -1;
+	}
+	return 0;
+}
+
+static inline int
+parse_frame_skip (const char * nonnull arg, ppu_options_t * nonnull ppu_opts)
+{
+	if (!strcmp(arg, "auto")) {
+		ppu_opts->adaptive_skip = true;
+		return 0;
+	}
+
+	char * end;
+	unsigned long interval = strtoul(arg, &end, 10);
+	if (*end || !interval || interval > UINT_MAX) {
+		ERROR_PRINT("Invalid frame skip '%s'", arg);
+		return -1;
+	}
+	ppu_opts->frame_interval = (unsigned)interval;
+	return 0;
+}
+
+static inline int
+parse_render_threads (const char * nonnull arg, ppu_options_t * nonnull ppu_opts)
+{
+	char * end;
+	unsigned long nthreads = strtoul(arg, &end, 10);
+	if (*end || !nthreads || nthreads > 64) {
+		ERROR_PRINT("Invalid number of render threads '%s'", arg);
+		return -1;
+	}
+	ppu_opts->nrender_threads = (unsigned)nthreads;
+	return 0;
+}
+
+static inline int
+parse_audio (char * nonnull arg, audio_output_t * nonnull output, char * nullable * nonnull wav_path)
+{
+	if (!strcmp(arg, "sdl")) {
+		*output = AUDIO_OUTPUT_SDL;
+	}
+	else if (!strcmp(arg, "null")) {
+		*output = AUDIO_OUTPUT_NULL;
+	}
+	else if (!strncmp(arg, "wav:", strlen("wav:")) && arg[strlen("wav:")]) {
+		*output = AUDIO_OUTPUT_WAV;
+		*wav_path = arg + strlen("wav:");
+	}
+	else {
+		ERROR_PRINT("Unknown audio output '%s'", arg);
+		return -1;
+	}
+	return 0;
+}
+
+// Creates the sink for the audio output picked. Without a pick, headless runs
+// have no sound (which lets the APU skip synthesizing it), and a missing sound
+// device only means there's no sound.
+static audiosink_t * nullable
+create_audiosink (audio_output_t output, const char * nullable wav_path, uint32_t sample_rate, bool headless)
+{
+	if (output == AUDIO_OUTPUT_DEFAULT && headless) {
+		output = AUDIO_OUTPUT_NULL;
+	}
+
+	switch (output) {
+	case AUDIO_OUTPUT_SDL:
+		return audiosink_new_sdl(sample_rate);
+	case AUDIO_OUTPUT_NULL:
+		return audiosink_new_null();
+	case AUDIO_OUTPUT_WAV:
+		return audiosink_new_wav((const char * nonnull)wav_path, sample_rate);
+	case AUDIO_OUTPUT_DEFAULT:
+		break;
+	}
+
+	audiosink_t * sink = audiosink_new_sdl(sample_rate);
+	if (!sink) {
+		WARNING_PRINT("Running without sound");
+		sink = audiosink_new_null();
+	}
+	return sink;
+}
+
+static inline int
+parse_sample_rate (const char * nonnull arg, uint32_t * nonnull sample_rate)
+{
+	char * end;
+	unsigned long rate = strtoul(arg, &end, 10);
+	if (*end || (rate != 44100 && rate != 48000)) {
+		ERROR_PRINT("Unsupported sample rate '%s' (must be 44100 or 48000)", arg);
+		return -1;
+	}
+	*sample_rate = (uint32_t)rate;
+	return 0;
+}
+
+static inline int
+parse_shm (char * nonnull arg, char * nullable * nonnull name, uint32_t * nonnull formats)
+{
+	*formats = SHM_FRAMES_INDEXED | SHM_FRAMES_RGBA;
+
+	char * suffix = strrchr(arg, ':');
+	if (suffix) {
+		if (!strcmp(suffix, ":indexed")) {
+			*formats = SHM_FRAMES_INDEXED;
+		}
+		else if (!strcmp(suffix, ":rgba")) {
+			*formats = SHM_FRAMES_RGBA;
+		}
+		else {
+			ERROR_PRINT("Unknown shared memory frame format '%s'", suffix + 1);
+			return -1;
+		}
+		*suffix = '\0';
+	}
+
+	if (!*arg) {
+		ERROR_PRINT("No shared memory name provided");
+		return -1;
+	}
+	*name = arg;
+	return 0;
+}
+
+// Parses a filter name, with settings after it as `:<setting>=<value>`. Sets
+// `*use_ntsc` if the filter is `ntsc` (rather than `none`).
+static inline int
+parse_filter (char * nonnull arg, bool * nonnull use_ntsc, ntsc_options_t * nonnull ntsc_opts)
+{
+	char * saveptr;
+	char * name = strtok_r(arg, ":", &saveptr);
+	if (!name || !strcmp(name, "none")) {
+		*use_ntsc = false;
+		return 0;
+	}
+	if (strcmp(name, "ntsc")) {
+		ERROR_PRINT("Unknown filter '%s'", name);
+		return -1;
+	}
+	*use_ntsc = true;
+
+	char * setting;
+	while ((setting = strtok_r(NULL, ":", &saveptr))) {
+		float * value;
+		if (!strncmp(setting, "sharpness=", strlen("sharpness="))) {
+			value = &ntsc_opts->sharpness;
+		}
+		else if (!strncmp(setting, "artifacts=", strlen("artifacts="))) {
+			value = &ntsc_opts->artifacts;
+		}
+		else {
+			ERROR_PRINT("Unknown NTSC filter setting '%s'", setting);
+			return -1;
+		}
+
+		char * end;
+		const char * start = strchr(setting, '=') + 1;
+		float parsed = strtof(start, &end);
+		if (end == start || *end || !(parsed >= 0.0f && parsed <= 1.0f)) {
+			ERROR_PRINT("Invalid NTSC filter setting '%s' (must be from 0 to 1)", setting);
+			return -1;
+		}
+		*value = parsed;
+	}
+	return 0;
+}
+
 static struct option long_options[] = {
 	{"interactive", no_argument, 0, 'i'},
 	{"palette", required_argument, 0, 'p'},
 	{"cscheme", required_argument, 0, 'c'},
 	{"scale", required_argument, 0, 's'},
+	{"renderer", required_argument, 0, 'r'},
+	{"threads", required_argument, 0, 'j'},
+	{"filter", required_argument, 0, 'F'},
+	{"headless", no_argument, 0, 'H'},
+	{"frame-skip", required_argument, 0, 'f'},
+	{"record", required_argument, 0, 'R'},
+	{"shm", required_argument, 0, 'S'},
+	{"audio", required_argument, 0, 'a'},
+	{"sample-rate", required_argument, 0, 'A'},
 	{"help", no_argument, 0, 'h'},
 	{"version", no_argument, 0, 'V'},
 	{0, 0, 0, 0}};
@@ -136,11 +360,28 @@ main (int argc, char ** argv)
 	char * cscheme_path = "cscheme";
 	char * palette_path = "palette";
 	bool interactive = false;
+	bool headless = false;
+	char * record_path = NULL;
+	char * shm_name = NULL;
+	audio_output_t audio_output = AUDIO_OUTPUT_DEFAULT;
+	char * wav_path = NULL;
+	uint32_t shm_formats = 0;
 	int scale = 1;
+	bool use_ntsc = false;
+	ntsc_options_t ntsc_opts = {
+		.sharpness = 0.25f,
+		.artifacts = 1.0f,
+	};
+	ppu_options_t ppu_opts = {
+		.renderer = PPU_RENDERER_SCANLINE,
+	};
+	apu_options_t apu_opts = {
+		.sample_rate = APU_SAMPLE_RATE,
+	};
 
 	while (1) {
 		int opt_idx = 0;
-		int c = getopt_long(argc, argv, "p:c:s:hiV", long_options, &opt_idx);
+		int c = getopt_long(argc, argv, "p:c:s:r:j:F:Hf:R:S:a:A:hiV", long_options, &opt_idx);
 
 		if (c == -1) {
 			break;
@@ -161,6 +402,47 @@ main (int argc, char ** argv)
 		case 's':
 			scale = atoi(optarg);
 			break;
+		case 'r':
+			if (parse_renderer(optarg, &ppu_opts.renderer)) {
+				goto ret;
+			}
+			break;
+		case 'j':
+			if (parse_render_threads(optarg, &ppu_opts)) {
+				goto ret;
+			}
+			break;
+		case 'H':
+			headless = true;
+			break;
+		case 'f':
+			if (parse_frame_skip(optarg, &ppu_opts)) {
+				goto ret;
+			}
+			break;
+		case 'R':
+			record_path = optarg;
+			break;
+		case 'F':
+			if (parse_filter(optarg, &use_ntsc, &ntsc_opts)) {
+				goto ret;
+			}
+			break;
+		case 'S':
+			if (parse_shm(optarg, &shm_name, &shm_formats)) {
+				goto ret;
+			}
+			break;
+		case 'a':
+			if (parse_audio(optarg, &audio_output, &wav_path)) {
+				goto ret;
+			}
+			break;
+		case 'A':
+			if (parse_sample_rate(optarg, &apu_opts.sample_rate)) {
+				goto ret;
+			}
+			break;
 		case 'V':
 			print_version();
 			retcode = 0;
@@ -192,10 +474,68 @@ main (int argc, char ** argv)
 		goto ret;
 	}
 
+	// Filters only apply to the window, so headless runs don't bother
+	// with them
+	ntsc_filter_t * ntsc = NULL;
+	if (use_ntsc && headless) {
+		WARNING_PRINT("Not filtering video, since there's no window");
+	}
+	else if (use_ntsc) {
+		ntsc = ntsc_filter_new(&ntsc_opts);
+		if (!ntsc) {
+			ERROR_PRINT("Failed to set up the NTSC filter");
+			goto quit_sdl;
+		}
+	}
+
+	// Headless runs never touch the SDL video subsystem
+	framesink_t * sink = headless ? framesink_new_null() : framesink_new_sdl(scale, ntsc);
+	if (ntsc) {
+		rc_release(ntsc);
+	}
+	if (!sink) {
+		ERROR_PRINT("Failed to create a video output");
+		goto quit_sdl;
+	}
+
+	// Frames are published to shared memory on their way to the video
+	// output
+	if (shm_name) {
+		framesink_t * shm_sink = shmsink_new((char * nonnull)shm_name, shm_formats, sink);
+		if (!shm_sink) {
+			ERROR_PRINT("Failed to set up shared memory frame export");
+			goto release_sink;
+		}
+		rc_release(sink);
+		sink = shm_sink;
+	}
+	ppu_opts.sink = sink;
+
+	audiosink_t * audiosink = create_audiosink(audio_output, wav_path, apu_opts.sample_rate, headless);
+	if (!audiosink) {
+		ERROR_PRINT("Failed to create an audio output");
+		goto release_sink;
+	}
+	apu_opts.sink = audiosink;
+
+	// The recorder sits between the PPU and the video output, and taps the
+	// APU's samples
+	recorder_t * recorder = NULL;
+	if (record_path) {
+		recorder = recorder_new(record_path, apu_opts.sample_rate, sink);
+		if (!recorder) {
+			ERROR_PRINT("Failed to start recording");
+			goto release_audiosink;
+		}
+		ppu_opts.sink = recorder_sink((recorder_t * nonnull)recorder);
+		apu_opts.tap = recorder_push_samples;
+		apu_opts.tap_ctx = recorder;
+	}
+
 	reset_manager_t * rm = reset_manager_new();
 	if (!rm) {
 		ERROR_PRINT("Failed to create a reset manager");
-		goto quit_sdl;
+		goto release_recorder;
 	}
 
 	timekeeper_t * tk = timekeeper_new(rm, 1.0 / NES_NTSC_SYSCLK);
@@ -210,7 +550,7 @@ main (int argc, char ** argv)
 		goto release_tk;
 	}
 
-	if (load_rom(rom_path, rm, cpu, palette_path, cscheme_path, scale)) {
+	if (load_rom(rom_path, rm, cpu, palette_path, cscheme_path, &ppu_opts, &apu_opts)) {
 		ERROR_PRINT("Couldn't initialize system");
 		goto release_cpu;
 	}
@@ -228,6 +568,14 @@ release_tk:
 	rc_release(tk);
 release_rm:
 	rc_release(rm);
+release_recorder:
+	if (recorder) {
+		rc_release(recorder);
+	}
+release_audiosink:
+	rc_release(audiosink);
+release_sink:
+	rc_release(sink);
 quit_sdl:
 	SDL_Quit();
 ret:
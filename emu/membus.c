@@ -149,3 +149,12 @@ membus_set_write_memory (membus_t * bus, size_t pagenum, void * obj, void * data
 	bus->write_mappings[pagenum].data = data;
 	bus->write_mappings[pagenum].offset_p1 = 0;
 }
+
+uint8_t *
+membus_read_memory (membus_t * bus, size_t pagenum)
+{
+	if (!bus->read_mappings[pagenum].obj || bus->read_mappings[pagenum].offset_p1) {
+		return NULL;
+	}
+	return bus->read_mappings[pagenum].data;
+}
@@ -9,18 +9,50 @@ reset (memory_t * memory)
 	memset(memory->bytes, 0xFF, memory->size);
 }
 
+static void
+deinit (memory_t * memory)
+{
+	if (memory->owner) {
+		rc_release(memory->owner);
+	}
+}
+
 memory_t *
 memory_new (reset_manager_t * rm, size_t size, bool writeable)
 {
-	memory_t * mem = rc_alloc(sizeof(memory_t) + size, NULL);
+	memory_t * mem = rc_alloc(sizeof(memory_t) + size, deinit);
 	mem->size      = size;
 	mem->writeable = writeable;
+	mem->bytes     = mem->storage;
 	if (writeable) {
 		reset_manager_add_device(rm, mem, reset);
 	}
 	return mem;
 }
 
+memory_t *
+memory_new_external (const uint8_t * bytes, size_t size, void * owner)
+{
+	memory_t * mem = rc_alloc(sizeof(memory_t), deinit);
+	mem->size      = size;
+	mem->writeable = false;
+	// Never written through, since the memory isn't writeable
+	mem->bytes     = (uint8_t *)bytes;
+	mem->owner     = rc_retain(owner);
+	return mem;
+}
+
+memory_t *
+memory_new_persistent (uint8_t * bytes, size_t size, void * owner)
+{
+	memory_t * mem = rc_alloc(sizeof(memory_t), deinit);
+	mem->size      = size;
+	mem->writeable = true;
+	mem->bytes     = bytes;
+	mem->owner     = rc_retain(owner);
+	return mem;
+}
+
 void
 memory_map (memory_t * mem, membus_t * bus, uint16_t bus_start, uint16_t size, size_t start)
 {
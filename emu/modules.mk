@@ -9,4 +9,6 @@ EMU_SRC += main.c \
 	   memory.c \
 	   membus.c \
 	   reset_manager.c \
-	   fileio.c
+	   fileio.c \
+	   romimage.c \
+	   savefile.c
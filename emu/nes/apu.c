@@ -1,171 +1,172 @@
 #include <stdint.h>
 #include <stdbool.h>
-
-#include <SDL2/SDL.h>
+#include <string.h>
 
 #include <base.h>
 #include <rc.h>
 #include <mos6502/mos6502.h>
+#include <membus.h>
 #include <nes/apu.h>
-#include <nes/apu_regs.h>
-#include <nes/apu_channels.h>
-
-#define SAMPLE_COUNT 65536
-#define QUARTER_FRAME (358000 / 4)
-#define ABOUT_44_1_KHZ 487
-
-static const uint8_t length_counters[32] = {
-    10, 254, 20, 2, 40, 4, 80, 6, 160, 8, 60, 10, 14, 12, 26, 14,
-	12, 16, 24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30,
-};
-
-typedef struct apu_frame_counter {
-	uint8_t step;
-	bool irq_flag;
-} apu_frame_counter_t;
-
+#include <nes/apu_state.h>
+#include <nes/apu_synth.h>
+
+// The countdown of a timer that is disarmed. The timekeeper still counts it
+// down, but it would take centuries to get anywhere near 0.
+#define DISARMED UINT64_MAX
+
+// The APU as the CPU sees it. Only what the CPU can see is kept up here: the
+// length counters and IRQ flags (through $4015 and the IRQ line) and the
+// DMC's byte fetches. The channels' sequencers are left where they are, and
+// the rest is worked out from the cycles that have gone by (see apu_sync()).
+// Samples are synthesized from a log of the writes on another thread, if
+// anyone is listening: either the sink keeps them, or there's a tap.
 typedef struct apu {
-	union {
-		apu_regs_t regs;
-		uint8_t reg_bytes[0x18];
-	};
-	
+	apu_state_t state;
+
 	mos6502_t * nonnull /*unowned*/ cpu;
+	apu_synth_t * nullable /*strong*/ synth;
+
+	// The master cycle that the APU has been brought up to, and of the last
+	// step that the frame counter was moved through. Steps are
+	// `APU_QUARTER_FRAME` cycles apart from reset on.
+	uint64_t clk_synced;
+	uint64_t clk_frame;
 
-	apu_channel_pulse_t pulse1;
-	apu_channel_pulse_t pulse2;
-	apu_channel_triangle_t triangle;
-	apu_channel_noise_t noise;
-	apu_channel_dmc_t dmc;
-	
-	apu_frame_counter_t frame_counter;
-
-	float * nonnull /*owned*/ samples;
-	size_t nsamples;
-	SDL_AudioDeviceID dev;
-	
-	uint64_t cycle_countdown;
+	uint64_t irq_countdown;
 	uint64_t frame_countdown;
-	bool even_cycle;
-	uint64_t sample_countdown;
+	uint64_t dmc_countdown;
 } apu_t;
 
-static void fc_update_irq(apu_frame_counter_t *fc, const apu_reg_frame_counter_t *reg) {
-	if (reg->disable_frame_irq) {
-		fc->irq_flag = false;
-	} else if (fc->step == 3 && !reg->five_step_sequence) {
-		fc->irq_flag = true;
-	}
+static inline bool is_disarmed(uint64_t countdown) {
+	return countdown > DISARMED / 2;
 }
 
-static void fc_step(apu_frame_counter_t *fc, const apu_reg_frame_counter_t *reg) {
-	fc->step++;
-	fc->step %= reg->five_step_sequence ? 5 : 4;
-	fc_update_irq(fc, reg);
-}
+// Brings the APU up to master cycle `clk`. The frame counter is moved through
+// every step since the last sync at once, and the DMC through its edges,
+// fetching the bytes it would have fetched on the way.
+static void apu_sync(apu_t *apu, uint64_t clk) {
+	if (clk <= apu->clk_synced) {
+		return;
+	}
+
+	uint64_t nsteps = (clk - apu->clk_frame) / APU_QUARTER_FRAME;
+	apu->clk_frame += nsteps * APU_QUARTER_FRAME;
+	apu_state_skip_frame_steps(&apu->state, nsteps);
+
+	apu_channel_dmc_t *dmc = &apu->state.dmc;
+	uint64_t nedges = apu_skip_edges(&dmc->next_edge, apu_dmc_period(&apu->state.regs.dmc), clk);
+	apu_dmc_skip(dmc, &apu->state.regs.dmc, nedges);
 
-static inline bool fc_at_quarter(const apu_frame_counter_t *fc, const apu_reg_frame_counter_t *reg) {
-	return reg->five_step_sequence ? fc->step != 3 : true;
+	apu->clk_synced = clk;
 }
 
-static inline bool fc_at_half(const apu_frame_counter_t *fc, const apu_reg_frame_counter_t *reg) {
-	if (reg->five_step_sequence) {
-		return fc->step == 1 || fc->step == 4;
-	} else {
-		return fc->step == 1 || fc->step == 3;
+// Fetches a DMC sample byte from the bus, and logs it for the synthesis
+// thread's DMC
+static uint8_t apu_fetch(void *ctx, uint16_t addr) {
+	apu_t *apu = ctx;
+	uint8_t val = membus_read(apu->cpu->bus, addr);
+	if (apu->synth) {
+		apu_synth_fetch(apu->synth, val);
 	}
+	return val;
+}
+
+static inline uint64_t apu_now(const apu_t *apu) {
+	return apu->cpu->tk->clk_cyclenum;
 }
 
-static float apu_mix_sample(const apu_t *apu) {
-	double pulse1 = apu_pulse_sample(&apu->pulse1, &apu->regs.pulse1);
-	double pulse2 = apu_pulse_sample(&apu->pulse2, &apu->regs.pulse2);
-	double triangle = apu_triangle_sample(&apu->triangle, &apu->regs.triangle);
-	double noise = apu_noise_sample(&apu->noise, &apu->regs.noise);
-	double dmc = apu_dmc_sample(&apu->dmc, &apu->regs.dmc);
+static inline bool apu_irq_pending(const apu_t *apu) {
+	return apu->state.dmc.mem_reader.irq_flag || apu->state.frame_counter.irq_flag;
+}
 
-	double tnd_out = 0.;
-	if (triangle + noise + dmc != 0.) {
-		tnd_out = 159.79 / (1. / (triangle / 8227. + noise / 12241. + dmc / 22638.) + 100.);
+// Polls the IRQ line for as long as an IRQ is pending. The CPU only sets or
+// clears its interrupt disable flag between instructions, which take at least
+// two cycles, so polling every other cycle still sees every change. The other
+// timers arm it from their routines.
+static void apu_irq_tick(apu_t *apu) {
+	if (!apu_irq_pending(apu)) {
+		apu->irq_countdown = DISARMED;
+		return;
 	}
 
-	double pulse_out = 0.;
-	if (pulse1 + pulse2 != 0.) {
-		pulse_out = 95.88 / (8128. / (pulse1 + pulse2) + 100.);
+	apu->irq_countdown = 2 * MOS6502_CLKDIVISOR;
+	if (!apu->cpu->p.i) {
+		mos6502_raise_irq(apu->cpu);
 	}
-
-	return (float)(tnd_out + pulse_out);
 }
 
-static void apu_push_sample(apu_t *apu, float sample) {
-	if (apu->nsamples < SAMPLE_COUNT) {
-		apu->samples[apu->nsamples++] = sample;
+static void apu_arm_irq(apu_t *apu) {
+	if (apu_irq_pending(apu) && is_disarmed(apu->irq_countdown)) {
+		apu_irq_tick(apu);
 	}
 }
 
-static void apu_cycle_tick(apu_t *apu) {
-	apu->cycle_countdown = MOS6502_CLKDIVISOR;
-
-	if (apu->dmc.mem_reader.irq_flag || apu->frame_counter.irq_flag) {
-		if (!apu->cpu->p.i) {
-			mos6502_raise_irq(apu->cpu);
-		}
+// The cycles from `now` until the frame counter's timer next needs to fire,
+// once the APU is brought up to `now`. The synthesis thread is told how far
+// emulation has got on every step; otherwise the timer only fires on the step
+// that raises the frame IRQ flag.
+static uint64_t apu_frame_countdown(const apu_t *apu, uint64_t now) {
+	if (apu->synth) {
+		return apu->clk_frame + APU_QUARTER_FRAME - now;
 	}
 
-	apu_triangle_tick(&apu->triangle, &apu->regs.triangle);
-	if (apu->even_cycle) {
-		apu_pulse_tick(&apu->pulse1, &apu->regs.pulse1);
-		apu_pulse_tick(&apu->pulse2, &apu->regs.pulse2);
-		apu_noise_tick(&apu->noise, &apu->regs.noise);
-		apu_dmc_tick(&apu->dmc, &apu->regs.dmc);
+	const apu_reg_frame_counter_t *reg = &apu->state.regs.frame_counter;
+	if (reg->five_step_sequence || reg->disable_frame_irq) {
+		return DISARMED;
 	}
+	uint64_t nsteps = (6 - apu->state.frame_counter.step) % 4 + 1;
+	return apu->clk_frame + nsteps * APU_QUARTER_FRAME - now;
+}
 
-	apu->even_cycle = !apu->even_cycle;
+// The cycles from `now` until the DMC's next byte fetch, which is on the edge
+// that finds its shift register empty
+static uint64_t apu_dmc_countdown(const apu_t *apu, uint64_t now) {
+	const apu_channel_dmc_t *dmc = &apu->state.dmc;
+	if (!apu_dmc_is_active(dmc)) {
+		return DISARMED;
+	}
+	uint64_t period_clks = (uint64_t)apu_dmc_period(&apu->state.regs.dmc) * MOS6502_CLKDIVISOR;
+	return dmc->next_edge + dmc->output_unit.bits_remaining * period_clks - now;
 }
 
+// The timers only rearm themselves, since the timekeeper may not have counted
+// the other one down yet
 static void apu_frame_tick(apu_t *apu) {
-	apu->frame_countdown = QUARTER_FRAME;
-	fc_step(&apu->frame_counter, &apu->regs.frame_counter);
-
-	if (fc_at_quarter(&apu->frame_counter, &apu->regs.frame_counter)) {
-		apu_pulse_quarter_frame(&apu->pulse1, &apu->regs.pulse1);
-		apu_pulse_quarter_frame(&apu->pulse2, &apu->regs.pulse2);
-		apu_triangle_quarter_frame(&apu->triangle, &apu->regs.triangle);
-		apu_noise_quarter_frame(&apu->noise, &apu->regs.noise);
-	}
-	if (fc_at_half(&apu->frame_counter, &apu->regs.frame_counter)) {
-		apu_pulse_half_frame(&apu->pulse1, &apu->regs.pulse1);
-		apu_pulse_half_frame(&apu->pulse2, &apu->regs.pulse2);
-		apu_triangle_half_frame(&apu->triangle, &apu->regs.triangle);
-		apu_noise_half_frame(&apu->noise, &apu->regs.noise);
-	}
+	uint64_t now = apu_now(apu);
+	apu_sync(apu, now);
+	apu_arm_irq(apu);
+	apu->frame_countdown = apu_frame_countdown(apu, now);
 
-	SDL_QueueAudio(apu->dev, apu->samples, apu->nsamples * sizeof(float));
-	
-	apu->nsamples = 0;
+	if (apu->synth) {
+		apu_synth_sync(apu->synth, now);
+	}
 }
 
-static void apu_sample_tick(apu_t *apu) {
-	apu->sample_countdown = ABOUT_44_1_KHZ;
-	apu_push_sample(apu, apu_mix_sample(apu));
+static void apu_dmc_tick(apu_t *apu) {
+	uint64_t now = apu_now(apu);
+	apu_sync(apu, now);
+	apu_arm_irq(apu);
+	apu->dmc_countdown = apu_dmc_countdown(apu, now);
 }
 
 uint8_t apu_mem_read(apu_t *apu, uint16_t addr, uint8_t *lane_mask) {
 	if (addr == 0x15) {
 		*lane_mask = 0xFF;
+		apu_sync(apu, apu_now(apu));
 
 		apu_reg_control_status_t status;
 		status.val = 0;
 
-		status.pulse1 = apu_pulse_is_active(&apu->pulse1);
-		status.pulse2 = apu_pulse_is_active(&apu->pulse2);
-		status.triangle = apu_triangle_is_active(&apu->triangle);
-		status.noise = apu_noise_is_active(&apu->noise);
-		status.dmc = apu_dmc_is_active(&apu->dmc);
+		status.pulse1 = apu_pulse_is_active(&apu->state.pulse1);
+		status.pulse2 = apu_pulse_is_active(&apu->state.pulse2);
+		status.triangle = apu_triangle_is_active(&apu->state.triangle);
+		status.noise = apu_noise_is_active(&apu->state.noise);
+		status.dmc = apu_dmc_is_active(&apu->state.dmc);
 		
-		status.dmc_irq = apu->dmc.mem_reader.irq_flag;
-		status.frame_irq = apu->frame_counter.irq_flag;
+		status.dmc_irq = apu->state.dmc.mem_reader.irq_flag;
+		status.frame_irq = apu->state.frame_counter.irq_flag;
 		
-		apu->frame_counter.irq_flag = false;
+		apu->state.frame_counter.irq_flag = false;
 		
 		return status.val;
 	} else {
@@ -178,147 +179,64 @@ void apu_mem_write(apu_t *apu, uint16_t addr, uint8_t data) {
 	if (addr > 0x17) {
 		return;
 	}
-	apu->reg_bytes[addr] = data;
-	uint8_t length_counter = length_counters[data >> 3];
-	switch (addr) {
-		case 0x01:
-			apu_pulse_reload_sweep(&apu->pulse1);
-			break;
-		case 0x03:
-			apu_pulse_set_lc(&apu->pulse1, length_counter);
-			break;
-		case 0x05:
-			apu_pulse_reload_sweep(&apu->pulse2);
-			break;
-		case 0x07:
-			apu_pulse_set_lc(&apu->pulse2, length_counter);
-			break;
-		case 0x0B:
-			apu_triangle_set_lc(&apu->triangle, length_counter);
-			break;
-		case 0x0F:
-			apu_noise_set_lc(&apu->noise, length_counter);
-			break;
-		case 0x10:
-			if (!apu->regs.dmc.irq) {
-				apu->dmc.mem_reader.irq_flag = false;
-			}
-			break;
-		case 0x11:
-			apu->dmc.output_unit.output_level = apu->regs.dmc.direct_load;
-			break;
-		case 0x12:
-			apu->dmc.mem_reader.sample_start = apu->regs.dmc.sample_addr * 64 + 0xC000;
-			apu->dmc.mem_reader.addr = apu->dmc.mem_reader.sample_start;
-			break;
-		case 0x13:
-			apu->dmc.mem_reader.sample_len = apu->regs.dmc.sample_len * 16 + 1;
-			apu->dmc.mem_reader.bytes_remaining = apu->dmc.mem_reader.sample_len;
-			break;
-		case 0x15:
-			apu->dmc.mem_reader.irq_flag = false;
-			if (apu->regs.control.dmc) {
-				apu_dmc_restart(&apu->dmc);
-			}
-			break;
-		case 0x17:
-			apu->frame_counter.step = 0;
-			if (apu->regs.frame_counter.five_step_sequence) {
-				apu_pulse_quarter_frame(&apu->pulse1, &apu->regs.pulse1);
-				apu_pulse_quarter_frame(&apu->pulse2, &apu->regs.pulse2);
-				apu_triangle_quarter_frame(&apu->triangle, &apu->regs.triangle);
-				apu_noise_quarter_frame(&apu->noise, &apu->regs.noise);
-
-				apu_pulse_half_frame(&apu->pulse1, &apu->regs.pulse1);
-				apu_pulse_half_frame(&apu->pulse2, &apu->regs.pulse2);
-				apu_triangle_half_frame(&apu->triangle, &apu->regs.triangle);
-				apu_noise_half_frame(&apu->noise, &apu->regs.noise);
-			}
-			fc_update_irq(&apu->frame_counter, &apu->regs.frame_counter);
-			break;
-		default:
-			break;
+	uint64_t now = apu_now(apu);
+	apu_sync(apu, now);
+
+	apu_state_write(&apu->state, addr, data);
+	if (apu->synth) {
+		apu_synth_write(apu->synth, now, addr, data);
 	}
+
+	apu_arm_irq(apu);
+	apu->frame_countdown = apu_frame_countdown(apu, now);
+	apu->dmc_countdown = apu_dmc_countdown(apu, now);
 }
 
 static void deinit(apu_t * nonnull apu) {
-	free(apu->samples);
-
-	SDL_CloseAudioDevice(apu->dev);
-	SDL_QuitSubSystem(SDL_INIT_AUDIO);
+	if (apu->synth) {
+		rc_release(apu->synth);
+	}
 }
 
 static void reset(apu_t * nonnull apu) {
-	#define ZERO(x) memset(&x, 0, sizeof(x));
-	
-	ZERO(apu->pulse1);
-	ZERO(apu->pulse2);
-	apu->pulse2.is_pulse2 = true;
-
-	ZERO(apu->triangle);
-
-	ZERO(apu->noise);
-	apu->noise.shift_reg = 1;
-
-	ZERO(apu->dmc.mem_reader.sample_start);
-	ZERO(apu->dmc.mem_reader.sample_len);
-	ZERO(apu->dmc.mem_reader.addr);
-	ZERO(apu->dmc.mem_reader.bytes_remaining);
-	ZERO(apu->dmc.sample_buffer);
-	ZERO(apu->dmc.timer);
-	ZERO(apu->dmc.output_unit);
-	
-	ZERO(apu->frame_counter);
-
-	ZERO(apu->even_cycle);
-	ZERO(apu->reg_bytes);
-
-	apu->cycle_countdown = MOS6502_CLKDIVISOR;
-	apu->frame_countdown = QUARTER_FRAME;
-	apu->sample_countdown = ABOUT_44_1_KHZ;
-
-	#undef ZERO
+	apu_state_reset(&apu->state);
+	apu->clk_synced = 0;
+	apu->clk_frame = 0;
+
+	apu->irq_countdown = DISARMED;
+	apu->frame_countdown = apu_frame_countdown(apu, 0);
+	apu->dmc_countdown = DISARMED;
+
+	if (apu->synth) {
+		apu_synth_reset(apu->synth);
+	}
 }
 
 apu_t *
-apu_new(reset_manager_t *rm, mos6502_t *cpu)
+apu_new(reset_manager_t *rm, mos6502_t *cpu, const apu_options_t *opts)
 {
 	apu_t * apu = rc_alloc(sizeof(apu_t), deinit);
+
 	reset_manager_add_device(rm, apu, reset);
-	timekeeper_add_timer(cpu->tk, apu, apu_cycle_tick, &apu->cycle_countdown);
+	timekeeper_add_timer(cpu->tk, apu, apu_irq_tick, &apu->irq_countdown);
 	timekeeper_add_timer(cpu->tk, apu, apu_frame_tick, &apu->frame_countdown);
-	timekeeper_add_timer(cpu->tk, apu, apu_sample_tick, &apu->sample_countdown);
-	
+	timekeeper_add_timer(cpu->tk, apu, apu_dmc_tick, &apu->dmc_countdown);
+
 	apu->cpu = cpu;
-	apu->dmc.mem_reader.bus = cpu->bus;
-
-	apu->pulse2.is_pulse2 = true;
-	apu->samples = calloc(SAMPLE_COUNT, sizeof(float));
-	
-	if (SDL_InitSubSystem(SDL_INIT_AUDIO)) {
-		ERROR_PRINT("Could not init SDL audio: %s", SDL_GetError());
-		goto initerror;
-	}
-	
-	SDL_AudioSpec spec;
-	spec.freq = 44100;
-	spec.format = AUDIO_F32SYS;
-	spec.channels = 1;
-	spec.callback = NULL;
-	apu->dev = SDL_OpenAudioDevice(NULL, 0, &spec, NULL, 0);
-	if (!apu->dev) {
-		ERROR_PRINT("Could not open audio device: %s", SDL_GetError());
-		goto deverror;
+	apu->state.dmc.mem_reader.fetch = apu_fetch;
+	apu->state.dmc.mem_reader.fetch_ctx = apu;
+	apu->state.pulse2.is_pulse2 = true;
+
+	if (!opts->sink->discards || opts->tap) {
+		apu->synth = apu_synth_new(opts, 1.0 / cpu->tk->clk_period);
+		if (!apu->synth) {
+			goto error;
+		}
 	}
 
-	SDL_PauseAudioDevice(apu->dev, 0);
-	
 	return apu;
-	
-deverror:
-	SDL_QuitSubSystem(SDL_INIT_AUDIO);
-initerror:
-	free(apu->samples);
+
+error:
 	rc_release(apu);
 	return NULL;
-}
\ No newline at end of file
+}
@@ -2,7 +2,6 @@
 #include <stdbool.h>
 
 #include <nes/apu_channels.h>
-#include <membus.h>
 
 static const uint16_t dmc_rates[16] = {
 	428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106, 84, 72, 54,
@@ -14,7 +13,7 @@ uint8_t read_byte(apu_dmc_mem_reader_t *mr, const apu_reg_dmc_t *reg) {
 	}
 
 	// TODO: "stall the CPU"
-	uint8_t val = membus_read(mr->bus, mr->addr);
+	uint8_t val = mr->fetch(mr->fetch_ctx, mr->addr);
 	mr->addr = (mr->addr + 1) | 0x8000;
 
 	if (--mr->bytes_remaining == 0) {
@@ -29,6 +28,13 @@ uint8_t read_byte(apu_dmc_mem_reader_t *mr, const apu_reg_dmc_t *reg) {
 	return val;
 }
 
+static void refill(apu_channel_dmc_t *ch, const apu_reg_dmc_t *reg) {
+	ch->output_unit.shift_reg = ch->sample_buffer;
+	ch->output_unit.bits_remaining = 8;
+	ch->sample_buffer = read_byte(&ch->mem_reader, reg);
+	ch->output_unit.silence = ch->mem_reader.bytes_remaining == 0;
+}
+
 void apu_dmc_restart(apu_channel_dmc_t *ch) {
 	if (ch->mem_reader.bytes_remaining == 0) {
 		ch->mem_reader.addr = ch->mem_reader.sample_start;
@@ -40,14 +46,11 @@ inline bool apu_dmc_is_active(const apu_channel_dmc_t *ch) {
 	return ch->mem_reader.bytes_remaining > 0;
 }
 
-void apu_dmc_tick(apu_channel_dmc_t *ch, const apu_reg_dmc_t *reg) {
-	if (ch->timer > 0) {
-		ch->timer--;
-		return;
-	}
+inline uint16_t apu_dmc_period(const apu_reg_dmc_t *reg) {
+	return dmc_rates[reg->freq_idx];
+}
 
-	ch->timer = dmc_rates[reg->freq_idx] / 2;
-	
+void apu_dmc_step(apu_channel_dmc_t *ch, const apu_reg_dmc_t *reg) {
 	if (!ch->output_unit.silence) {
 		uint8_t *v = &ch->output_unit.output_level;
 		if ((ch->output_unit.shift_reg & 1) != 0) {
@@ -68,10 +71,30 @@ void apu_dmc_tick(apu_channel_dmc_t *ch, const apu_reg_dmc_t *reg) {
 		return;
 	}
 
-	ch->output_unit.shift_reg = ch->sample_buffer;
-	ch->output_unit.bits_remaining = 8;
-	ch->sample_buffer = read_byte(&ch->mem_reader, reg);
-	ch->output_unit.silence = ch->mem_reader.bytes_remaining == 0;
+	refill(ch, reg);
+}
+
+// Skips `nsteps` edges without running the output level, which nothing but
+// the channel's output depends on. The sample buffer is still refilled on the
+// edges that would refill it, so that bytes are fetched (and the IRQ raised)
+// just as they would be. Once there's nothing left to fetch, refills only load
+// silence and are skipped all at once.
+void apu_dmc_skip(apu_channel_dmc_t *ch, const apu_reg_dmc_t *reg, uint64_t nsteps) {
+	while (nsteps > ch->output_unit.bits_remaining && apu_dmc_is_active(ch)) {
+		nsteps -= ch->output_unit.bits_remaining + 1u;
+		refill(ch, reg);
+	}
+
+	if (nsteps <= ch->output_unit.bits_remaining) {
+		ch->output_unit.bits_remaining -= (uint8_t)nsteps;
+		return;
+	}
+
+	nsteps -= ch->output_unit.bits_remaining + 1u;
+	ch->output_unit.shift_reg = 0;
+	ch->output_unit.bits_remaining = (uint8_t)(8 - nsteps % 9);
+	ch->output_unit.silence = true;
+	ch->sample_buffer = 0;
 }
 
 inline uint8_t apu_dmc_sample(const apu_channel_dmc_t *ch, const apu_reg_dmc_t *reg) {
@@ -34,16 +34,36 @@ void apu_noise_half_frame(apu_channel_noise_t *ch, apu_reg_noise_t *reg) {
 	}
 }
 
-void apu_noise_tick(apu_channel_noise_t *ch, const apu_reg_noise_t *reg) {
-	if (ch->timer > 0) {
-		ch->timer--;
-		return;
+void apu_noise_skip_half_frames(apu_channel_noise_t *ch, const apu_reg_noise_t *reg, uint64_t nhalves) {
+	if (!reg->lch) {
+		ch->length_counter = ch->length_counter > nhalves ? (uint8_t)(ch->length_counter - nhalves) : 0;
 	}
-	ch->timer = noise_periods[reg->period];
+}
+
+inline uint16_t apu_noise_period(const apu_reg_noise_t *reg) {
+	return noise_periods[reg->period];
+}
+
+bool apu_noise_is_audible(const apu_channel_noise_t *ch, const apu_reg_noise_t *reg) {
+	return apu_envelope_output(&ch->envelope, ch->length_counter > 0, reg->lch, reg->volume) != 0;
+}
+
+void apu_noise_step(apu_channel_noise_t *ch, const apu_reg_noise_t *reg) {
 	uint16_t feedback = sr_bit(ch, 0) ^ sr_bit(ch, reg->mode ? 6 : 1);
 	ch->shift_reg = (ch->shift_reg >> 1) | (feedback << 14);
 }
 
+// The shift register has to go through every step, but the long mode's
+// sequence repeats every 32767 of them
+void apu_noise_skip(apu_channel_noise_t *ch, const apu_reg_noise_t *reg, uint64_t nsteps) {
+	if (!reg->mode) {
+		nsteps %= 32767;
+	}
+	for (uint64_t i = 0; i < nsteps; i++) {
+		apu_noise_step(ch, reg);
+	}
+}
+
 uint8_t apu_noise_sample(const apu_channel_noise_t *ch, const apu_reg_noise_t *reg) {
 	bool active = true;
 	active &= ch->length_counter > 0;
@@ -1,5 +1,3 @@
-#include <string.h>
-
 #include <nes/apu_channels.h>
 
 static const uint8_t pulse_sequences[4][8] = {
@@ -65,20 +63,38 @@ void apu_pulse_half_frame(apu_channel_pulse_t *ch, apu_reg_pulse_t *reg) {
 	update_period(ch, reg);
 }
 
-void apu_pulse_tick(apu_channel_pulse_t *ch, const apu_reg_pulse_t *reg) {
-	uint16_t period = reg->timer.timer;
-	if (ch->timer == 0) {
-		ch->timer = period;
-		if (ch->sequence_pos > 0) {
-			ch->sequence_pos--;
-		} else {
-			ch->sequence_pos = 7;
-		}
+// Runs the length counter through `nhalves` half frames at once. Nothing else
+// that a half frame clocks can be seen by the CPU, so this is all that the
+// APU keeps up when it isn't synthesizing samples.
+void apu_pulse_skip_half_frames(apu_channel_pulse_t *ch, const apu_reg_pulse_t *reg, uint64_t nhalves) {
+	if (!reg->volume.lch) {
+		ch->length_counter = ch->length_counter > nhalves ? (uint8_t)(ch->length_counter - nhalves) : 0;
+	}
+}
+
+// The timer is clocked every other CPU cycle
+inline uint16_t apu_pulse_period(const apu_reg_pulse_t *reg) {
+	return (reg->timer.timer + 1) * 2;
+}
+
+bool apu_pulse_is_audible(const apu_channel_pulse_t *ch, const apu_reg_pulse_t *reg) {
+	bool audible = true;
+	audible &= ch->length_counter != 0;
+	audible &= reg->timer.timer >= 8;
+	audible &= target_period(ch, reg) <= 0x07FF;
+	return apu_envelope_output(&ch->envelope, audible, reg->volume.constant, reg->volume.level) != 0;
+}
+
+void apu_pulse_step(apu_channel_pulse_t *ch, const apu_reg_pulse_t *reg) {
+	if (ch->sequence_pos > 0) {
+		ch->sequence_pos--;
 	} else {
-		ch->timer--;
+		ch->sequence_pos = 7;
 	}
-	// this function runs at >10 MHz, but... it's 8 bytes
-	memcpy(ch->sequence, pulse_sequences[reg->volume.duty], 8);
+}
+
+void apu_pulse_skip(apu_channel_pulse_t *ch, const apu_reg_pulse_t *reg, uint64_t nsteps) {
+	ch->sequence_pos = (uint8_t)((ch->sequence_pos + 8 - nsteps % 8) % 8);
 }
 
 uint8_t apu_pulse_sample(const apu_channel_pulse_t *ch, const apu_reg_pulse_t *reg) {
@@ -86,6 +102,6 @@ uint8_t apu_pulse_sample(const apu_channel_pulse_t *ch, const apu_reg_pulse_t *r
 	active &= ch->length_counter != 0;
 	active &= reg->timer.timer >= 8;
 	active &= target_period(ch, reg) <= 0x07FF;
-	active &= ch->sequence[ch->sequence_pos] != 0;
+	active &= pulse_sequences[reg->volume.duty][ch->sequence_pos] != 0;
 	return apu_envelope_output(&ch->envelope, active, reg->volume.constant, reg->volume.level);
 }
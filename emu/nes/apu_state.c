@@ -0,0 +1,171 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <nes/apu_state.h>
+
+static const uint8_t length_counters[32] = {
+    10, 254, 20, 2, 40, 4, 80, 6, 160, 8, 60, 10, 14, 12, 26, 14,
+	12, 16, 24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30,
+};
+
+static void fc_update_irq(apu_frame_counter_t *fc, const apu_reg_frame_counter_t *reg) {
+	if (reg->disable_frame_irq) {
+		fc->irq_flag = false;
+	} else if (fc->step == 3 && !reg->five_step_sequence) {
+		fc->irq_flag = true;
+	}
+}
+
+static void fc_step(apu_frame_counter_t *fc, const apu_reg_frame_counter_t *reg) {
+	fc->step++;
+	fc->step %= reg->five_step_sequence ? 5 : 4;
+	fc_update_irq(fc, reg);
+}
+
+static inline bool fc_at_quarter(const apu_frame_counter_t *fc, const apu_reg_frame_counter_t *reg) {
+	return reg->five_step_sequence ? fc->step != 3 : true;
+}
+
+static inline bool fc_at_half(const apu_frame_counter_t *fc, const apu_reg_frame_counter_t *reg) {
+	if (reg->five_step_sequence) {
+		return fc->step == 1 || fc->step == 4;
+	} else {
+		return fc->step == 1 || fc->step == 3;
+	}
+}
+
+static void quarter_frame(apu_state_t *state) {
+	apu_pulse_quarter_frame(&state->pulse1, &state->regs.pulse1);
+	apu_pulse_quarter_frame(&state->pulse2, &state->regs.pulse2);
+	apu_triangle_quarter_frame(&state->triangle, &state->regs.triangle);
+	apu_noise_quarter_frame(&state->noise, &state->regs.noise);
+}
+
+static void half_frame(apu_state_t *state) {
+	apu_pulse_half_frame(&state->pulse1, &state->regs.pulse1);
+	apu_pulse_half_frame(&state->pulse2, &state->regs.pulse2);
+	apu_triangle_half_frame(&state->triangle, &state->regs.triangle);
+	apu_noise_half_frame(&state->noise, &state->regs.noise);
+}
+
+void apu_state_reset(apu_state_t *state) {
+	#define ZERO(x) memset(&x, 0, sizeof(x));
+
+	ZERO(state->pulse1);
+	ZERO(state->pulse2);
+	state->pulse2.is_pulse2 = true;
+
+	ZERO(state->triangle);
+
+	ZERO(state->noise);
+	state->noise.shift_reg = 1;
+
+	ZERO(state->dmc.mem_reader.sample_start);
+	ZERO(state->dmc.mem_reader.sample_len);
+	ZERO(state->dmc.mem_reader.addr);
+	ZERO(state->dmc.mem_reader.bytes_remaining);
+	ZERO(state->dmc.sample_buffer);
+	ZERO(state->dmc.next_edge);
+	ZERO(state->dmc.output_unit);
+
+	ZERO(state->frame_counter);
+
+	ZERO(state->reg_bytes);
+
+	#undef ZERO
+}
+
+void apu_state_write(apu_state_t *state, uint16_t addr, uint8_t data) {
+	state->reg_bytes[addr] = data;
+	uint8_t length_counter = length_counters[data >> 3];
+	switch (addr) {
+		case 0x01:
+			apu_pulse_reload_sweep(&state->pulse1);
+			break;
+		case 0x03:
+			apu_pulse_set_lc(&state->pulse1, length_counter);
+			break;
+		case 0x05:
+			apu_pulse_reload_sweep(&state->pulse2);
+			break;
+		case 0x07:
+			apu_pulse_set_lc(&state->pulse2, length_counter);
+			break;
+		case 0x0B:
+			apu_triangle_set_lc(&state->triangle, length_counter);
+			break;
+		case 0x0F:
+			apu_noise_set_lc(&state->noise, length_counter);
+			break;
+		case 0x10:
+			if (!state->regs.dmc.irq) {
+				state->dmc.mem_reader.irq_flag = false;
+			}
+			break;
+		case 0x11:
+			state->dmc.output_unit.output_level = state->regs.dmc.direct_load;
+			break;
+		case 0x12:
+			state->dmc.mem_reader.sample_start = state->regs.dmc.sample_addr * 64 + 0xC000;
+			state->dmc.mem_reader.addr = state->dmc.mem_reader.sample_start;
+			break;
+		case 0x13:
+			state->dmc.mem_reader.sample_len = state->regs.dmc.sample_len * 16 + 1;
+			state->dmc.mem_reader.bytes_remaining = state->dmc.mem_reader.sample_len;
+			break;
+		case 0x15:
+			state->dmc.mem_reader.irq_flag = false;
+			if (state->regs.control.dmc) {
+				apu_dmc_restart(&state->dmc);
+			}
+			break;
+		case 0x17:
+			state->frame_counter.step = 0;
+			if (state->regs.frame_counter.five_step_sequence) {
+				quarter_frame(state);
+				half_frame(state);
+			}
+			fc_update_irq(&state->frame_counter, &state->regs.frame_counter);
+			break;
+		default:
+			break;
+	}
+}
+
+void apu_state_frame_step(apu_state_t *state) {
+	fc_step(&state->frame_counter, &state->regs.frame_counter);
+
+	if (fc_at_quarter(&state->frame_counter, &state->regs.frame_counter)) {
+		quarter_frame(state);
+	}
+	if (fc_at_half(&state->frame_counter, &state->regs.frame_counter)) {
+		half_frame(state);
+	}
+}
+
+// Whole sequences each clock two half frames and pass the IRQ step; the steps
+// left over are taken one at a time
+void apu_state_skip_frame_steps(apu_state_t *state, uint64_t nsteps) {
+	if (nsteps == 0) {
+		return;
+	}
+
+	apu_frame_counter_t *fc = &state->frame_counter;
+	const apu_reg_frame_counter_t *reg = &state->regs.frame_counter;
+	uint8_t sequence_len = reg->five_step_sequence ? 5 : 4;
+
+	uint64_t nhalves = nsteps / sequence_len * 2;
+	if (nsteps >= sequence_len && !reg->five_step_sequence && !reg->disable_frame_irq) {
+		fc->irq_flag = true;
+	}
+	for (uint64_t i = 0; i < nsteps % sequence_len; i++) {
+		fc_step(fc, reg);
+		nhalves += fc_at_half(fc, reg);
+	}
+
+	apu_pulse_skip_half_frames(&state->pulse1, &state->regs.pulse1, nhalves);
+	apu_pulse_skip_half_frames(&state->pulse2, &state->regs.pulse2, nhalves);
+	apu_triangle_skip_half_frames(&state->triangle, &state->regs.triangle, nhalves);
+	apu_noise_skip_half_frames(&state->noise, &state->regs.noise, nhalves);
+}
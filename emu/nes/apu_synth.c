@@ -0,0 +1,383 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include <SDL2/SDL.h>
+#include <base.h>
+#include <rc.h>
+#include <nes/apu_state.h>
+#include <nes/apu_synth.h>
+#include <nes/blip.h>
+#include <nes/biquad.h>
+#include <nes/audiosink.h>
+
+// The corners of the high-pass and low-pass filters on the NES's audio output
+#define AUDIO_HIGHPASS1_HZ 90.
+#define AUDIO_HIGHPASS2_HZ 440.
+#define AUDIO_LOWPASS_HZ 14000.
+
+// The entries that the log has room for (a power of two). Games write a few
+// dozen registers a frame, or a few hundred when they stream samples through
+// $4011, so this covers far more than the synthesis thread ever lags by.
+#define LOG_NENTRIES 16384
+
+// The fetched DMC bytes that can be waiting for the synthesis thread's DMC to
+// get to them (a power of two). At its fastest, the DMC fetches about 15
+// bytes per frame counter step.
+#define NFETCHED 256
+
+typedef enum log_kind {
+	LOG_WRITE,
+	LOG_FETCH,
+	LOG_SYNC,
+	LOG_RESET,
+} log_kind_t;
+
+typedef struct log_entry {
+	uint64_t clk;
+	uint8_t kind;
+	uint8_t addr;
+	uint8_t data;
+} log_entry_t;
+
+typedef struct apu_synth {
+	// The emulation thread only ever advances `head` and the synthesis
+	// thread only `tail`. They're kept a cache line apart, so that the
+	// threads don't fight over one.
+	log_entry_t * nullable /*owned*/ log;
+	atomic_size_t head;
+	char pad[64 - sizeof(atomic_size_t)];
+	atomic_size_t tail;
+
+	// Only touched by the emulation thread
+	size_t nstalls;
+
+	SDL_Thread * nullable /*owned*/ thread;
+	SDL_sem * nullable /*owned*/ work;
+	atomic_bool running;
+
+	// Only touched by the synthesis thread. The channels have been run up to
+	// master cycle `clk_synced`, and the frame counter takes its next step
+	// at `clk_step`. `levels` are the channels' output levels at
+	// `clk_synced`, and `output` is the mix of those.
+	apu_state_t state;
+	uint64_t clk_synced;
+	uint64_t clk_step;
+	uint8_t levels[5];
+	float output;
+	uint8_t fetched[NFETCHED];
+	size_t fetched_head;
+	size_t fetched_tail;
+
+	uint32_t sample_rate;
+	blip_t blip;
+	biquad_chain_t filters;
+	float * nullable /*owned*/ samples;
+
+	audiosink_t * nonnull /*strong*/ sink;
+	apu_sample_callback_t * nullable tap;
+	void * nullable /*unowned*/ tap_ctx;
+} apu_synth_t;
+
+// The nonlinear mix of the pulse channels, indexed by the sum of their levels,
+// and of the other three, indexed by 3 * triangle + 2 * noise + dmc
+static float pulse_table[31];
+static float tnd_table[203];
+
+static void build_mix_tables(void) {
+	for (size_t n = 1; n < 31; n++) {
+		pulse_table[n] = (float)(95.52 / (8128. / n + 100.));
+	}
+	for (size_t n = 1; n < 203; n++) {
+		tnd_table[n] = (float)(163.67 / (24329. / n + 100.));
+	}
+}
+
+static inline float mix_sample(const uint8_t levels[5]) {
+	return pulse_table[levels[0] + levels[1]] + tnd_table[3 * levels[2] + 2 * levels[3] + levels[4]];
+}
+
+// Adds a step to the output at master cycle `clk` if any channel's level has
+// changed
+static void update_output(apu_synth_t *synth, uint64_t clk) {
+	apu_state_t *s = &synth->state;
+	uint8_t levels[5] = {
+		apu_pulse_sample(&s->pulse1, &s->regs.pulse1),
+		apu_pulse_sample(&s->pulse2, &s->regs.pulse2),
+		apu_triangle_sample(&s->triangle, &s->regs.triangle),
+		apu_noise_sample(&s->noise, &s->regs.noise),
+		apu_dmc_sample(&s->dmc, &s->regs.dmc),
+	};
+	if (!memcmp(levels, synth->levels, sizeof(levels))) {
+		return;
+	}
+	memcpy(synth->levels, levels, sizeof(levels));
+
+	float output = mix_sample(levels);
+	blip_add_delta(&synth->blip, clk, output - synth->output);
+	synth->output = output;
+}
+
+static inline uint64_t min_clk(uint64_t a, uint64_t b) {
+	return a < b ? a : b;
+}
+
+// Runs the channels through every edge up to and including master cycle
+// `clk`. Channels whose output can't change before then skip their edges all
+// at once; the rest are stepped edge by edge, in order, so that each step in
+// the output is mixed from the levels of all channels at the time.
+static void run_channels(apu_synth_t *synth, uint64_t clk) {
+	if (clk <= synth->clk_synced) {
+		return;
+	}
+
+	apu_state_t *s = &synth->state;
+	if (!apu_pulse_is_audible(&s->pulse1, &s->regs.pulse1)) {
+		uint64_t nedges = apu_skip_edges(&s->pulse1.next_edge, apu_pulse_period(&s->regs.pulse1), clk);
+		apu_pulse_skip(&s->pulse1, &s->regs.pulse1, nedges);
+	}
+	if (!apu_pulse_is_audible(&s->pulse2, &s->regs.pulse2)) {
+		uint64_t nedges = apu_skip_edges(&s->pulse2.next_edge, apu_pulse_period(&s->regs.pulse2), clk);
+		apu_pulse_skip(&s->pulse2, &s->regs.pulse2, nedges);
+	}
+	if (!apu_triangle_is_stepping(&s->triangle, &s->regs.triangle)) {
+		apu_skip_edges(&s->triangle.next_edge, apu_triangle_period(&s->regs.triangle), clk);
+	}
+	if (!apu_noise_is_audible(&s->noise, &s->regs.noise)) {
+		uint64_t nedges = apu_skip_edges(&s->noise.next_edge, apu_noise_period(&s->regs.noise), clk);
+		apu_noise_skip(&s->noise, &s->regs.noise, nedges);
+	}
+
+	for (;;) {
+		uint64_t edge = min_clk(min_clk(s->pulse1.next_edge, s->pulse2.next_edge),
+				       min_clk(min_clk(s->triangle.next_edge, s->noise.next_edge),
+					       s->dmc.next_edge));
+		if (edge > clk) {
+			break;
+		}
+
+		if (s->pulse1.next_edge == edge) {
+			apu_pulse_step(&s->pulse1, &s->regs.pulse1);
+			s->pulse1.next_edge += apu_pulse_period(&s->regs.pulse1) * MOS6502_CLKDIVISOR;
+		}
+		if (s->pulse2.next_edge == edge) {
+			apu_pulse_step(&s->pulse2, &s->regs.pulse2);
+			s->pulse2.next_edge += apu_pulse_period(&s->regs.pulse2) * MOS6502_CLKDIVISOR;
+		}
+		if (s->triangle.next_edge == edge) {
+			apu_triangle_step(&s->triangle, &s->regs.triangle);
+			s->triangle.next_edge += apu_triangle_period(&s->regs.triangle) * MOS6502_CLKDIVISOR;
+		}
+		if (s->noise.next_edge == edge) {
+			apu_noise_step(&s->noise, &s->regs.noise);
+			s->noise.next_edge += apu_noise_period(&s->regs.noise) * MOS6502_CLKDIVISOR;
+		}
+		if (s->dmc.next_edge == edge) {
+			apu_dmc_step(&s->dmc, &s->regs.dmc);
+			s->dmc.next_edge += apu_dmc_period(&s->regs.dmc) * MOS6502_CLKDIVISOR;
+		}
+
+		update_output(synth, edge);
+	}
+
+	synth->clk_synced = clk;
+}
+
+// Takes the frame counter's step at master cycle `clk`, and synthesizes the
+// samples for everything up to then
+static void frame_step(apu_synth_t *synth, uint64_t clk) {
+	apu_state_frame_step(&synth->state);
+	update_output(synth, clk);
+
+	blip_end_block(&synth->blip, clk);
+	size_t nsamples = blip_read_samples(&synth->blip, (float * nonnull)synth->samples, BLIP_NSAMPLES);
+	biquad_chain_process(&synth->filters, (float * nonnull)synth->samples, nsamples);
+
+	audiosink_push(synth->sink, (float * nonnull)synth->samples, nsamples);
+	if (synth->tap) {
+		synth->tap(synth->tap_ctx, (float * nonnull)synth->samples, nsamples);
+	}
+}
+
+// Runs everything up to master cycle `clk`, taking the frame counter's steps
+// on the way
+static void run(apu_synth_t *synth, uint64_t clk) {
+	while (synth->clk_step <= clk) {
+		run_channels(synth, synth->clk_step);
+		frame_step(synth, synth->clk_step);
+		synth->clk_step += APU_QUARTER_FRAME;
+	}
+	run_channels(synth, clk);
+}
+
+// Hands the synthesis thread's DMC the next byte that the emulation thread's
+// DMC fetched. Both run the same sequence of fetches, so the bytes always come
+// in the order they're asked for.
+static uint8_t fetch_logged(void *ctx, uint16_t addr) {
+	apu_synth_t *synth = ctx;
+	if (synth->fetched_tail == synth->fetched_head) {
+		return 0;
+	}
+	return synth->fetched[synth->fetched_tail++ & (NFETCHED - 1)];
+}
+
+static void reset(apu_synth_t *synth) {
+	apu_state_reset(&synth->state);
+	synth->clk_synced = 0;
+	synth->clk_step = APU_QUARTER_FRAME;
+	memset(synth->levels, 0, sizeof(synth->levels));
+	synth->output = 0.f;
+	synth->fetched_head = 0;
+	synth->fetched_tail = 0;
+	blip_reset(&synth->blip, 0);
+	biquad_chain_reset(&synth->filters);
+}
+
+static void replay(apu_synth_t *synth, const log_entry_t *entry) {
+	switch (entry->kind) {
+		case LOG_WRITE:
+			run(synth, entry->clk);
+			apu_state_write(&synth->state, entry->addr, entry->data);
+			update_output(synth, entry->clk);
+			break;
+		case LOG_FETCH:
+			synth->fetched[synth->fetched_head++ & (NFETCHED - 1)] = entry->data;
+			break;
+		case LOG_SYNC:
+			run(synth, entry->clk);
+			break;
+		case LOG_RESET:
+			reset(synth);
+			break;
+		default:
+			break;
+	}
+}
+
+// Replays the log until it's empty, handing each entry's room back as soon as
+// it's been replayed
+static void drain(apu_synth_t *synth) {
+	size_t tail = atomic_load_explicit(&synth->tail, memory_order_relaxed);
+	size_t head;
+	while ((head = atomic_load_explicit(&synth->head, memory_order_acquire)) != tail) {
+		for (; tail != head; tail++) {
+			replay(synth, &((log_entry_t * nonnull)synth->log)[tail & (LOG_NENTRIES - 1)]);
+			atomic_store_explicit(&synth->tail, tail + 1, memory_order_release);
+		}
+	}
+}
+
+static int synth_thread(void * nonnull data) {
+	apu_synth_t *synth = data;
+
+	while (atomic_load(&synth->running)) {
+		SDL_SemWait((SDL_sem * nonnull)synth->work);
+		drain(synth);
+	}
+
+	// Replay whatever was logged before shutdown
+	drain(synth);
+	return 0;
+}
+
+static void log_push(apu_synth_t *synth, log_entry_t entry) {
+	size_t head = atomic_load_explicit(&synth->head, memory_order_relaxed);
+	while (head - atomic_load_explicit(&synth->tail, memory_order_acquire) == LOG_NENTRIES) {
+		// The synthesis thread is a whole log behind. Make sure it's awake,
+		// and give it a moment.
+		synth->nstalls++;
+		SDL_SemPost((SDL_sem * nonnull)synth->work);
+		SDL_Delay(1);
+	}
+
+	((log_entry_t * nonnull)synth->log)[head & (LOG_NENTRIES - 1)] = entry;
+	atomic_store_explicit(&synth->head, head + 1, memory_order_release);
+}
+
+void apu_synth_write(apu_synth_t *synth, uint64_t clk, uint16_t addr, uint8_t data) {
+	log_push(synth, (log_entry_t) { .clk = clk, .kind = LOG_WRITE, .addr = (uint8_t)addr, .data = data });
+}
+
+void apu_synth_fetch(apu_synth_t *synth, uint8_t data) {
+	log_push(synth, (log_entry_t) { .kind = LOG_FETCH, .data = data });
+}
+
+void apu_synth_sync(apu_synth_t *synth, uint64_t clk) {
+	log_push(synth, (log_entry_t) { .clk = clk, .kind = LOG_SYNC });
+	SDL_SemPost((SDL_sem * nonnull)synth->work);
+}
+
+void apu_synth_reset(apu_synth_t *synth) {
+	log_push(synth, (log_entry_t) { .kind = LOG_RESET });
+}
+
+static void deinit(apu_synth_t * nonnull synth) {
+	if (synth->thread) {
+		atomic_store(&synth->running, false);
+		SDL_SemPost((SDL_sem * nonnull)synth->work);
+		SDL_WaitThread(synth->thread, NULL);
+
+		if (synth->nstalls) {
+			WARNING_PRINT("APU: emulation waited %zu times for the synthesis thread", synth->nstalls);
+		}
+	}
+
+	if (synth->work) {
+		SDL_DestroySemaphore((SDL_sem * nonnull)synth->work);
+	}
+	free(synth->log);
+	free(synth->samples);
+	rc_release(synth->sink);
+}
+
+apu_synth_t *
+apu_synth_new(const apu_options_t *opts, double clk_rate)
+{
+	apu_synth_t * synth = rc_alloc(sizeof(apu_synth_t), deinit);
+	synth->sink = rc_retain(opts->sink);
+	synth->tap = opts->tap;
+	synth->tap_ctx = opts->tap_ctx;
+
+	synth->state.dmc.mem_reader.fetch = fetch_logged;
+	synth->state.dmc.mem_reader.fetch_ctx = synth;
+
+	synth->sample_rate = opts->sample_rate ? opts->sample_rate : APU_SAMPLE_RATE;
+	blip_init(&synth->blip, clk_rate, synth->sample_rate);
+
+	build_mix_tables();
+	biquad_coeffs_t filters[] = {
+		biquad_highpass1(AUDIO_HIGHPASS1_HZ, synth->sample_rate),
+		biquad_highpass1(AUDIO_HIGHPASS2_HZ, synth->sample_rate),
+		biquad_lowpass1(AUDIO_LOWPASS_HZ, synth->sample_rate),
+	};
+	biquad_chain_init(&synth->filters, filters, sizeof(filters) / sizeof(*filters));
+	reset(synth);
+
+	synth->samples = calloc(BLIP_NSAMPLES, sizeof(float));
+	synth->log = calloc(LOG_NENTRIES, sizeof(log_entry_t));
+	if (!synth->samples || !synth->log) {
+		ERROR_PRINT("Could not allocate audio buffers");
+		goto error;
+	}
+	atomic_init(&synth->head, 0);
+	atomic_init(&synth->tail, 0);
+
+	synth->work = SDL_CreateSemaphore(0);
+	if (!synth->work) {
+		ERROR_PRINT("Could not create a semaphore: %s", SDL_GetError());
+		goto error;
+	}
+
+	atomic_init(&synth->running, true);
+	synth->thread = SDL_CreateThread(synth_thread, "apu", synth);
+	if (!synth->thread) {
+		ERROR_PRINT("Could not create the APU synthesis thread: %s", SDL_GetError());
+		goto error;
+	}
+
+	return synth;
+error:
+	rc_release(synth);
+	return NULL;
+}
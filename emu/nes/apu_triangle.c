@@ -33,18 +33,28 @@ void apu_triangle_half_frame(apu_channel_triangle_t *ch, apu_reg_triangle_t *reg
 	}
 }
 
-void apu_triangle_tick(apu_channel_triangle_t *ch, const apu_reg_triangle_t *reg) {
-	if (ch->timer > 0) {
-		ch->timer--;
-		return;
-	}
-	ch->timer = reg->timer.timer + 1;
-	if (ch->linear_counter > 0 && ch->length_counter > 0) {
-		ch->sequence_pos += 1;
-		ch->sequence_pos %= 32;
+void apu_triangle_skip_half_frames(apu_channel_triangle_t *ch, const apu_reg_triangle_t *reg, uint64_t nhalves) {
+	if (!reg->counter.control) {
+		ch->length_counter = ch->length_counter > nhalves ? (uint8_t)(ch->length_counter - nhalves) : 0;
 	}
 }
 
+inline uint16_t apu_triangle_period(const apu_reg_triangle_t *reg) {
+	return reg->timer.timer + 1;
+}
+
+// The sequencer only moves while both counters are nonzero. Ultrasonic periods
+// are held rather than stepped, since the hardware's output at those averages
+// out to a level that isn't worth a step every other cycle.
+bool apu_triangle_is_stepping(const apu_channel_triangle_t *ch, const apu_reg_triangle_t *reg) {
+	return ch->linear_counter > 0 && ch->length_counter > 0 && reg->timer.timer >= 2;
+}
+
+void apu_triangle_step(apu_channel_triangle_t *ch, const apu_reg_triangle_t *reg) {
+	ch->sequence_pos += 1;
+	ch->sequence_pos %= 32;
+}
+
 uint8_t apu_triangle_sample(const apu_channel_triangle_t *ch, const apu_reg_triangle_t *reg) {
 	if (ch->sequence_pos <= 15) {
 		return 15 - ch->sequence_pos;
@@ -0,0 +1,83 @@
+#include <base.h>
+#include <nes/audioring.h>
+
+#include <string.h>
+
+int
+audio_ring_init (audio_ring_t * ring, size_t capacity)
+{
+	ASSERT((capacity & (capacity - 1)) == 0);
+
+	ring->samples = calloc(capacity, sizeof(float));
+	if (!ring->samples) {
+		return -1;
+	}
+	ring->capacity = capacity;
+	atomic_init(&ring->head, 0);
+	atomic_init(&ring->tail, 0);
+	return 0;
+}
+
+void
+audio_ring_deinit (audio_ring_t * ring)
+{
+	free(ring->samples);
+	ring->samples = NULL;
+}
+
+size_t
+audio_ring_fill (audio_ring_t * ring)
+{
+	size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+	size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+	return head - tail;
+}
+
+// The index into the ring's samples of position `pos`, and how many samples
+// from there can be copied before wrapping around
+static inline size_t
+wrap (const audio_ring_t * nonnull ring, size_t pos, size_t nsamples, size_t * nonnull first)
+{
+	size_t start = pos & (ring->capacity - 1);
+	*first = ring->capacity - start < nsamples ? ring->capacity - start : nsamples;
+	return start;
+}
+
+size_t
+audio_ring_write (audio_ring_t * ring, const float * samples, size_t nsamples)
+{
+	size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+	size_t room = ring->capacity - (head - tail);
+	if (nsamples > room) {
+		nsamples = room;
+	}
+
+	size_t first;
+	size_t start = wrap(ring, head, nsamples, &first);
+	memcpy((float * nonnull)ring->samples + start, samples, first * sizeof(float));
+	memcpy((float * nonnull)ring->samples, samples + first, (nsamples - first) * sizeof(float));
+
+	atomic_store_explicit(&ring->head, head + nsamples, memory_order_release);
+	return nsamples;
+}
+
+size_t
+audio_ring_read (audio_ring_t * ring, float * samples, size_t nsamples)
+{
+	size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+	if (nsamples > head - tail) {
+		nsamples = head - tail;
+	}
+
+	size_t first;
+	size_t start = wrap(ring, tail, nsamples, &first);
+	memcpy(samples, (float * nonnull)ring->samples + start, first * sizeof(float));
+	memcpy(samples + first, (float * nonnull)ring->samples, (nsamples - first) * sizeof(float));
+
+	atomic_store_explicit(&ring->tail, tail + nsamples, memory_order_release);
+	return nsamples;
+}
@@ -0,0 +1,416 @@
+#include <rc.h>
+#include <base.h>
+#include <fileio.h>
+#include <nes/audioring.h>
+#include <nes/audiosink.h>
+#include <SDL2/SDL.h>
+
+#include <errno.h>
+#include <string.h>
+#include <stdatomic.h>
+
+// The samples that the sound device asks for at a time, the size of the ring
+// that feeds it, and how full that ring is kept (about 46ms at 44.1kHz)
+#define SDL_DEVICE_NSAMPLES 512
+#define SDL_RING_NSAMPLES 8192
+#define SDL_TARGET_FILL 2048
+
+// The most that the rate samples are played at is nudged away from the sample
+// rate, which is far too little to be heard as a change in pitch
+#define SDL_MAX_RATE_DELTA 0.005
+
+// How much each new measurement of the ring's fill counts towards its average,
+// and how quickly the difference between the device's clock and emulation's
+// is learned from the fill's distance to the target (slowly enough that the
+// fill settles without overshooting). Both are per callback.
+#define SDL_FILL_SMOOTHING 0.06
+#define SDL_DRIFT_GAIN 1.5e-6
+
+// The samples held back between callbacks when resampling: the one that the
+// next callback starts from, one before it and two after it
+#define SDL_HISTORY 4
+
+// The size of the stdio buffer that WAV sinks write through
+#define WAV_BUFFER_SIZE (64 * 1024)
+
+// The offsets of the two size fields in a WAV header, and the header's size
+#define WAV_RIFF_SIZE_OFFSET 4
+#define WAV_DATA_SIZE_OFFSET 40
+#define WAV_HEADER_SIZE 44
+
+// A sink that plays samples on a sound device. The device pulls samples from
+// `ring` on its own thread. It keeps track of how full the ring is, and plays
+// samples at `step` times the sample rate (resampling them) to keep it near
+// the target.
+typedef struct sdl_audiosink {
+	audiosink_t sink;
+
+	uint32_t sample_rate;
+	bool audio_init;
+	SDL_AudioDeviceID dev;
+	size_t device_nsamples;
+	audio_ring_t ring;
+
+	// Only touched by the device's thread. `resample_buf` holds the
+	// `SDL_HISTORY` samples that the last callback didn't pass, followed by
+	// the ones taken from the ring for the current callback.
+	bool primed;
+	double fill_avg;
+	double drift;
+	double step;
+	double phase;
+	float * nullable /*owned*/ resample_buf;
+	float history[SDL_HISTORY];
+	float last_sample;
+
+	_Atomic double latency_ms;
+	_Atomic double rate_ratio;
+	atomic_size_t nunderruns;
+	atomic_size_t noverruns;
+} sdl_audiosink_t;
+
+// A sink that streams samples to a WAV file
+typedef struct wav_audiosink {
+	audiosink_t sink;
+
+	char * nullable /*owned*/ path;
+	FILE * nullable /*owned*/ f;
+	char * nullable /*owned*/ buffer;
+	uint32_t sample_rate;
+	size_t nsamples_written;
+	size_t nsamples_in_header;
+	bool failed;
+} wav_audiosink_t;
+
+static inline double
+clamp_delta (double delta)
+{
+	if (delta > SDL_MAX_RATE_DELTA) {
+		return SDL_MAX_RATE_DELTA;
+	}
+	else if (delta < -SDL_MAX_RATE_DELTA) {
+		return -SDL_MAX_RATE_DELTA;
+	}
+	return delta;
+}
+
+// Nudges the rate that samples are played at so that the ring's average fill
+// is pulled towards the target. The nudge is in proportion to how far off the
+// fill is, plus the learned drift between the two clocks, so that the fill
+// settles at the target rather than wherever the proportional nudge alone
+// would make up for the drift.
+static void
+sdl_update_step (sdl_audiosink_t * nonnull sdl, size_t fill)
+{
+	sdl->fill_avg += ((double)fill - sdl->fill_avg) * SDL_FILL_SMOOTHING;
+
+	double error = (sdl->fill_avg - SDL_TARGET_FILL) / SDL_TARGET_FILL;
+	sdl->drift = clamp_delta(sdl->drift + error * SDL_DRIFT_GAIN);
+	sdl->step = 1. + clamp_delta(error * SDL_MAX_RATE_DELTA + sdl->drift);
+
+	atomic_store(&sdl->latency_ms, (sdl->fill_avg + sdl->device_nsamples) * 1000. / sdl->sample_rate);
+	atomic_store(&sdl->rate_ratio, sdl->step);
+}
+
+// Interpolates between `s[0]` and `s[1]` at `t`, along a Catmull-Rom spline
+static inline float
+cubic (const float * nonnull s, float t)
+{
+	float a = -0.5f * s[-1] + 1.5f * s[0] - 1.5f * s[1] + 0.5f * s[2];
+	float b = s[-1] - 2.5f * s[0] + 2.f * s[1] - 0.5f * s[2];
+	float c = -0.5f * s[-1] + 0.5f * s[1];
+	return ((a * t + b) * t + c) * t + s[0];
+}
+
+// Feeds the sound device from the ring, on the device's thread. Until the ring
+// has filled up to the target (at first, and again after running dry), the
+// device is given the last sample it played, so that it doesn't pop.
+static void
+sdl_audio_callback (void * nonnull ctx, Uint8 * nonnull stream, int len)
+{
+	sdl_audiosink_t * sdl = ctx;
+	float * out = (float *)stream;
+	size_t nwanted = (size_t)len / sizeof(float);
+
+	size_t fill = audio_ring_fill(&sdl->ring);
+	if (!sdl->primed && fill >= SDL_TARGET_FILL) {
+		sdl->primed = true;
+	}
+
+	// Output sample `i` is at `phase + i * step` samples past the second
+	// sample of history, and needs the two samples either side of that. As
+	// many samples are taken from the ring as the callback moves past, and
+	// the history keeps enough of a lead to cover the ones after that.
+	size_t nneeded = 0;
+	double end = 0.;
+	if (sdl->primed) {
+		sdl_update_step(sdl, fill);
+		end = sdl->phase + nwanted * sdl->step;
+		nneeded = (size_t)end;
+
+		if (fill < nneeded || nneeded > sdl->device_nsamples * 2) {
+			sdl->primed = false;
+			atomic_fetch_add(&sdl->nunderruns, 1);
+		}
+	}
+
+	if (!sdl->primed) {
+		for (size_t i = 0; i < nwanted; i++) {
+			out[i] = sdl->last_sample;
+		}
+		return;
+	}
+
+	float * buf = (float * nonnull)sdl->resample_buf;
+	memcpy(buf, sdl->history, sizeof(sdl->history));
+	audio_ring_read(&sdl->ring, buf + SDL_HISTORY, nneeded);
+
+	for (size_t i = 0; i < nwanted; i++) {
+		double pos = sdl->phase + i * sdl->step;
+		size_t k = (size_t)pos;
+		out[i] = cubic(buf + 1 + k, (float)(pos - k));
+	}
+	sdl->last_sample = out[nwanted - 1];
+
+	memcpy(sdl->history, buf + nneeded, sizeof(sdl->history));
+	sdl->phase = end - nneeded;
+}
+
+static void
+sdl_push (audiosink_t * nonnull sink, const float * nonnull samples, size_t nsamples)
+{
+	sdl_audiosink_t * sdl = (sdl_audiosink_t *)sink;
+	if (audio_ring_write(&sdl->ring, samples, nsamples) < nsamples) {
+		atomic_fetch_add(&sdl->noverruns, 1);
+	}
+}
+
+static int
+sdl_get_stats (audiosink_t * nonnull sink, audiosink_stats_t * nonnull stats)
+{
+	sdl_audiosink_t * sdl = (sdl_audiosink_t *)sink;
+	stats->nunderruns = atomic_load(&sdl->nunderruns);
+	stats->noverruns = atomic_load(&sdl->noverruns);
+	stats->latency_ms = atomic_load(&sdl->latency_ms);
+	stats->target_latency_ms = (double)(SDL_TARGET_FILL + sdl->device_nsamples) * 1000. / sdl->sample_rate;
+	stats->rate_ratio = atomic_load(&sdl->rate_ratio);
+	return 0;
+}
+
+static void
+sdl_deinit (sdl_audiosink_t * nonnull sdl)
+{
+	if (sdl->dev) {
+		// Stops the device's thread before the ring goes away
+		SDL_CloseAudioDevice(sdl->dev);
+
+		audiosink_stats_t stats;
+		sdl_get_stats(&sdl->sink, &stats);
+		INFO_PRINT("Audio: %zu underruns, %zu overruns, %.1fms latency (target %.1fms), rate x%.4f",
+			   stats.nunderruns, stats.noverruns, stats.latency_ms, stats.target_latency_ms, stats.rate_ratio);
+	}
+	if (sdl->audio_init) {
+		SDL_QuitSubSystem(SDL_INIT_AUDIO);
+	}
+
+	audio_ring_deinit(&sdl->ring);
+	free(sdl->resample_buf);
+}
+
+audiosink_t *
+audiosink_new_sdl (uint32_t sample_rate)
+{
+	sdl_audiosink_t * sdl = rc_alloc(sizeof(sdl_audiosink_t), sdl_deinit);
+	sdl->sink.push = sdl_push;
+	sdl->sink.get_stats = sdl_get_stats;
+	sdl->sample_rate = sample_rate;
+
+	sdl->fill_avg = SDL_TARGET_FILL;
+	sdl->step = 1.;
+	atomic_init(&sdl->latency_ms, 0.);
+	atomic_init(&sdl->rate_ratio, 1.);
+	atomic_init(&sdl->nunderruns, 0);
+	atomic_init(&sdl->noverruns, 0);
+
+	if (audio_ring_init(&sdl->ring, SDL_RING_NSAMPLES)) {
+		ERROR_PRINT("Could not allocate audio buffers");
+		goto error;
+	}
+
+	if (SDL_InitSubSystem(SDL_INIT_AUDIO)) {
+		ERROR_PRINT("Could not init SDL audio: %s", SDL_GetError());
+		goto error;
+	}
+	sdl->audio_init = true;
+
+	SDL_AudioSpec spec, obtained;
+	memset(&spec, 0, sizeof(spec));
+	spec.freq = (int)sample_rate;
+	spec.format = AUDIO_F32SYS;
+	spec.channels = 1;
+	spec.samples = SDL_DEVICE_NSAMPLES;
+	spec.callback = sdl_audio_callback;
+	spec.userdata = sdl;
+	sdl->dev = SDL_OpenAudioDevice(NULL, 0, &spec, &obtained, 0);
+	if (!sdl->dev) {
+		ERROR_PRINT("Could not open audio device: %s", SDL_GetError());
+		goto error;
+	}
+	sdl->device_nsamples = obtained.samples;
+
+	// Room for the history, and up to twice as many samples as the device
+	// asks for (far more than the rate is ever nudged by)
+	sdl->resample_buf = calloc(sdl->device_nsamples * 2 + SDL_HISTORY, sizeof(float));
+	if (!sdl->resample_buf) {
+		ERROR_PRINT("Could not allocate audio buffers");
+		goto error;
+	}
+
+	SDL_PauseAudioDevice(sdl->dev, 0);
+
+	return &sdl->sink;
+error:
+	rc_release(sdl);
+	return NULL;
+}
+
+static void
+null_push (audiosink_t * nonnull sink, const float * nonnull samples, size_t nsamples)
+{
+}
+
+audiosink_t *
+audiosink_new_null (void)
+{
+	audiosink_t * sink = rc_alloc(sizeof(audiosink_t), NULL);
+	sink->push = null_push;
+	sink->discards = true;
+	return sink;
+}
+
+static void
+wav_push (audiosink_t * nonnull sink, const float * nonnull samples, size_t nsamples)
+{
+	wav_audiosink_t * wav = (wav_audiosink_t *)sink;
+	if (wav->failed) {
+		return;
+	}
+
+	FILE * f = (FILE * nonnull)wav->f;
+	if (fwrite(samples, sizeof(float), nsamples, f) != nsamples) {
+		ERROR_PRINT("Could not write to %s: %s", wav->path, strerror(errno));
+		wav->failed = true;
+		return;
+	}
+	wav->nsamples_written += nsamples;
+
+	// Bring the header up to date about once a second, so that the file
+	// stays playable even if the emulator exits without releasing the sink
+	if (wav->nsamples_written - wav->nsamples_in_header >= wav->sample_rate) {
+		audiosink_write_wav_header(f, wav->sample_rate, wav->nsamples_written * sizeof(float));
+		wav->nsamples_in_header = wav->nsamples_written;
+	}
+}
+
+static void
+wav_deinit (wav_audiosink_t * nonnull wav)
+{
+	if (wav->f) {
+		FILE * f = (FILE * nonnull)wav->f;
+		if (!wav->failed && audiosink_write_wav_header(f, wav->sample_rate, wav->nsamples_written * sizeof(float))) {
+			ERROR_PRINT("Could not finish %s: %s", wav->path, strerror(errno));
+		}
+		fclose(f);
+		INFO_PRINT("Audio: %zu samples written to %s", wav->nsamples_written, wav->path);
+	}
+	free(wav->buffer);
+	free(wav->path);
+}
+
+audiosink_t *
+audiosink_new_wav (const char * path, uint32_t sample_rate)
+{
+	wav_audiosink_t * wav = rc_alloc(sizeof(wav_audiosink_t), wav_deinit);
+	wav->sink.push = wav_push;
+	wav->sample_rate = sample_rate;
+
+	wav->path = strdup(path);
+	wav->buffer = malloc(WAV_BUFFER_SIZE);
+	if (!wav->path || !wav->buffer) {
+		ERROR_PRINT("Could not allocate the WAV output buffer");
+		goto error;
+	}
+
+	FILE * f = try_fopen(path, "wb");
+	if (!f) {
+		goto error;
+	}
+	setvbuf(f, wav->buffer, _IOFBF, WAV_BUFFER_SIZE);
+	wav->f = f;
+
+	// The sizes in the header are filled in as samples are written
+	if (audiosink_write_wav_header(f, sample_rate, 0)) {
+		ERROR_PRINT("Could not write to %s", path);
+		goto error;
+	}
+
+	return &wav->sink;
+error:
+	rc_release(wav);
+	return NULL;
+}
+
+void
+audiosink_push (audiosink_t * sink, const float * samples, size_t nsamples)
+{
+	sink->push(sink, samples, nsamples);
+}
+
+int
+audiosink_get_stats (audiosink_t * sink, audiosink_stats_t * stats)
+{
+	if (!sink->get_stats) {
+		return -1;
+	}
+	return sink->get_stats(sink, stats);
+}
+
+static inline void
+put_le16 (uint8_t * nonnull dst, uint16_t val)
+{
+	dst[0] = val & 0xFF;
+	dst[1] = val >> 8;
+}
+
+static inline void
+put_le32 (uint8_t * nonnull dst, uint32_t val)
+{
+	put_le16(dst, val & 0xFFFF);
+	put_le16(dst + 2, val >> 16);
+}
+
+int
+audiosink_write_wav_header (FILE * f, uint32_t sample_rate, size_t data_size)
+{
+	uint8_t header[WAV_HEADER_SIZE];
+	memcpy(&header[0], "RIFF", 4);
+	put_le32(&header[WAV_RIFF_SIZE_OFFSET], (uint32_t)(WAV_HEADER_SIZE - 8 + data_size));
+	memcpy(&header[8], "WAVE", 4);
+
+	memcpy(&header[12], "fmt ", 4);
+	put_le32(&header[16], 16);
+	put_le16(&header[20], 3); // IEEE float
+	put_le16(&header[22], 1);
+	put_le32(&header[24], sample_rate);
+	put_le32(&header[28], sample_rate * sizeof(float));
+	put_le16(&header[32], sizeof(float));
+	put_le16(&header[34], 8 * sizeof(float));
+
+	memcpy(&header[36], "data", 4);
+	put_le32(&header[WAV_DATA_SIZE_OFFSET], (uint32_t)data_size);
+
+	if (fseek(f, 0, SEEK_SET) || fwrite(header, sizeof(header), 1, f) != 1) {
+		return -1;
+	}
+	return fseek(f, 0, SEEK_END);
+}
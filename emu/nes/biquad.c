@@ -0,0 +1,125 @@
+#include <base.h>
+#include <nes/biquad.h>
+
+#include <math.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#	include <immintrin.h>
+#endif
+
+_Static_assert(BIQUAD_NSTAGES == 4, "The stages must fill a 4-lane vector");
+
+biquad_coeffs_t
+biquad_highpass1 (double cutoff, double sample_rate)
+{
+	// The bilinear transform of an RC filter, with its corner prewarped
+	double k = tan(M_PI * cutoff / sample_rate);
+	return (biquad_coeffs_t) {
+		.b0 = (float)(1. / (1. + k)),
+		.b1 = (float)(-1. / (1. + k)),
+		.a1 = (float)((k - 1.) / (k + 1.)),
+	};
+}
+
+biquad_coeffs_t
+biquad_lowpass1 (double cutoff, double sample_rate)
+{
+	double k = tan(M_PI * cutoff / sample_rate);
+	return (biquad_coeffs_t) {
+		.b0 = (float)(k / (1. + k)),
+		.b1 = (float)(k / (1. + k)),
+		.a1 = (float)((k - 1.) / (k + 1.)),
+	};
+}
+
+void
+biquad_chain_init (biquad_chain_t * chain, const biquad_coeffs_t * stages, size_t nstages)
+{
+	ASSERT(nstages <= BIQUAD_NSTAGES);
+
+	for (size_t i = 0; i < BIQUAD_NSTAGES; i++) {
+		biquad_coeffs_t c = { .b0 = 1.f };
+		if (i < nstages) {
+			c = stages[i];
+		}
+		chain->b0[i] = c.b0;
+		chain->b1[i] = c.b1;
+		chain->b2[i] = c.b2;
+		chain->a1[i] = c.a1;
+		chain->a2[i] = c.a2;
+	}
+	biquad_chain_reset(chain);
+}
+
+void
+biquad_chain_reset (biquad_chain_t * chain)
+{
+	memset(chain->x1, 0, sizeof(chain->x1));
+	memset(chain->x2, 0, sizeof(chain->x2));
+	memset(chain->y1, 0, sizeof(chain->y1));
+	memset(chain->y2, 0, sizeof(chain->y2));
+}
+
+void
+biquad_chain_process (biquad_chain_t * chain, float * samples, size_t nsamples)
+{
+#if defined(__SSE2__)
+	// The high-pass stages decay towards 0 through silence, and would
+	// otherwise spend most of their time on denormals
+	unsigned int csr = _mm_getcsr();
+	_mm_setcsr(csr | _MM_FLUSH_ZERO_ON | _MM_DENORMALS_ZERO_ON);
+
+	__m128 b0 = _mm_loadu_ps(chain->b0);
+	__m128 b1 = _mm_loadu_ps(chain->b1);
+	__m128 b2 = _mm_loadu_ps(chain->b2);
+	__m128 a1 = _mm_loadu_ps(chain->a1);
+	__m128 a2 = _mm_loadu_ps(chain->a2);
+	__m128 x1 = _mm_loadu_ps(chain->x1);
+	__m128 x2 = _mm_loadu_ps(chain->x2);
+	__m128 y1 = _mm_loadu_ps(chain->y1);
+	__m128 y2 = _mm_loadu_ps(chain->y2);
+
+	for (size_t i = 0; i < nsamples; i++) {
+		// The new sample goes into the first stage, and each stage's last
+		// output into the next
+		__m128 x = _mm_move_ss(_mm_shuffle_ps(y1, y1, _MM_SHUFFLE(2, 1, 0, 0)), _mm_set_ss(samples[i]));
+
+		__m128 y = _mm_add_ps(_mm_mul_ps(b0, x), _mm_mul_ps(b1, x1));
+		y = _mm_add_ps(y, _mm_mul_ps(b2, x2));
+		y = _mm_sub_ps(y, _mm_mul_ps(a1, y1));
+		y = _mm_sub_ps(y, _mm_mul_ps(a2, y2));
+
+		x2 = x1;
+		x1 = x;
+		y2 = y1;
+		y1 = y;
+		samples[i] = _mm_cvtss_f32(_mm_shuffle_ps(y, y, _MM_SHUFFLE(3, 3, 3, 3)));
+	}
+
+	_mm_storeu_ps(chain->x1, x1);
+	_mm_storeu_ps(chain->x2, x2);
+	_mm_storeu_ps(chain->y1, y1);
+	_mm_storeu_ps(chain->y2, y2);
+
+	_mm_setcsr(csr);
+#else
+	for (size_t i = 0; i < nsamples; i++) {
+		float x[BIQUAD_NSTAGES];
+		x[0] = samples[i];
+		for (size_t s = 1; s < BIQUAD_NSTAGES; s++) {
+			x[s] = chain->y1[s - 1];
+		}
+
+		for (size_t s = 0; s < BIQUAD_NSTAGES; s++) {
+			float y = chain->b0[s] * x[s] + chain->b1[s] * chain->x1[s] + chain->b2[s] * chain->x2[s]
+				- chain->a1[s] * chain->y1[s] - chain->a2[s] * chain->y2[s];
+			chain->x2[s] = chain->x1[s];
+			chain->x1[s] = x[s];
+			chain->y2[s] = chain->y1[s];
+			chain->y1[s] = y;
+		}
+		samples[i] = chain->y1[BIQUAD_NSTAGES - 1];
+	}
+#endif
+}
@@ -0,0 +1,189 @@
+#include <base.h>
+#include <nes/blip.h>
+
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+#if defined(__AVX__) || defined(__SSE2__)
+#	include <immintrin.h>
+#endif
+
+#define FRAC_BITS 32
+#define PHASE_SHIFT (FRAC_BITS - 6)
+
+_Static_assert(BLIP_NPHASES == 1 << (FRAC_BITS - PHASE_SHIFT), "PHASE_SHIFT must match BLIP_NPHASES");
+
+// Where the step response's passband ends, as a fraction of the Nyquist
+// frequency
+#define CUTOFF 0.9
+
+// The largest denominator that the ratio between the rates is given with
+#define MAX_DEN (1ULL << 32)
+
+// The samples that a step at `clk` starts at, in 32.32 fixed point
+static inline uint64_t
+clk_pos (const blip_t * nonnull blip, uint64_t clk)
+{
+	return blip->pos_start + (clk - blip->clk_start) * blip->factor;
+}
+
+// Fills in the difference between consecutive samples of a step response for
+// every phase, so that adding up a phase's differences gives exactly 1
+static void
+build_kernels (blip_t * nonnull blip)
+{
+	// The step response, finely sampled at every phase of every sample it
+	// spans
+	enum { NFINE = BLIP_KERNEL_WIDTH * BLIP_NPHASES + 1 };
+	double step[NFINE];
+
+	double sum = 0.;
+	for (size_t j = 0; j < NFINE; j++) {
+		double x = (double)j / BLIP_NPHASES - BLIP_KERNEL_WIDTH / 2;
+		double sinc = x == 0. ? 1. : sin(M_PI * CUTOFF * x) / (M_PI * CUTOFF * x);
+		double w = x / (BLIP_KERNEL_WIDTH / 2);
+		double blackman = 0.42 + 0.5 * cos(M_PI * w) + 0.08 * cos(2. * M_PI * w);
+		sum += sinc * blackman;
+		step[j] = sum;
+	}
+
+	for (size_t p = 0; p < BLIP_NPHASES; p++) {
+		double total = 0.;
+		for (size_t k = 0; k < BLIP_KERNEL_WIDTH; k++) {
+			size_t hi = (k + 1) * BLIP_NPHASES - p;
+			double prev = k * BLIP_NPHASES >= p ? step[k * BLIP_NPHASES - p] : 0.;
+			float d = (float)((step[hi] - prev) / sum);
+			if (k == BLIP_KERNEL_WIDTH - 1) {
+				d = (float)(1. - total);
+			}
+			blip->kernels[p][k] = d;
+			total += d;
+		}
+	}
+}
+
+// Finds the simplest fraction `*num / *den` that is within double precision
+// of `ratio`, from the convergents of its continued fraction
+static void
+rationalize (double ratio, uint64_t * nonnull num, uint64_t * nonnull den)
+{
+	// The last two convergents
+	uint64_t h0 = 0, h1 = 1;
+	uint64_t k0 = 1, k1 = 0;
+
+	double x = ratio;
+	for (;;) {
+		double a = floor(x);
+		uint64_t h2 = (uint64_t)a * h1 + h0;
+		uint64_t k2 = (uint64_t)a * k1 + k0;
+		if (k2 > MAX_DEN) {
+			break;
+		}
+		h0 = h1, h1 = h2;
+		k0 = k1, k1 = k2;
+
+		if (fabs((double)h1 / (double)k1 - ratio) <= ratio * 4 * DBL_EPSILON || x == a) {
+			break;
+		}
+		x = 1. / (x - a);
+	}
+
+	*num = h1;
+	*den = k1;
+}
+
+void
+blip_init (blip_t * blip, double clock_rate, double sample_rate)
+{
+	rationalize(sample_rate / clock_rate, &blip->num, &blip->den);
+	blip->factor = (uint64_t)llround((double)blip->num / (double)blip->den * (double)(1ULL << FRAC_BITS));
+	build_kernels(blip);
+	blip_reset(blip, 0);
+}
+
+void
+blip_reset (blip_t * blip, uint64_t clk)
+{
+	blip->pos_start = 0;
+	blip->clk_start = clk;
+	blip->rem = 0;
+	blip->integrator = 0.;
+	memset(blip->buf, 0, sizeof(blip->buf));
+}
+
+void
+blip_add_delta (blip_t * blip, uint64_t clk, float delta)
+{
+	uint64_t pos = clk_pos(blip, clk);
+	size_t i = (size_t)(pos >> FRAC_BITS);
+	if (i >= BLIP_NSAMPLES) {
+		return;
+	}
+
+	const float * kernel = blip->kernels[(pos >> PHASE_SHIFT) % BLIP_NPHASES];
+	float * out = blip->buf + i;
+
+#if defined(__AVX__)
+	__m256 d = _mm256_set1_ps(delta);
+	for (size_t k = 0; k < BLIP_KERNEL_WIDTH; k += 8) {
+		_mm256_storeu_ps(out + k, _mm256_add_ps(_mm256_loadu_ps(out + k),
+							_mm256_mul_ps(d, _mm256_loadu_ps(kernel + k))));
+	}
+#elif defined(__SSE2__)
+	__m128 d = _mm_set1_ps(delta);
+	for (size_t k = 0; k < BLIP_KERNEL_WIDTH; k += 4) {
+		_mm_storeu_ps(out + k, _mm_add_ps(_mm_loadu_ps(out + k),
+						  _mm_mul_ps(d, _mm_loadu_ps(kernel + k))));
+	}
+#else
+	for (size_t k = 0; k < BLIP_KERNEL_WIDTH; k++) {
+		out[k] += delta * kernel[k];
+	}
+#endif
+}
+
+size_t
+blip_end_block (blip_t * blip, uint64_t clk)
+{
+	// Work out where the block ends exactly, rather than leaving it to the
+	// rounded fixed-point factor
+	uint64_t total = blip->rem + (clk - blip->clk_start) * blip->num;
+	uint64_t whole = (blip->pos_start >> FRAC_BITS) + total / blip->den;
+	blip->rem = total % blip->den;
+	blip->clk_start = clk;
+
+	// If nothing has been read for so long that the buffer is full, the
+	// rest of the block is lost
+	if (whole > BLIP_NSAMPLES) {
+		whole = BLIP_NSAMPLES;
+	}
+	blip->pos_start = (whole << FRAC_BITS) | ((blip->rem << FRAC_BITS) / blip->den);
+
+	return (size_t)(blip->pos_start >> FRAC_BITS);
+}
+
+size_t
+blip_read_samples (blip_t * blip, float * samples, size_t nsamples)
+{
+	size_t navail = (size_t)(blip->pos_start >> FRAC_BITS);
+	if (nsamples > navail) {
+		nsamples = navail;
+	}
+
+	double acc = blip->integrator;
+	for (size_t i = 0; i < nsamples; i++) {
+		acc += blip->buf[i];
+		samples[i] = (float)acc;
+	}
+	blip->integrator = acc;
+
+	// Move the samples that steps are still being added to down to the start
+	// of the buffer
+	size_t nkept = navail - nsamples + BLIP_KERNEL_WIDTH;
+	memmove(blip->buf, blip->buf + nsamples, nkept * sizeof(float));
+	memset(blip->buf + nkept, 0, nsamples * sizeof(float));
+	blip->pos_start -= (uint64_t)nsamples << FRAC_BITS;
+
+	return nsamples;
+}
@@ -0,0 +1,46 @@
+#include <rc.h>
+#include <base.h>
+#include <nes/cnrom.h>
+#include <nes/mapper.h>
+
+// CNROM has NROM's fixed PRGROM, and switches 8K CHRROM banks
+static void
+reset (mapper_t * mapper)
+{
+	mapper_map_prg(mapper, 0, 0);
+	mapper_map_prg(mapper, 1, mapper_prg_nbanks(mapper) - 1);
+	mapper_map_chr(mapper, 0, 0);
+}
+
+// Any write to $8000-$FFFF selects the CHR bank
+static void
+reg_write (mapper_t * mapper, uint16_t addr, uint8_t val)
+{
+	(void)addr;
+	mapper_map_chr(mapper, 0, val);
+}
+
+static const mapper_ops_t ops = {
+	.name = "CNROM",
+	.prg_window_size = 0x4000,
+	.chr_window_size = 0x2000,
+	.reset = reset,
+	.write = reg_write,
+};
+
+int
+cnrom_setup (rominfo_t * info)
+{
+	if (info->prgrom && info->prgrom->size > 0x8000) {
+		ERROR_PRINT("ROM has an invalid PRGROM configuration:");
+		ERROR_PRINT("  CNROM expects up to 32768 bytes of PRGROM, but ROM specifies %zu", info->prgrom->size);
+		return -1;
+	}
+
+	mapper_t * cart = mapper_new(info, &ops, sizeof(mapper_t));
+	if (!cart) {
+		return -1;
+	}
+	rc_release(cart);
+	return 0;
+}
@@ -0,0 +1,374 @@
+#include <rc.h>
+#include <base.h>
+#include <nes/ppu.h>
+#include <nes/ntsc.h>
+#include <nes/keyboard.h>
+#include <nes/framesink.h>
+#include <SDL2/SDL.h>
+
+#include <string.h>
+#include <stdatomic.h>
+
+// The number of frames that pass between the emulation and render threads. The
+// emulation thread draws into one, the render thread displays another, and the
+// third holds the newest frame that the render thread has yet to take.
+#define SDL_NFRAMES 3
+
+// Flags the frame in `sdl_framesink_t.middle` as newer than the one on display
+#define FRAME_FRESH 0x4
+
+// How long the render thread waits for a new frame before showing the last one
+// again (roughly one refresh at 60Hz)
+#define SDL_FRAME_TIMEOUT_MS 17
+
+// A sink that displays frames in an SDL window. All SDL video calls and event
+// polling happen on a dedicated render thread, which frames are passed to
+// through a lock-free triple buffer, so the emulation thread never blocks on
+// the display.
+typedef struct sdl_framesink {
+	framesink_t sink;
+
+	int scale;
+
+	// The filter that frames go through on the render thread, if any
+	ntsc_filter_t * nullable /*strong*/ filter;
+	bool filter_has_palette;
+
+	SDL_Thread * nullable /*owned*/ thread;
+	SDL_sem * nullable /*owned*/ started;
+	SDL_sem * nullable /*owned*/ frame_ready;
+	bool setup_failed;
+	atomic_bool running;
+	atomic_bool quit;
+
+	// Only touched by the render thread, once it's started
+	SDL_Window * nullable /*owned*/ win;
+	SDL_Renderer * nullable /*owned*/ rend;
+	SDL_Texture * nullable /*owned*/ tex;
+
+	// The triple buffer. `back` is only touched by the emulation thread and
+	// `front` only by the render thread; the two swap buffers with `middle`.
+	uint16_t * nullable /*owned*/ frames[SDL_NFRAMES];
+	size_t framenums[SDL_NFRAMES];
+	size_t back;
+	atomic_uint middle;
+	size_t front;
+
+	// Written once by the emulation thread, before the first frame is passed
+	bool have_palette;
+	uint32_t palette_rgba[PPU_NCOLORS + 1];
+
+	atomic_size_t npresented;
+	atomic_size_t ndropped;
+	atomic_size_t nduplicated;
+} sdl_framesink_t;
+
+// A sink that passes frames to a callback
+typedef struct callback_framesink {
+	framesink_t sink;
+
+	framesink_callback_t * nonnull callback;
+	void * nullable /*unowned*/ ctx;
+} callback_framesink_t;
+
+static inline void
+sdl_print_stats (sdl_framesink_t * nonnull sdl)
+{
+	INFO_PRINT("Video: %zu frames presented, %zu dropped, %zu duplicated",
+		   atomic_load(&sdl->npresented),
+		   atomic_load(&sdl->ndropped),
+		   atomic_load(&sdl->nduplicated));
+}
+
+// Passes a finished frame to the render thread, overwriting (and so dropping)
+// any frame it has yet to take. Also exits if the render thread got SDL_QUIT.
+static void
+sdl_present (framesink_t * nonnull sink, const ppu_t * nonnull ppu)
+{
+	sdl_framesink_t * sdl = (sdl_framesink_t *)sink;
+
+	if (atomic_load(&sdl->quit)) {
+		sdl_print_stats(sdl);
+		ppu_print_stats(ppu);
+		INFO_PRINT("Goodbye!");
+		exit(EXIT_SUCCESS);
+	}
+
+	if (!sdl->have_palette) {
+		memcpy(sdl->palette_rgba, ppu->palette_rgba, sizeof(sdl->palette_rgba));
+		sdl->have_palette = true;
+	}
+
+	memcpy((uint16_t * nonnull)sdl->frames[sdl->back], ppu->frame, PPU_OUTPUT_WIDTH * PPU_OUTPUT_HEIGHT * sizeof(uint16_t));
+	sdl->framenums[sdl->back] = ppu->framenum;
+
+	unsigned prev = atomic_exchange(&sdl->middle, (unsigned)sdl->back | FRAME_FRESH);
+	if (prev & FRAME_FRESH) {
+		atomic_fetch_add(&sdl->ndropped, 1);
+	}
+	sdl->back = prev & ~FRAME_FRESH;
+
+	SDL_SemPost((SDL_sem * nonnull)sdl->frame_ready);
+}
+
+// Creates the window, renderer, and texture, on the render thread
+static inline int
+sdl_setup (sdl_framesink_t * nonnull sdl)
+{
+	if (SDL_InitSubSystem(SDL_INIT_VIDEO)) {
+		ERROR_PRINT("Could not init SDL video: %s", SDL_GetError());
+		goto initerror;
+	}
+
+	sdl->win = SDL_CreateWindow(
+		"Hawknest",
+		SDL_WINDOWPOS_CENTERED,
+		SDL_WINDOWPOS_CENTERED,
+		PPU_OUTPUT_WIDTH * sdl->scale,
+		PPU_OUTPUT_HEIGHT * sdl->scale,
+		SDL_WINDOW_ALLOW_HIGHDPI);
+
+	if (!sdl->win) {
+		ERROR_PRINT("Could not create window: %s", SDL_GetError());
+		goto winerror;
+	}
+
+	sdl->rend = SDL_CreateRenderer((SDL_Window * nonnull)sdl->win, -1, SDL_RENDERER_PRESENTVSYNC);
+	if (!sdl->rend) {
+		ERROR_PRINT("Could not create renderer: %s", SDL_GetError());
+		goto renderror;
+	}
+
+	// Make sure the texture stays pixelated if `scale > 1`. Filtered
+	// frames are already smooth, and twice as wide as the window at scale
+	// 1, so they are scaled smoothly instead.
+	SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, sdl->filter ? "linear" : "nearest");
+
+	// Create the texture, setting the access mode to `STREAMING` so that
+	// we can efficiently replace its contents.
+	sdl->tex = SDL_CreateTexture(
+		(SDL_Renderer * nonnull)sdl->rend,
+		SDL_PIXELFORMAT_RGBA32,
+		SDL_TEXTUREACCESS_STREAMING,
+		sdl->filter ? NTSC_OUTPUT_WIDTH : PPU_OUTPUT_WIDTH,
+		PPU_OUTPUT_HEIGHT);
+
+	if (!sdl->tex) {
+		ERROR_PRINT("Could not create texture: %s", SDL_GetError());
+		goto texerror;
+	}
+
+	return 0;
+texerror:
+	SDL_DestroyRenderer((SDL_Renderer * nonnull)sdl->rend);
+renderror:
+	SDL_DestroyWindow((SDL_Window * nonnull)sdl->win);
+winerror:
+	SDL_QuitSubSystem(SDL_INIT_VIDEO);
+initerror:
+	return -1;
+}
+
+// Converts the frame in `frames[front]` into the texture's pixels, and
+// "commits" them to the backing `SDL_Texture` object
+static inline void
+sdl_upload (sdl_framesink_t * nonnull sdl)
+{
+	if (sdl->filter) {
+		ntsc_filter_t * filter = (ntsc_filter_t * nonnull)sdl->filter;
+		if (!sdl->filter_has_palette) {
+			ntsc_filter_set_palette(filter, sdl->palette_rgba);
+			sdl->filter_has_palette = true;
+		}
+
+		const uint32_t * pixels = ntsc_filter_frame(filter, (uint16_t * nonnull)sdl->frames[sdl->front], sdl->framenums[sdl->front]);
+		SDL_UpdateTexture((SDL_Texture * nonnull)sdl->tex, NULL, pixels, NTSC_OUTPUT_WIDTH * sizeof(uint32_t));
+		return;
+	}
+
+	uint8_t * texdata;
+	int pitch;
+	SDL_LockTexture((SDL_Texture * nonnull)sdl->tex, NULL, (void **)&texdata, &pitch);
+	ppu_frame_to_rgba(sdl->palette_rgba, (uint16_t * nonnull)sdl->frames[sdl->front], texdata, (size_t)pitch);
+	SDL_UnlockTexture((SDL_Texture * nonnull)sdl->tex);
+}
+
+// The render thread. Each time around, this displays the newest frame if
+// there is one, or the last one again if none has come in for a while.
+static int
+render_thread (void * nonnull data)
+{
+	sdl_framesink_t * sdl = data;
+
+	if (sdl_setup(sdl)) {
+		sdl->setup_failed = true;
+		SDL_SemPost((SDL_sem * nonnull)sdl->started);
+		return -1;
+	}
+	SDL_SemPost((SDL_sem * nonnull)sdl->started);
+
+	bool have_frame = false;
+	while (atomic_load(&sdl->running)) {
+		int waitres = SDL_SemWaitTimeout((SDL_sem * nonnull)sdl->frame_ready, SDL_FRAME_TIMEOUT_MS);
+
+		// Check if we should quit (e.g. the user clicked the
+		// close-window button). The emulation thread does the actual
+		// quitting when it next presents a frame.
+		SDL_Event event;
+		while (SDL_PollEvent(&event)) {
+			if (event.type == SDL_QUIT) {
+				atomic_store(&sdl->quit, true);
+			}
+		}
+		keyboard_publish();
+
+		if (atomic_load(&sdl->middle) & FRAME_FRESH) {
+			sdl->front = atomic_exchange(&sdl->middle, (unsigned)sdl->front) & ~FRAME_FRESH;
+			sdl_upload(sdl);
+			have_frame = true;
+			atomic_fetch_add(&sdl->npresented, 1);
+		}
+		else if (waitres == SDL_MUTEX_TIMEDOUT && have_frame) {
+			atomic_fetch_add(&sdl->nduplicated, 1);
+		}
+		else {
+			continue;
+		}
+
+		// Copy the frame to the backbuffer, upscaling it if required
+		SDL_RenderCopy((SDL_Renderer * nonnull)sdl->rend, (SDL_Texture * nonnull)sdl->tex, NULL, NULL);
+
+		// Swap buffers to display the frame, synchronously blocking
+		// until a new backbuffer is available
+		SDL_RenderPresent((SDL_Renderer * nonnull)sdl->rend);
+	}
+
+	SDL_DestroyTexture((SDL_Texture * nonnull)sdl->tex);
+	SDL_DestroyRenderer((SDL_Renderer * nonnull)sdl->rend);
+	SDL_DestroyWindow((SDL_Window * nonnull)sdl->win);
+	SDL_QuitSubSystem(SDL_INIT_VIDEO);
+	return 0;
+}
+
+static void
+sdl_deinit (sdl_framesink_t * nonnull sdl)
+{
+	if (sdl->thread) {
+		atomic_store(&sdl->running, false);
+		SDL_SemPost((SDL_sem * nonnull)sdl->frame_ready);
+		SDL_WaitThread(sdl->thread, NULL);
+		sdl_print_stats(sdl);
+	}
+
+	if (sdl->started) {
+		SDL_DestroySemaphore((SDL_sem * nonnull)sdl->started);
+	}
+	if (sdl->frame_ready) {
+		SDL_DestroySemaphore((SDL_sem * nonnull)sdl->frame_ready);
+	}
+	free(sdl->frames[0]);
+	if (sdl->filter) {
+		rc_release(sdl->filter);
+	}
+}
+
+framesink_t *
+framesink_new_sdl (int scale, ntsc_filter_t * filter)
+{
+	sdl_framesink_t * sdl = rc_alloc(sizeof(sdl_framesink_t), sdl_deinit);
+	sdl->sink.present = sdl_present;
+	sdl->scale = scale;
+	if (filter) {
+		sdl->filter = rc_retain(filter);
+	}
+
+	size_t frame_npixels = PPU_OUTPUT_WIDTH * PPU_OUTPUT_HEIGHT;
+	uint16_t * frames = calloc(SDL_NFRAMES * frame_npixels, sizeof(uint16_t));
+	if (!frames) {
+		ERROR_PRINT("Could not allocate frames for the render thread");
+		goto error;
+	}
+	for (size_t i = 0; i < SDL_NFRAMES; i++) {
+		sdl->frames[i] = frames + i * frame_npixels;
+	}
+	sdl->back = 0;
+	atomic_init(&sdl->middle, 1);
+	sdl->front = 2;
+
+	sdl->started = SDL_CreateSemaphore(0);
+	sdl->frame_ready = SDL_CreateSemaphore(0);
+	if (!sdl->started || !sdl->frame_ready) {
+		ERROR_PRINT("Could not create semaphores: %s", SDL_GetError());
+		goto error;
+	}
+
+	atomic_init(&sdl->running, true);
+	atomic_init(&sdl->quit, false);
+	atomic_init(&sdl->npresented, 0);
+	atomic_init(&sdl->ndropped, 0);
+	atomic_init(&sdl->nduplicated, 0);
+
+	SDL_Thread * thread = SDL_CreateThread(render_thread, "render", sdl);
+	if (!thread) {
+		ERROR_PRINT("Could not create render thread: %s", SDL_GetError());
+		goto error;
+	}
+
+	// Wait for the render thread to set up the window, so that failing to
+	// do so can be reported here
+	SDL_SemWait((SDL_sem * nonnull)sdl->started);
+	if (sdl->setup_failed) {
+		SDL_WaitThread(thread, NULL);
+		goto error;
+	}
+	sdl->thread = thread;
+
+	return &sdl->sink;
+error:
+	rc_release(sdl);
+	return NULL;
+}
+
+static void
+null_present (framesink_t * nonnull sink, const ppu_t * nonnull ppu)
+{
+}
+
+framesink_t *
+framesink_new_null (void)
+{
+	framesink_t * sink = rc_alloc(sizeof(framesink_t), NULL);
+	sink->present = null_present;
+	return sink;
+}
+
+static void
+callback_present (framesink_t * nonnull sink, const ppu_t * nonnull ppu)
+{
+	callback_framesink_t * cb = (callback_framesink_t *)sink;
+	cb->callback(cb->ctx, ppu);
+}
+
+framesink_t *
+framesink_new_callback (framesink_callback_t * callback, void * ctx)
+{
+	callback_framesink_t * cb = rc_alloc(sizeof(callback_framesink_t), NULL);
+	cb->sink.present = callback_present;
+	cb->callback = callback;
+	cb->ctx = ctx;
+	return &cb->sink;
+}
+
+void
+framesink_present (framesink_t * sink, const ppu_t * ppu)
+{
+	sink->present(sink, ppu);
+}
+
+void
+framesink_skip (framesink_t * sink, const ppu_t * ppu)
+{
+	if (sink->skip) {
+		sink->skip(sink, ppu);
+	}
+}
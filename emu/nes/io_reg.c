@@ -1,6 +1,7 @@
 #include <rc.h>
 #include <fileio.h>
 #include <nes/io_reg.h>
+#include <nes/keyboard.h>
 
 #include <errno.h>
 
@@ -13,12 +14,10 @@ set_strobe (io_reg_t * io, bool val)
 		// Sync up with real time.
 		timekeeper_sync(io->cpu->tk);
 
-		// Make sure SDL updates the keyboard state array before we
-		// read from it.
-		SDL_PumpEvents();
-
-		// Update the shift registers according to the current key-press state.
-		const uint8_t * kbstate = SDL_GetKeyboardState(NULL);
+		// Update the shift registers according to the key-press state
+		// that the render thread last saw.
+		uint8_t kbstate[SDL_NUM_SCANCODES];
+		keyboard_snapshot(kbstate);
 		for (size_t j = 0; j < 2; j++) {
 			for (size_t i = 0; i < CONTROLLER_NBUTTONS; i++) {
 				io->controller_shiftregs[j] |= (uint8_t)(kbstate[io->controller_mappings[i][j]] << i);
@@ -42,8 +41,8 @@ io_reg_mem_read (io_reg_t * io, uint16_t addr, uint8_t * lanemask)
 		// A-button state.
 		if (io->controller_strobe) {
 			timekeeper_sync(io->cpu->tk);
-			SDL_PumpEvents();
-			const uint8_t * kbstate = SDL_GetKeyboardState(NULL);
+			uint8_t kbstate[SDL_NUM_SCANCODES];
+			keyboard_snapshot(kbstate);
 			bit = kbstate[io->controller_mappings[addr - 0x16][CONTROLLER_BUTTON_A]];
 		}
 		else {
@@ -0,0 +1,41 @@
+#include <base.h>
+#include <nes/keyboard.h>
+
+#include <stdatomic.h>
+
+// The published state, guarded by a sequence lock: the count is odd while the
+// render thread is writing, and readers retry if it changed while they read
+static atomic_uint seq;
+static _Atomic uint8_t keys[SDL_NUM_SCANCODES];
+
+void
+keyboard_publish (void)
+{
+	int nkeys;
+	const uint8_t * kbstate = SDL_GetKeyboardState(&nkeys);
+	if (nkeys > SDL_NUM_SCANCODES) {
+		nkeys = SDL_NUM_SCANCODES;
+	}
+
+	unsigned s = atomic_load_explicit(&seq, memory_order_relaxed);
+	atomic_store_explicit(&seq, s + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	for (int i = 0; i < nkeys; i++) {
+		atomic_store_explicit(&keys[i], kbstate[i], memory_order_relaxed);
+	}
+	atomic_store_explicit(&seq, s + 2, memory_order_release);
+}
+
+void
+keyboard_snapshot (uint8_t state[SDL_NUM_SCANCODES])
+{
+	unsigned before, after;
+	do {
+		before = atomic_load_explicit(&seq, memory_order_acquire);
+		for (size_t i = 0; i < SDL_NUM_SCANCODES; i++) {
+			state[i] = atomic_load_explicit(&keys[i], memory_order_relaxed);
+		}
+		atomic_thread_fence(memory_order_acquire);
+		after = atomic_load_explicit(&seq, memory_order_relaxed);
+	} while (before != after || (before & 1));
+}
@@ -0,0 +1,223 @@
+#include <rc.h>
+#include <base.h>
+#include <memory.h>
+#include <nes/mapper.h>
+
+#include <stdint.h>
+#include <string.h>
+
+// Handles a CPU write to $8000-$FFFF
+static void
+reg_write (mapper_t * mapper, size_t addr, uint8_t val)
+{
+	// Whatever the mapper does may switch banks or mirroring out from
+	// under the PPU
+	ppu_sync(mapper->ppu);
+	mapper->ops->write(mapper, (uint16_t)addr, val);
+}
+
+static void
+a12_rise (mapper_t * mapper)
+{
+	mapper->ops->a12_rise(mapper);
+}
+
+static void
+reset (mapper_t * mapper)
+{
+	for (size_t i = 0; i < MAPPER_MAX_PRG_WINDOWS; i++) {
+		mapper->prg_offsets[i] = SIZE_MAX;
+	}
+	for (size_t i = 0; i < MAPPER_MAX_CHR_WINDOWS; i++) {
+		mapper->chr_offsets[i] = SIZE_MAX;
+	}
+	mapper->mirroring = -1;
+
+	mapper_set_mirroring(mapper, mapper->default_mirroring);
+	size_t wram_size = mapper_wram_size(mapper);
+	for (size_t base = 0x6000; wram_size && base < 0x8000; base += wram_size) {
+		size_t addr = base;
+		if (mapper->wram) {
+			memory_t * wram = (memory_t * nonnull)mapper->wram;
+			memory_map(wram, mapper->cpu->bus, (uint16_t)addr, (uint16_t)wram->size, 0x0000);
+			addr += wram->size;
+		}
+		if (mapper->sram) {
+			memory_t * sram = (memory_t * nonnull)mapper->sram;
+			memory_map(sram, mapper->cpu->bus, (uint16_t)addr, (uint16_t)sram->size, 0x0000);
+		}
+	}
+
+	mapper->ops->reset(mapper);
+}
+
+static void
+deinit (mapper_t * mapper)
+{
+	rc_release(mapper->prgrom);
+	rc_release(mapper->chr);
+	rc_release(mapper->vram);
+
+	if (mapper->wram) {
+		rc_release((memory_t * nonnull)mapper->wram);
+	}
+	if (mapper->sram) {
+		rc_release((memory_t * nonnull)mapper->sram);
+	}
+}
+
+mapper_t *
+mapper_new (rominfo_t * info, const mapper_ops_t * ops, size_t size)
+{
+	ASSERT(0x8000 / ops->prg_window_size <= MAPPER_MAX_PRG_WINDOWS);
+	ASSERT(0x2000 / ops->chr_window_size <= MAPPER_MAX_CHR_WINDOWS);
+
+	size_t wram_size = info->wram ? info->wram->size : 0;
+	size_t sram_size = info->sram ? info->sram->size : 0;
+	if (wram_size + sram_size > 0x2000 ||
+	    (wram_size + sram_size && 0x2000 % (wram_size + sram_size)) ||
+	    wram_size % MEMBUS_PAGESIZE || sram_size % MEMBUS_PAGESIZE) {
+		ERROR_PRINT("ROM has an invalid WRAM configuration:");
+		ERROR_PRINT("  %s expects up to 8192 bytes of WRAM in whole pages, but ROM specifies %zu volatile and %zu battery-backed",
+			    ops->name, wram_size, sram_size);
+		return NULL;
+	}
+
+	if (!info->prgrom || info->prgrom->size % ops->prg_window_size) {
+		ERROR_PRINT("ROM has an invalid PRGROM configuration:");
+		if (info->prgrom) {
+			ERROR_PRINT("  ROM's PRGROM size (%zu) is not a multiple of %u", info->prgrom->size, ops->prg_window_size);
+		}
+		else {
+			ERROR_PRINT("  ROM is missing PRGROM");
+		}
+		return NULL;
+	}
+
+	memory_t * chr = info->chrom ? info->chrom : info->chram;
+	if (!chr || (info->chrom && info->chram) || chr->size % ops->chr_window_size) {
+		ERROR_PRINT("ROM has an invalid CHR configuration:");
+		if (!chr) {
+			ERROR_PRINT("  ROM has neither CHRROM nor CHRRAM");
+		}
+		else if (info->chrom && info->chram) {
+			ERROR_PRINT("  ROM has both CHRROM and CHRRAM");
+		}
+		else {
+			ERROR_PRINT("  ROM's CHR size (%zu) is not a multiple of %u", chr->size, ops->chr_window_size);
+		}
+		return NULL;
+	}
+
+	if (!info->vram || info->vram->size != 0x0800) {
+		ERROR_PRINT("ROM has an invalid VRAM configuration");
+		return NULL;
+	}
+
+	mapper_t * mapper = rc_alloc(size, deinit);
+	mapper->ops    = ops;
+	mapper->cpu    = info->cpu;
+	mapper->ppu    = info->ppu;
+	mapper->prgrom = rc_retain((memory_t * nonnull)info->prgrom);
+	mapper->chr    = rc_retain((memory_t * nonnull)chr);
+	mapper->vram   = rc_retain((memory_t * nonnull)info->vram);
+	if (info->wram) {
+		mapper->wram = rc_retain((memory_t * nonnull)info->wram);
+	}
+	if (info->sram) {
+		mapper->sram = rc_retain((memory_t * nonnull)info->sram);
+	}
+
+	mapper->default_mirroring = info->mirroring == INES_MIRRORING_VERTICAL ?
+				    MAPPER_MIRRORING_VERTICAL : MAPPER_MIRRORING_HORIZONTAL;
+
+	reset_manager_add_device(info->rm, mapper, reset);
+	if (ops->write) {
+		for (size_t pagenum = 0x80; pagenum < 0x100; pagenum++) {
+			membus_set_write_handler(info->cpu->bus, pagenum, mapper, pagenum * MEMBUS_PAGESIZE, reg_write);
+		}
+	}
+	if (ops->a12_rise) {
+		ppu_set_a12_handler(info->ppu, mapper, a12_rise);
+	}
+
+	// The CPU is reset before the mapper is, so the banks have to be in
+	// place for it to find its reset vector
+	reset(mapper);
+
+	return mapper;
+}
+
+size_t
+mapper_wram_size (const mapper_t * mapper)
+{
+	size_t size = 0;
+	if (mapper->wram) {
+		size += ((memory_t * nonnull)mapper->wram)->size;
+	}
+	if (mapper->sram) {
+		size += ((memory_t * nonnull)mapper->sram)->size;
+	}
+	return size;
+}
+
+size_t
+mapper_prg_nbanks (const mapper_t * mapper)
+{
+	return mapper->prgrom->size / mapper->ops->prg_window_size;
+}
+
+size_t
+mapper_chr_nbanks (const mapper_t * mapper)
+{
+	return mapper->chr->size / mapper->ops->chr_window_size;
+}
+
+void
+mapper_map_prg (mapper_t * mapper, size_t window, size_t bank)
+{
+	uint16_t size = mapper->ops->prg_window_size;
+	size_t offset = bank % mapper_prg_nbanks(mapper) * size;
+	if (mapper->prg_offsets[window] == offset) {
+		return;
+	}
+	mapper->prg_offsets[window] = offset;
+
+	memory_map(mapper->prgrom, mapper->cpu->bus, (uint16_t)(0x8000 + window * size), size, offset);
+}
+
+void
+mapper_map_chr (mapper_t * mapper, size_t window, size_t bank)
+{
+	uint16_t size = mapper->ops->chr_window_size;
+	size_t offset = bank % mapper_chr_nbanks(mapper) * size;
+	if (mapper->chr_offsets[window] == offset) {
+		return;
+	}
+	mapper->chr_offsets[window] = offset;
+
+	uint16_t addr = (uint16_t)(window * size);
+	memory_map(mapper->chr, mapper->ppu->bus, addr, size, offset);
+	ppu_chr_rebuild(mapper->ppu, addr, size);
+}
+
+void
+mapper_set_mirroring (mapper_t * mapper, mapper_mirroring_t mirroring)
+{
+	if (mapper->mirroring == (int)mirroring) {
+		return;
+	}
+	mapper->mirroring = (int)mirroring;
+
+	// The VRAM offset of the nametable in each of the four slots
+	static const uint16_t layouts[4][4] = {
+		[MAPPER_MIRRORING_HORIZONTAL]      = {0x0000, 0x0000, 0x0400, 0x0400},
+		[MAPPER_MIRRORING_VERTICAL]        = {0x0000, 0x0400, 0x0000, 0x0400},
+		[MAPPER_MIRRORING_ONE_SCREEN_LOW]  = {0x0000, 0x0000, 0x0000, 0x0000},
+		[MAPPER_MIRRORING_ONE_SCREEN_HIGH] = {0x0400, 0x0400, 0x0400, 0x0400},
+	};
+	for (size_t slot = 0; slot < 4; slot++) {
+		memory_map(mapper->vram, mapper->ppu->bus, (uint16_t)(0x2000 + slot * 0x0400), 0x0400, layouts[mirroring][slot]);
+	}
+	ppu_remap_windows(mapper->ppu, 0x2000, 0x1000);
+}
@@ -25,38 +25,6 @@ mmc1_reset (mmc1_t * mmc1)
 	mmc1->last_cpu_cyclenum = UINT64_MAX;
 }
 
-void
-mmc1_map_vram (mmc1_t * mmc1, membus_t * bus, memory_t * vram)
-{
-	switch (mmc1->reg0.mirroring) {
-	case MMC1_MIRRORING_ONE_SCREEN_NT0:
-		memory_map(vram, bus, 0x2000, 0x0400, 0x0000);
-		memory_map(vram, bus, 0x2400, 0x0400, 0x0000);
-		memory_map(vram, bus, 0x2800, 0x0400, 0x0000);
-		memory_map(vram, bus, 0x2C00, 0x0400, 0x0000);
-		break;
-	case MMC1_MIRRORING_ONE_SCREEN_NT1:
-		memory_map(vram, bus, 0x2000, 0x0400, 0x0400);
-		memory_map(vram, bus, 0x2400, 0x0400, 0x0400);
-		memory_map(vram, bus, 0x2800, 0x0400, 0x0400);
-		memory_map(vram, bus, 0x2C00, 0x0400, 0x0400);
-		break;
-	case MMC1_MIRRORING_VERTICAL:
-		memory_map(vram, bus, 0x2000, 0x0400, 0x0000);
-		memory_map(vram, bus, 0x2400, 0x0400, 0x0400);
-		memory_map(vram, bus, 0x2800, 0x0400, 0x0000);
-		memory_map(vram, bus, 0x2C00, 0x0400, 0x0400);
-		break;
-	case MMC1_MIRRORING_HORIZONTAL:
-		memory_map(vram, bus, 0x2000, 0x0400, 0x0000);
-		memory_map(vram, bus, 0x2400, 0x0400, 0x0000);
-		memory_map(vram, bus, 0x2800, 0x0400, 0x0400);
-		memory_map(vram, bus, 0x2C00, 0x0400, 0x0400);
-		break;
-	}
-}
-
-
 /*
  * Shift reg initial state: Bit 5 is set as a sentinal
  * 1 0 0 0 0 0
@@ -0,0 +1,187 @@
+#include <rc.h>
+#include <base.h>
+#include <nes/mmc3.h>
+#include <nes/mapper.h>
+#include <timekeeper.h>
+#include <mos6502/mos6502.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+// The countdown of the IRQ timer while it's disarmed
+#define DISARMED UINT64_MAX
+
+typedef struct mmc3 {
+	mapper_t mapper;
+
+	// $8000: which of `regs` the next $8001 write goes to (bits 0-2), and
+	// the PRG (bit 6) and CHR (bit 7) bank modes
+	uint8_t bank_select;
+	// R0-R5 are CHR banks in 1K units (R0 and R1 select 2K banks, ignoring
+	// bit 0), and R6-R7 are PRG banks in 8K units
+	uint8_t regs[8];
+
+	// The scanline counter
+	uint8_t irq_latch;
+	uint8_t irq_counter;
+	bool irq_reload;
+	bool irq_enabled;
+	bool irq_pending;
+
+	// Counts down to the next poll of the IRQ line, while it's asserted
+	uint64_t irq_countdown;
+} mmc3_t;
+
+// Remaps PRGROM and CHR from the bank registers
+static void
+remap (mmc3_t * cart)
+{
+	mapper_t * mapper = &cart->mapper;
+	size_t second_last = mapper_prg_nbanks(mapper) - 2;
+
+	// PRG mode 1 swaps $8000 and $C000
+	size_t swap = (cart->bank_select & 0x40) ? 2 : 0;
+	mapper_map_prg(mapper, 0 ^ swap, cart->regs[6]);
+	mapper_map_prg(mapper, 1, cart->regs[7]);
+	mapper_map_prg(mapper, 2 ^ swap, second_last);
+	mapper_map_prg(mapper, 3, second_last + 1);
+
+	// CHR mode 1 swaps the pattern tables, putting the 2K banks at $1000
+	size_t flip = (cart->bank_select & 0x80) ? 4 : 0;
+	mapper_map_chr(mapper, 0 ^ flip, cart->regs[0] & ~1);
+	mapper_map_chr(mapper, 1 ^ flip, cart->regs[0] | 1);
+	mapper_map_chr(mapper, 2 ^ flip, cart->regs[1] & ~1);
+	mapper_map_chr(mapper, 3 ^ flip, cart->regs[1] | 1);
+	for (size_t i = 0; i < 4; i++) {
+		mapper_map_chr(mapper, (4 + i) ^ flip, cart->regs[2 + i]);
+	}
+}
+
+static void
+reset (mapper_t * mapper)
+{
+	mmc3_t * cart = (mmc3_t *)mapper;
+
+	static const uint8_t initial_regs[8] = {0, 2, 4, 5, 6, 7, 0, 1};
+	cart->bank_select = 0;
+	memcpy(cart->regs, initial_regs, sizeof(cart->regs));
+
+	cart->irq_latch = 0;
+	cart->irq_counter = 0;
+	cart->irq_reload = false;
+	cart->irq_enabled = false;
+	cart->irq_pending = false;
+	cart->irq_countdown = DISARMED;
+
+	remap(cart);
+}
+
+// Holds the IRQ line asserted for as long as an IRQ is pending, by raising an
+// IRQ whenever the CPU would take one. Like the APU's IRQ timer, this polls
+// every other cycle, since the CPU can't change its interrupt disable flag any
+// more often than that.
+static void
+irq_tick (mmc3_t * cart)
+{
+	if (!cart->irq_pending) {
+		cart->irq_countdown = DISARMED;
+		return;
+	}
+
+	cart->irq_countdown = 2 * MOS6502_CLKDIVISOR;
+	if (!cart->mapper.cpu->p.i) {
+		mos6502_raise_irq(cart->mapper.cpu);
+	}
+}
+
+// Each 8K region of $8000-$FFFF has a pair of registers, told apart by bit 0
+// of the address
+static void
+reg_write (mapper_t * mapper, uint16_t addr, uint8_t val)
+{
+	mmc3_t * cart = (mmc3_t *)mapper;
+
+	switch (addr & 0xE001) {
+	case 0x8000:
+		cart->bank_select = val;
+		remap(cart);
+		break;
+	case 0x8001:
+		cart->regs[cart->bank_select & 0x07] = val;
+		remap(cart);
+		break;
+	case 0xA000:
+		mapper_set_mirroring(mapper, (val & 0x01) ? MAPPER_MIRRORING_HORIZONTAL : MAPPER_MIRRORING_VERTICAL);
+		break;
+	case 0xA001:
+		// The WRAM enable and write protect bits are ignored, since
+		// MMC6 boards share mapper #4 and use them differently
+		break;
+	case 0xC000:
+		cart->irq_latch = val;
+		break;
+	case 0xC001:
+		cart->irq_counter = 0;
+		cart->irq_reload = true;
+		break;
+	case 0xE000:
+		cart->irq_enabled = false;
+		cart->irq_pending = false;
+		cart->irq_countdown = DISARMED;
+		break;
+	case 0xE001:
+		cart->irq_enabled = true;
+		break;
+	}
+}
+
+// The scanline counter is clocked by each rise of A12, which happens once per
+// rendered scanline when the background and sprites use different pattern
+// tables. Reaching 0 asserts the IRQ line, which stays asserted until the IRQ is
+// acknowledged by a write to $E000.
+static void
+a12_rise (mapper_t * mapper)
+{
+	mmc3_t * cart = (mmc3_t *)mapper;
+
+	if (cart->irq_counter == 0 || cart->irq_reload) {
+		cart->irq_counter = cart->irq_latch;
+		cart->irq_reload = false;
+	}
+	else {
+		cart->irq_counter--;
+	}
+
+	if (cart->irq_counter == 0 && cart->irq_enabled && !cart->irq_pending) {
+		cart->irq_pending = true;
+		irq_tick(cart);
+	}
+}
+
+static const mapper_ops_t ops = {
+	.name = "MMC3",
+	.prg_window_size = 0x2000,
+	.chr_window_size = 0x0400,
+	.reset = reset,
+	.write = reg_write,
+	.a12_rise = a12_rise,
+};
+
+int
+mmc3_setup (rominfo_t * info)
+{
+	if (info->prgrom && info->prgrom->size < 0x4000) {
+		ERROR_PRINT("ROM has an invalid PRGROM configuration:");
+		ERROR_PRINT("  MMC3 expects at least 16384 bytes of PRGROM, but ROM specifies %zu", info->prgrom->size);
+		return -1;
+	}
+
+	mapper_t * cart = mapper_new(info, &ops, sizeof(mmc3_t));
+	if (!cart) {
+		return -1;
+	}
+	timekeeper_add_timer(info->cpu->tk, cart, irq_tick, &((mmc3_t *)cart)->irq_countdown);
+	rc_release(cart);
+	return 0;
+}
@@ -1,12 +1,27 @@
 EMU_SRC += nes/io_reg.c \
+	   nes/keyboard.c \
+	   nes/mapper.c \
 	   nes/nrom.c \
 	   nes/sxrom.c \
 	   nes/mmc1.c \
+	   nes/uxrom.c \
+	   nes/cnrom.c \
+	   nes/mmc3.c \
 	   nes/ppu.c \
+	   nes/framesink.c \
+	   nes/ntsc.c \
+	   nes/recorder.c \
+	   nes/shmsink.c \
+	   nes/blip.c \
+	   nes/biquad.c \
+	   nes/audioring.c \
+	   nes/audiosink.c \
 	   nes/apu_envelope.c \
 	   nes/apu_pulse.c \
 	   nes/apu_triangle.c \
 	   nes/apu_noise.c \
 	   nes/apu_dmc.c \
+	   nes/apu_state.c \
+	   nes/apu_synth.c \
 	   nes/apu.c \
 	   nes/pageforty.c
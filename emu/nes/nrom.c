@@ -1,92 +1,38 @@
+#include <rc.h>
 #include <base.h>
 #include <nes/nrom.h>
+#include <nes/mapper.h>
 
-int
-nrom_setup (rominfo_t * info)
+// NROM has no registers: a 16K PRGROM is mirrored into both halves of
+// $8000-$FFFF, and 8K of CHR is mapped in whole
+static void
+reset (mapper_t * mapper)
 {
-	if (info->wram && info->wram->size > 0x2000) {
-		ERROR_PRINT("ROM has invalid WRAM configuration");
-		return -1;
-	}
-
-	if (!info->prgrom || info->prgrom->size > 0x8000) {
-		ERROR_PRINT("ROM has invalid PRGROM configuration");
-		return -1;
-	}
+	mapper_map_prg(mapper, 0, 0);
+	mapper_map_prg(mapper, 1, mapper_prg_nbanks(mapper) - 1);
+	mapper_map_chr(mapper, 0, 0);
+}
 
-	if (!info->chrom || info->chrom->size != 0x2000) {
-		ERROR_PRINT("ROM has invalid CHROM configuration");
-		return -1;
-	}
+static const mapper_ops_t ops = {
+	.name = "NROM",
+	.prg_window_size = 0x4000,
+	.chr_window_size = 0x2000,
+	.reset = reset,
+};
 
-	if (!info->vram || info->vram->size != 0x0800) {
-		ERROR_PRINT("ROM has invalid VRAM configuration");
+int
+nrom_setup (rominfo_t * info)
+{
+	if (info->prgrom && info->prgrom->size > 0x8000) {
+		ERROR_PRINT("ROM has an invalid PRGROM configuration:");
+		ERROR_PRINT("  NROM expects up to 32768 bytes of PRGROM, but ROM specifies %zu", info->prgrom->size);
 		return -1;
 	}
 
-	if (info->chram) {
-		ERROR_PRINT("ROM has invalid CHRAM configuration");
+	mapper_t * cart = mapper_new(info, &ops, sizeof(mapper_t));
+	if (!cart) {
 		return -1;
 	}
-
-	if (info->wram) {
-		memory_map_mirroring((memory_t * nonnull)info->wram,
-				     info->cpu->bus,
-				     0x6000,
-				     (uint16_t)info->wram->size,
-				     0x0000, 0x2000 / info->wram->size);
-	}
-	memory_map_mirroring((memory_t * nonnull)info->prgrom,
-			     info->cpu->bus,
-			     0x8000,
-			     (uint16_t)info->prgrom->size,
-			     0x0000,
-			     0x8000 / info->prgrom->size);
-
-	memory_map((memory_t * nonnull)info->chrom, info->ppu->bus, 0x0000, (uint16_t)info->chrom->size, 0x0000);
-
-	switch (info->mirroring) {
-	case INES_MIRRORING_HORIZONTAL:
-		memory_map_mirroring((memory_t * nonnull)info->vram,
-				     info->ppu->bus,
-				     0x2000,
-				     (uint16_t)info->vram->size/2,
-				     0,
-				     2);
-
-		memory_map_mirroring((memory_t * nonnull)info->vram,
-				     info->ppu->bus,
-				     0x2800,
-				     (uint16_t)info->vram->size/2,
-				     info->vram->size/2,
-				     2);
-		break;
-	case INES_MIRRORING_VERTICAL:
-		memory_map((memory_t * nonnull)info->vram,
-			   info->ppu->bus,
-			   0x2000,
-			   (uint16_t)info->vram->size/2,
-			   0);
-
-		memory_map((memory_t * nonnull)info->vram,
-			   info->ppu->bus,
-			   0x2400,
-			   (uint16_t)info->vram->size/2,
-			   info->vram->size/2);
-
-		memory_map((memory_t * nonnull)info->vram,
-			   info->ppu->bus,
-			   0x2800,
-			   (uint16_t)info->vram->size/2,
-			   0);
-
-		memory_map((memory_t * nonnull)info->vram,
-			   info->ppu->bus,
-			   0x2C00,
-			   (uint16_t)info->vram->size/2,
-			   info->vram->size/2);
-		break;
-	}
-
+	rc_release(cart);
 	return 0;
 }
@@ -0,0 +1,423 @@
+#include <rc.h>
+#include <base.h>
+#include <nes/ppu.h>
+#include <nes/ntsc.h>
+
+#include <SDL2/SDL.h>
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#if defined(__AVX__) || defined(__SSE2__)
+#	include <immintrin.h>
+#endif
+
+// The video signal has eight samples per pixel, and twelve per cycle of the
+// color subcarrier
+#define SAMPLES_PER_PIXEL 8
+#define SAMPLES_PER_CYCLE 12
+
+// The subcarrier phases that a pixel can start at (0, 4, or 8 samples into a
+// cycle). Each pixel starts two phases after the last, each scanline one phase
+// after the last, and each frame alternates between starting at phase 0 and 1.
+#define NPHASES 3
+
+// The output pixels that each input pixel contributes to: its own two, and
+// `KERNEL_FIRST` and `KERNEL_SIZE - KERNEL_FIRST - 2` either side of them. This
+// reaches as far as the widest decoding window, and keeps pairs of output
+// pixels aligned.
+#define KERNEL_FIRST 4
+#define KERNEL_SIZE 10
+
+// How many samples either side of an output pixel's center chroma is decoded
+// from. Two whole subcarrier cycles cancel out flat luma exactly.
+#define CHROMA_RADIUS 12.0f
+
+// How many samples either side of an output pixel's center luma is decoded
+// from, at sharpness 0 and 1. A whole subcarrier cycle cancels out flat chroma
+// exactly.
+#define LUMA_RADIUS_SOFT 12.0f
+#define LUMA_RADIUS_SHARP 4.0f
+
+// How much an active emphasis bit attenuates the signal
+#define EMPHASIS_ATTENUATION 0.746f
+
+// Turns the decoded chroma so that hues line up with the usual NES palettes,
+// in samples
+#define HUE_OFFSET 4.0f
+
+// Signal levels for the low and high halves of the square wave at each of the
+// four brightness levels, with black at 0 and white at 1
+static const float signal_low[4] = {-0.117f, 0.000f, 0.308f, 0.715f};
+static const float signal_high[4] = {0.397f, 0.681f, 1.000f, 1.000f};
+
+struct ntsc_filter {
+	// How each color contributes to the output pixels around it, in RGBA
+	// (alpha unused), for a pixel starting at each phase. This includes
+	// `deltas`.
+	float (* nullable /*owned*/ kernels)[PPU_NCOLORS + 1][KERNEL_SIZE][4];
+
+	// What has been added to each color's contribution to its own two
+	// output pixels, to make flat areas come out in the palette's colors
+	float deltas[PPU_NCOLORS + 1][4];
+
+	// The last rows filtered for each field (even and odd frames, which
+	// start at different phases), and which of them are valid
+	uint16_t rows[2][NTSC_OUTPUT_HEIGHT][PPU_OUTPUT_WIDTH];
+	bool valid[2][NTSC_OUTPUT_HEIGHT];
+	uint32_t output[2][NTSC_OUTPUT_HEIGHT][NTSC_OUTPUT_WIDTH];
+
+	// The frame being filtered, and its field. The rows are split into
+	// `nbands` bands, of which the first `ntaken` have been taken by the
+	// caller or a worker. `work` is posted once for each worker when a frame
+	// comes in, and `done` once a worker has filtered a band.
+	const uint16_t * nullable /*unowned*/ frame;
+	size_t field;
+	size_t nbands;
+	atomic_size_t ntaken;
+	SDL_sem * nullable work;
+	SDL_sem * nullable done;
+
+	atomic_bool quit;
+	size_t nthreads;
+	SDL_Thread * nullable threads[];
+};
+
+// The level of the signal for `color` (laid out like a `ppu_pixel_t`) at
+// `phase`
+static float
+signal_level (unsigned color, unsigned phase)
+{
+	unsigned hue = color & 0x0F;
+	unsigned level = hue > 0x0D ? 1 : (color >> 4) & 0x03;
+
+	float low = signal_low[level];
+	float high = signal_high[level];
+	if (hue == 0x00) {
+		low = high;
+	}
+	else if (hue > 0x0C) {
+		high = low;
+	}
+
+	// A hue is at its high level for half of each cycle, starting at a
+	// phase of its own
+#define IN_PHASE(h) (((h) + phase) % SAMPLES_PER_CYCLE < SAMPLES_PER_CYCLE / 2)
+	float signal = IN_PHASE(hue) ? high : low;
+
+	if (hue < 0x0E && (((color & 0x040) && IN_PHASE(0x0C)) ||
+			   ((color & 0x080) && IN_PHASE(0x04)) ||
+			   ((color & 0x100) && IN_PHASE(0x08)))) {
+		signal *= EMPHASIS_ATTENUATION;
+	}
+#undef IN_PHASE
+
+	return signal;
+}
+
+// The weight of a sample `offset` samples from the center of a decoding window
+// `radius` samples either side (a raised cosine)
+static inline float
+window_weight (float offset, float radius)
+{
+	if (fabsf(offset) >= radius) {
+		return 0.0f;
+	}
+	return 0.5f + 0.5f * cosf((float)M_PI * offset / radius);
+}
+
+// The sum of a decoding window's weights, for a window centered between two
+// samples (as output pixels are)
+static float
+window_total (float radius)
+{
+	float total = 0.0f;
+	for (int i = -(int)radius - 1; i <= (int)radius; i++) {
+		total += window_weight((float)i + 0.5f, radius);
+	}
+	return total;
+}
+
+// Computes the kernel for `color` starting at `phase` into `kernel`, straight
+// from the signal model
+static void
+build_kernel (const ntsc_options_t * nonnull opts, unsigned color, size_t phase, float (* nonnull kernel)[4])
+{
+	float luma_radius = LUMA_RADIUS_SOFT + (LUMA_RADIUS_SHARP - LUMA_RADIUS_SOFT) * opts->sharpness;
+	float luma_total = window_total(luma_radius);
+	float chroma_total = window_total(CHROMA_RADIUS);
+
+	// Split the signal into luma (its average over a cycle) and chroma (the
+	// rest). With artifacts, each is decoded with some of the other mixed
+	// in, as it is from a composite signal.
+	float luma = 0.0f;
+	for (unsigned p = 0; p < SAMPLES_PER_CYCLE; p++) {
+		luma += signal_level(color, p);
+	}
+	luma /= SAMPLES_PER_CYCLE;
+
+	float luma_in[SAMPLES_PER_PIXEL];
+	float chroma_in[SAMPLES_PER_PIXEL];
+	for (unsigned s = 0; s < SAMPLES_PER_PIXEL; s++) {
+		float chroma = signal_level(color, (unsigned)(phase * 4 + s) % SAMPLES_PER_CYCLE) - luma;
+		luma_in[s] = luma + opts->artifacts * chroma;
+		chroma_in[s] = chroma + opts->artifacts * luma;
+	}
+
+	for (int k = 0; k < KERNEL_SIZE; k++) {
+		// Output pixels are four samples wide, and the pixel's own
+		// start at its first sample
+		float center = (float)((k - KERNEL_FIRST) * 4) + 1.5f;
+
+		float y = 0.0f, i = 0.0f, q = 0.0f;
+		for (unsigned s = 0; s < SAMPLES_PER_PIXEL; s++) {
+			float offset = (float)s - center;
+			float angle = 2.0f * (float)M_PI * ((float)((phase * 4 + s) % SAMPLES_PER_CYCLE) + HUE_OFFSET) / SAMPLES_PER_CYCLE;
+			float chroma = 2.0f * window_weight(offset, CHROMA_RADIUS) / chroma_total * chroma_in[s];
+
+			y += window_weight(offset, luma_radius) / luma_total * luma_in[s];
+			i += chroma * cosf(angle);
+			q += chroma * sinf(angle);
+		}
+
+		kernel[k][0] = 255.0f * (y + 0.956f * i + 0.621f * q);
+		kernel[k][1] = 255.0f * (y - 0.272f * i - 0.647f * q);
+		kernel[k][2] = 255.0f * (y - 1.106f * i + 1.703f * q);
+		kernel[k][3] = 0.0f;
+	}
+}
+
+// Filters row `row` of the frame into the current field's output, unless it
+// hasn't changed since it was last filtered
+static void
+filter_row (ntsc_filter_t * nonnull ntsc, size_t row)
+{
+	const uint16_t * src = (const uint16_t * nonnull)ntsc->frame + row * PPU_OUTPUT_WIDTH;
+	uint16_t * cached = ntsc->rows[ntsc->field][row];
+	if (ntsc->valid[ntsc->field][row] && !memcmp(cached, src, PPU_OUTPUT_WIDTH * sizeof(uint16_t))) {
+		return;
+	}
+	memcpy(cached, src, PPU_OUTPUT_WIDTH * sizeof(uint16_t));
+	ntsc->valid[ntsc->field][row] = true;
+
+	// Sum up every input pixel's contributions. Output pixel `j` is at
+	// `acc[(j + KERNEL_FIRST) * 4]`.
+	_Alignas(32) float acc[(NTSC_OUTPUT_WIDTH + KERNEL_SIZE) * 4];
+	memset(acc, 0, sizeof(acc));
+
+	size_t phase = (row + ntsc->field) % NPHASES;
+	for (size_t x = 0; x < PPU_OUTPUT_WIDTH; x++) {
+		const float * kernel = (const float *)ntsc->kernels[phase][src[x]];
+		float * out = acc + x * 2 * 4;
+		phase = (phase + 2) % NPHASES;
+
+#if defined(__AVX__)
+		for (size_t i = 0; i < KERNEL_SIZE * 4; i += 8) {
+			_mm256_store_ps(out + i, _mm256_add_ps(_mm256_load_ps(out + i), _mm256_load_ps(kernel + i)));
+		}
+#elif defined(__SSE2__)
+		for (size_t i = 0; i < KERNEL_SIZE * 4; i += 4) {
+			_mm_store_ps(out + i, _mm_add_ps(_mm_load_ps(out + i), _mm_load_ps(kernel + i)));
+		}
+#else
+		for (size_t i = 0; i < KERNEL_SIZE * 4; i++) {
+			out[i] += kernel[i];
+		}
+#endif
+	}
+
+	// Round and clamp the sums into pixels, four at a time where the target
+	// supports it (rows are a multiple of four pixels wide)
+	uint32_t * dst = ntsc->output[ntsc->field][row];
+	const float * sums = acc + KERNEL_FIRST * 4;
+#if defined(__SSE2__)
+	const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+	for (size_t j = 0; j < NTSC_OUTPUT_WIDTH; j += 4) {
+		__m128i lo = _mm_packs_epi32(_mm_cvtps_epi32(_mm_load_ps(sums + j * 4)),
+					     _mm_cvtps_epi32(_mm_load_ps(sums + j * 4 + 4)));
+		__m128i hi = _mm_packs_epi32(_mm_cvtps_epi32(_mm_load_ps(sums + j * 4 + 8)),
+					     _mm_cvtps_epi32(_mm_load_ps(sums + j * 4 + 12)));
+		_mm_storeu_si128((__m128i *)(dst + j), _mm_or_si128(_mm_packus_epi16(lo, hi), alpha));
+	}
+#else
+	for (size_t j = 0; j < NTSC_OUTPUT_WIDTH; j++) {
+		uint8_t rgba[4] = {0, 0, 0, 255};
+		for (size_t c = 0; c < 3; c++) {
+			float v = roundf(sums[j * 4 + c]);
+			rgba[c] = v < 0.0f ? 0 : v > 255.0f ? 255 : (uint8_t)v;
+		}
+		memcpy(&dst[j], rgba, sizeof(rgba));
+	}
+#endif
+}
+
+// Filters every row of band number `band`
+static void
+filter_band (ntsc_filter_t * nonnull ntsc, size_t band)
+{
+	size_t first = band * NTSC_OUTPUT_HEIGHT / ntsc->nbands;
+	size_t last = (band + 1) * NTSC_OUTPUT_HEIGHT / ntsc->nbands;
+	for (size_t row = first; row < last; row++) {
+		filter_row(ntsc, row);
+	}
+}
+
+// A filter worker: takes a band of the frame each time one comes in
+static int
+filter_worker (void * data)
+{
+	ntsc_filter_t * ntsc = data;
+
+	for (;;) {
+		SDL_SemWait((SDL_sem * nonnull)ntsc->work);
+		if (atomic_load(&ntsc->quit)) {
+			return 0;
+		}
+
+		size_t band = atomic_fetch_add(&ntsc->ntaken, 1);
+		if (band < ntsc->nbands) {
+			filter_band(ntsc, band);
+			SDL_SemPost((SDL_sem * nonnull)ntsc->done);
+		}
+	}
+}
+
+const uint32_t *
+ntsc_filter_frame (ntsc_filter_t * ntsc, const uint16_t * frame, uint64_t framenum)
+{
+	ntsc->frame = frame;
+	ntsc->field = framenum & 1;
+	atomic_store(&ntsc->ntaken, 0);
+
+	for (size_t i = 0; i < ntsc->nthreads; i++) {
+		SDL_SemPost((SDL_sem * nonnull)ntsc->work);
+	}
+
+	// Filter bands here too until there are none left, then wait for the
+	// ones the workers took
+	size_t nown = 0;
+	size_t band;
+	while ((band = atomic_fetch_add(&ntsc->ntaken, 1)) < ntsc->nbands) {
+		filter_band(ntsc, band);
+		nown++;
+	}
+	for (size_t i = nown; i < ntsc->nbands; i++) {
+		SDL_SemWait((SDL_sem * nonnull)ntsc->done);
+	}
+
+	return ntsc->output[ntsc->field][0];
+}
+
+void
+ntsc_filter_set_palette (ntsc_filter_t * ntsc, const uint32_t * palette_rgba)
+{
+	float (* kernels)[PPU_NCOLORS + 1][KERNEL_SIZE][4] = (float (* nonnull)[PPU_NCOLORS + 1][KERNEL_SIZE][4])ntsc->kernels;
+
+	for (size_t color = 0; color <= PPU_NCOLORS; color++) {
+		// Average what a flat area of the color comes out as over the
+		// six output pixels that it takes for the phases to repeat,
+		// from the pixels far enough around them to contribute
+		float flat[3] = {0.0f, 0.0f, 0.0f};
+		for (int j = 2 * KERNEL_SIZE; j < 2 * KERNEL_SIZE + 2 * NPHASES; j++) {
+			for (int x = 0; x < 2 * KERNEL_SIZE; x++) {
+				int k = j - 2 * x + KERNEL_FIRST;
+				if (k < 0 || k >= KERNEL_SIZE) {
+					continue;
+				}
+				for (size_t c = 0; c < 3; c++) {
+					flat[c] += kernels[(2 * x) % NPHASES][color][k][c] - (k == KERNEL_FIRST || k == KERNEL_FIRST + 1 ? ntsc->deltas[color][c] : 0.0f);
+				}
+			}
+		}
+
+		uint8_t rgba[4];
+		memcpy(rgba, &palette_rgba[color], sizeof(rgba));
+
+		for (size_t c = 0; c < 3; c++) {
+			float delta = (float)rgba[c] - flat[c] / (2 * NPHASES);
+			for (size_t phase = 0; phase < NPHASES; phase++) {
+				kernels[phase][color][KERNEL_FIRST][c] += delta - ntsc->deltas[color][c];
+				kernels[phase][color][KERNEL_FIRST + 1][c] += delta - ntsc->deltas[color][c];
+			}
+			ntsc->deltas[color][c] = delta;
+		}
+	}
+
+	memset(ntsc->valid, 0, sizeof(ntsc->valid));
+}
+
+static void
+deinit (ntsc_filter_t * nonnull ntsc)
+{
+	if (ntsc->nthreads) {
+		atomic_store(&ntsc->quit, true);
+		for (size_t i = 0; i < ntsc->nthreads; i++) {
+			SDL_SemPost((SDL_sem * nonnull)ntsc->work);
+		}
+		for (size_t i = 0; i < ntsc->nthreads; i++) {
+			SDL_WaitThread(ntsc->threads[i], NULL);
+		}
+	}
+
+	if (ntsc->work) {
+		SDL_DestroySemaphore(ntsc->work);
+	}
+	if (ntsc->done) {
+		SDL_DestroySemaphore(ntsc->done);
+	}
+	free(ntsc->kernels);
+}
+
+ntsc_filter_t *
+ntsc_filter_new (const ntsc_options_t * opts)
+{
+	size_t nthreads = opts->nthreads;
+	if (!nthreads) {
+		int ncpus = SDL_GetCPUCount();
+		nthreads = ncpus > 1 ? (size_t)ncpus - 1 : 0;
+	}
+
+	ntsc_filter_t * ntsc = rc_alloc(sizeof(ntsc_filter_t) + nthreads * sizeof(SDL_Thread *), deinit);
+	ntsc->nbands = nthreads + 1;
+	atomic_init(&ntsc->ntaken, 0);
+	atomic_init(&ntsc->quit, false);
+
+	// Kernels are added up a pair of output pixels at a time, so they have
+	// to be aligned for that
+	ntsc->kernels = aligned_alloc(32, NPHASES * sizeof(*ntsc->kernels));
+	if (!ntsc->kernels) {
+		ERROR_PRINT("Could not allocate the NTSC filter kernels");
+		goto error;
+	}
+	for (size_t phase = 0; phase < NPHASES; phase++) {
+		for (unsigned color = 0; color < PPU_NCOLORS; color++) {
+			build_kernel(opts, color, phase, ntsc->kernels[phase][color]);
+		}
+
+		// Blank pixels are black
+		build_kernel(opts, 0x0F, phase, ntsc->kernels[phase][PPU_PIXEL_BLANK]);
+	}
+
+	ntsc->work = SDL_CreateSemaphore(0);
+	ntsc->done = SDL_CreateSemaphore(0);
+	if (!ntsc->work || !ntsc->done) {
+		ERROR_PRINT("Could not create the NTSC filter's semaphores: %s", SDL_GetError());
+		goto error;
+	}
+
+	for (; ntsc->nthreads < nthreads; ntsc->nthreads++) {
+		SDL_Thread * thread = SDL_CreateThread(filter_worker, "ntsc-filter", ntsc);
+		if (!thread) {
+			ERROR_PRINT("Could not start an NTSC filter worker: %s", SDL_GetError());
+			goto error;
+		}
+		ntsc->threads[ntsc->nthreads] = thread;
+	}
+
+	return ntsc;
+error:
+	rc_release(ntsc);
+	return NULL;
+}
@@ -35,7 +35,7 @@ write (pageforty_t * pageforty, uint16_t addr, uint8_t val)
 }
 
 int
-pageforty_setup (reset_manager_t * rm, mos6502_t * cpu, const char * cscheme_path)
+pageforty_setup (reset_manager_t * rm, mos6502_t * cpu, const char * cscheme_path, const apu_options_t * apu_opts)
 {
 	int retcode = -1;
 
@@ -45,7 +45,7 @@ pageforty_setup (reset_manager_t * rm, mos6502_t * cpu, const char * cscheme_pat
 		goto ret;
 	}
 
-	apu_t * apu = apu_new(rm, cpu);
+	apu_t * apu = apu_new(rm, cpu, apu_opts);
 	if (!apu) {
 		ERROR_PRINT("Couldn't create an APU device");
 		rc_release(io);
@@ -36,7 +36,9 @@
  * - The actual hardware directly produced composite NTSC video, which led to
  *   some interesting visual artifacts. Emulating composite video generation
  *   and decoding sounded complicated, so we instead produce very boring
- *   pixelated images.
+ *   pixelated images. These can optionally be put through an approximation
+ *   of composite video on their way to the window (see `ntsc.h`), but the
+ *   PPU itself never knows about it.
  *
  * - There are likely yet-undiscovered issues with this implementation.
  *
@@ -50,38 +52,124 @@
 #include <base.h>
 #include <membus.h>
 #include <nes/ppu.h>
-#include <SDL2/SDL.h>
+#include <nes/framesink.h>
 #include <mos6502/mos6502.h>
 
-// Displays the current frame of video to the screen, and processes SDL_QUIT
-// events
+#include <SDL2/SDL.h>
+
+#include <string.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+
+#if defined(__AVX2__) || defined(__SSE4_1__) || defined(__SSE2__)
+#	include <immintrin.h>
+#endif
+
+// The number of dots at the start of each visible scanline (dots 1 through
+// 256) that the scanline renderers skip over and then render in one go
+#define SCANLINE_DEFERRED_DOTS 256
+
+// A little over how long a frame lasts in real time, in milliseconds. Adaptive
+// frame skipping kicks in once emulation is this far behind.
+#define FRAME_MS 17
+
+// The layout of a sprite line buffer entry, apart from the sprite's color in
+// the low 2 bits
+#define SPRITE_LINE_PALETTE_SHIFT 2
+#define SPRITE_LINE_BEHIND_BG     0x10
+#define SPRITE_LINE_SPRITE0       0x20
+
+// The bits of the mask register that decide which pixels are drawn, as laid
+// out in `ppu_t`
+#define MASK_LEFT_BG_EN     0x02
+#define MASK_LEFT_SPRITE_EN 0x04
+#define MASK_BG_EN          0x08
+#define MASK_SPRITE_EN      0x10
+
+// How many scanlines (starting from a multiple of this) are handed to a render
+// worker at a time by `PPU_RENDERER_PARALLEL`
+#define WORKER_BATCH_LINES 16
+
+// Computes an FNV-1a hash of an indexed frame
+static inline uint64_t
+frame_hash (const uint16_t * nonnull frame)
+{
+	const uint8_t * bytes = (const uint8_t *)frame;
+	uint64_t hash = 0xCBF29CE484222325ULL;
+	for (size_t i = 0; i < PPU_OUTPUT_WIDTH * PPU_OUTPUT_HEIGHT * sizeof(*frame); i++) {
+		hash ^= bytes[i];
+		hash *= 0x100000001B3ULL;
+	}
+	return hash;
+}
+
+// Compares the frame produced by the scanline renderer with that produced by
+// the dot renderer, for `PPU_RENDERER_VERIFY`
 static inline void
-present_frame (ppu_t * nonnull ppu)
+verify_frame (ppu_t * nonnull ppu)
 {
-	// Check if we should quit (e.g. the user clicked the close-window button)
-	SDL_Event event;
-	while (SDL_PollEvent(&event)) {
-		if (event.type == SDL_QUIT) {
-			INFO_PRINT("Goodbye!");
-			exit(EXIT_SUCCESS);
+	uint16_t * dot_frame = (uint16_t * nonnull)ppu->verify_frame;
+
+	// Rows that only one renderer produced (because the scanline renderer
+	// fell back to the dot renderer, or nothing was rendered) are taken
+	// as-is from the actual frame
+	for (size_t row = 0; row < PPU_OUTPUT_HEIGHT; row++) {
+		if (!ppu->verify_rows[row]) {
+			memcpy(dot_frame + row * PPU_OUTPUT_WIDTH,
+			       ppu->frame + row * PPU_OUTPUT_WIDTH,
+			       PPU_OUTPUT_WIDTH * sizeof(*dot_frame));
 		}
+		ppu->verify_rows[row] = false;
 	}
 
-	// "Commit" the new frame contents to the backing `SDL_Texture` object
-	SDL_UnlockTexture(ppu->tex);
+	uint64_t scanline_hash = frame_hash(ppu->frame);
+	uint64_t dot_hash = frame_hash(dot_frame);
+	if (scanline_hash != dot_hash) {
+		ppu->verify_nmismatches++;
+		WARNING_PRINT("Frame %zu: scanline renderer hash %016" PRIx64 " differs from dot renderer hash %016" PRIx64
+			      " (%zu mismatched frames so far)",
+			      ppu->framenum, scanline_hash, dot_hash, ppu->verify_nmismatches);
+	}
+}
+
+// Decides whether the next frame should be skipped, due to either the frame
+// interval or (if adaptive skipping is on) emulation falling behind
+static inline bool
+should_skip_frame (ppu_t * nonnull ppu)
+{
+	if (ppu->frame_interval > 1 && ppu->nskipped + 1 < ppu->frame_interval) {
+		return true;
+	}
+
+	return ppu->adaptive_skip &&
+	       ppu->nskipped < PPU_MAX_SKIPPED_FRAMES &&
+	       timekeeper_lag_ms(ppu->cpu->tk) > FRAME_MS;
+}
+
+static void finish_lines (struct ppu_workers * nonnull workers);
 
-	// Copy the frame to the backbuffer, upscaling it if required
-	SDL_RenderCopy(ppu->rend, ppu->tex, NULL, NULL);
+// Hands the current frame of video off to the frame sink, unless it was
+// skipped, and decides whether to skip the next one
+static inline void
+present_frame (ppu_t * nonnull ppu)
+{
+	if (ppu->workers) {
+		finish_lines((struct ppu_workers * nonnull)ppu->workers);
+	}
 
-	// Swap buffers to display the new frame, synchronously blocking until
-	// a new backbuffer is available
-	SDL_RenderPresent(ppu->rend);
+	if (!ppu->skip_frame) {
+		if (ppu->renderer == PPU_RENDERER_VERIFY) {
+			verify_frame(ppu);
+		}
+
+		framesink_present(ppu->sink, ppu);
+	}
+	else {
+		framesink_skip(ppu->sink, ppu);
+	}
 
-	// Lock the frame texture so that it can be overwritten with the next
-	// frame
-	int pitch;
-	SDL_LockTexture(ppu->tex, NULL, (void **)&ppu->texdata, &pitch);
-	ppu->texpitch = (size_t)pitch;
+	ppu->skip_frame = should_skip_frame(ppu);
+	ppu->nskipped = ppu->skip_frame ? ppu->nskipped + 1 : 0;
 }
 
 // Increments the coarse (8-pixel) x-position for background scrolling,
@@ -173,6 +261,20 @@ palette_loc (ppu_t * nonnull ppu, uint16_t addr)
 	return &ppu->palette_mem[offset];
 }
 
+// Recomputes `palette_cache` from palette memory and the color emphasis bits
+static inline void
+refresh_palette_cache (ppu_t * nonnull ppu)
+{
+	uint16_t emph = 0;
+	emph |= ppu->emph_red << 6;
+	emph |= ppu->emph_green << 7;
+	emph |= ppu->emph_blue << 8;
+
+	for (uint16_t i = 0; i < 32; i++) {
+		ppu->palette_cache[i] = *palette_loc(ppu, 0x3F00 + i) | emph;
+	}
+}
+
 // Sets the status registers that we previously determined needed to be set.
 // This means setting the `sprite0_hit` flag on the dot after it was detected,
 // and the `sprite_overflow` flag on dot determined during sprite evaluation.
@@ -190,34 +292,90 @@ set_delayed_regs (ppu_t * nonnull ppu)
 	}
 }
 
-// Clears status registers as appropriate
+// Clears status registers at the start of the pre-render scanline
 static inline void
 clear_regs (ppu_t * nonnull ppu)
 {
-	if (ppu->dotnum == 1 && ppu->slnum == 261) {
-		ppu->sprite0_hit           = false;
-		ppu->sprite0_hit_shouldset = false;
-		ppu->sprite_overflow       = false;
-		ppu->write_toggle          = false;
-		ppu->vblank                = false;
+	ppu->sprite0_hit           = false;
+	ppu->sprite0_hit_shouldset = false;
+	ppu->sprite_overflow       = false;
+	ppu->write_toggle          = false;
+	ppu->vblank                = false;
+}
+
+// Fetches the color and palette bits of the current background pixel from the
+// background shiftregs
+static inline void
+bg_pixel (ppu_t * nonnull ppu, uint8_t * nonnull color, uint8_t * nonnull palette)
+{
+	*color = (ppu->bg_bmp_shiftregs[0] >> (ppu->fine_xscroll * 8)) & 0x3;
+
+	*palette = 0;
+	*palette |= ((ppu->bg_attr_shiftregs[0] << ppu->fine_xscroll) >> 7) & 0x1;
+	*palette |= ((ppu->bg_attr_shiftregs[1] << ppu->fine_xscroll) >> 6) & 0x2;
+}
+
+// Looks up the color at `paladdr` (with color emphasis applied), and writes it
+// to the frame at the position of `dotnum` on the current scanline
+static inline void
+output_pixel (ppu_t * nonnull ppu, size_t dotnum, uint16_t paladdr)
+{
+	ppu->frame[ppu->slnum * PPU_OUTPUT_WIDTH + dotnum - 1] = ppu->palette_cache[paladdr % 32];
+}
+
+// Combines a background and sprite pixel at `dotnum` into a palette address,
+// under the mask register value `mask`, setting `sprite0_hit` if a sprite 0
+// hit occurs
+static inline uint16_t
+compose_pixel (uint8_t mask,
+	       size_t dotnum,
+	       uint8_t bg_color,
+	       uint8_t bg_palette,
+	       uint8_t sprite_color,
+	       uint8_t sprite_palette,
+	       bool sprite_behind_bg,
+	       bool is_sprite0,
+	       bool * nonnull sprite0_hit)
+{
+	// When sprites are disabled, force the sprite to be transparent
+	if (!(mask & MASK_SPRITE_EN) || (!(mask & MASK_LEFT_SPRITE_EN) && dotnum <= 8)) {
+		sprite_color = 0;
+	}
+
+	// When the background is disabled, force the background to be
+	// transparent
+	if (!(mask & MASK_BG_EN) || (!(mask & MASK_LEFT_BG_EN) && dotnum <= 8)) {
+		bg_color = 0;
+	}
+
+	if (!bg_color) {
+		if (!sprite_color) {
+			return 0x3F00;
+		}
+		goto sprite;
+	}
+
+	if (sprite_color && is_sprite0 && dotnum != 256) {
+		*sprite0_hit = true;
 	}
+
+	if (!sprite_color || sprite_behind_bg) {
+		return 0x3F01 + 4 * bg_palette + bg_color - 1;
+	}
+
+sprite:
+	return 0x3F11 + 4 * sprite_palette + sprite_color - 1;
 }
 
-// If rendering is enabled and the cursor is within the visible part of the
-// frame, computes and sets the appropriate pixel
+// Computes and sets the pixel at the cursor, which must be within the visible
+// part of the frame
 static inline void
 draw_pixel (ppu_t * ppu)
 {
-	if (!(ppu->bg_en || ppu->sprite_en) || ppu->dotnum < 1 || ppu->dotnum > 256 || ppu->slnum >= 240) {
-		return;
-	}
 
 	// Fetch the next color and palette bits from the background shiftregs
-	uint8_t bg_color = 0, bg_palette = 0;
-	bg_color   |= ((ppu->bg_bmp_shiftregs[0] << ppu->fine_xscroll) >> 15) & 0x1;
-	bg_color   |= ((ppu->bg_bmp_shiftregs[1] << ppu->fine_xscroll) >> 14) & 0x2;
-	bg_palette |= ((ppu->bg_attr_shiftregs[0] << ppu->fine_xscroll) >> 7) & 0x1;
-	bg_palette |= ((ppu->bg_attr_shiftregs[1] << ppu->fine_xscroll) >> 6) & 0x2;
+	uint8_t bg_color, bg_palette;
+	bg_pixel(ppu, &bg_color, &bg_palette);
 
 	// Decrement the relative x-position of each sprite
 	for (size_t i = 0; i < 8; i++) {
@@ -238,8 +396,7 @@ draw_pixel (ppu_t * ppu)
 
 		if (!sprite_color) {
 			// Current sprite pixel is transparent
-			sprite_color |= (ppu->sprite_bmp_shiftregs[i][0] >> 7) & 0x1;
-			sprite_color |= (ppu->sprite_bmp_shiftregs[i][1] >> 6) & 0x2;
+			sprite_color     = ppu->sprite_bmp_shiftregs[i] & 0x3;
 			sprite_palette   = ppu->sprite_attrs[i].palette;
 			sprite_behind_bg = ppu->sprite_attrs[i].behind_bg;
 			is_sprite0 = !i && ppu->scanline_has_sprite0;
@@ -247,73 +404,105 @@ draw_pixel (ppu_t * ppu)
 
 		// Shift the sprite shiftregs, so that the next dot gets the
 		// next pixel in the sprite
-		ppu->sprite_bmp_shiftregs[i][0] <<= 1;
-		ppu->sprite_bmp_shiftregs[i][1] <<= 1;
+		ppu->sprite_bmp_shiftregs[i] >>= 8;
 	}
 
-	// When sprites are disabled, force the sprite to be transparent
-	if (!ppu->sprite_en || (!ppu->left_sprite_en && ppu->dotnum <= 8)) {
-		sprite_color = 0;
+	bool sprite0_hit = false;
+	uint16_t paladdr = compose_pixel(ppu->mask, ppu->dotnum,
+					 bg_color, bg_palette,
+					 sprite_color, sprite_palette,
+					 sprite_behind_bg, is_sprite0,
+					 &sprite0_hit);
+	if (sprite0_hit) {
+		ppu->sprite0_hit_shouldset = true;
 	}
-
-	// When the background is disabled, force the background to be
-	// transparent
-	if (!ppu->bg_en || (!ppu->left_bg_en && ppu->dotnum <= 8)) {
-		bg_color = 0;
+	if (!ppu->skip_frame) {
+		output_pixel(ppu, ppu->dotnum, paladdr);
 	}
+}
 
-	uint16_t paladdr;
+static inline size_t
+sprite_height (const ppu_t * nonnull ppu)
+{
+	return ppu->spritesize == PPU_SPRITESIZE_8x8 ? 8 : 16;
+}
 
-	if (!bg_color) {
-		if (!sprite_color) {
-			paladdr = 0x3F00;
-			goto output;
-		}
-		goto sprite;
+// Adds sprite `spritenum` to (or removes it from) `sprite_lines` for each
+// visible scanline that it overlaps
+static inline void
+index_sprite (ppu_t * nonnull ppu, size_t spritenum, bool overlaps)
+{
+	size_t ypos = ppu->sprites[spritenum].ypos;
+	size_t end = ypos + sprite_height(ppu);
+	if (end > PPU_OUTPUT_HEIGHT) {
+		end = PPU_OUTPUT_HEIGHT;
 	}
 
-	if (sprite_color && is_sprite0 && ppu->dotnum != 256) {
-		ppu->sprite0_hit_shouldset = true;
+	uint64_t bit = (uint64_t)1 << spritenum;
+	for (size_t slnum = ypos; slnum < end; slnum++) {
+		if (overlaps) {
+			ppu->sprite_lines[slnum] |= bit;
+		}
+		else {
+			ppu->sprite_lines[slnum] &= ~bit;
+		}
 	}
+}
 
-	if (!sprite_color || sprite_behind_bg) {
-		goto bg;
+// Rebuilds `sprite_lines` from scratch, for when all of OAM or the sprite size
+// changes. Each scanline's mask comes from comparing it against the
+// y-positions of all 64 sprites at once.
+static void
+rebuild_sprite_lines (ppu_t * nonnull ppu)
+{
+	uint8_t ys[64];
+	for (size_t i = 0; i < 64; i++) {
+		ys[i] = ppu->sprites[i].ypos;
 	}
+	uint8_t height = (uint8_t)sprite_height(ppu);
 
-	// fallthrough
-
-sprite:
-	paladdr = 0x3F11 + 4 * sprite_palette + sprite_color - 1;
-	goto output;
-bg:
-	paladdr = 0x3F01 + 4 * bg_palette + bg_color - 1;
-	// fallthrough
-output : {
-	uint16_t pixel_color = *palette_loc(ppu, paladdr);
-	pixel_color |= ppu->emph_red << 6;
-	pixel_color |= ppu->emph_green << 7;
-	pixel_color |= ppu->emph_blue << 8;
-
-	uint8_t * pixdata = ppu->texdata + ppu->slnum * ppu->texpitch + (ppu->dotnum - 1) * 4;
-	pixdata[0] = ppu->palette_srgb[pixel_color][0];
-	pixdata[1] = ppu->palette_srgb[pixel_color][1];
-	pixdata[2] = ppu->palette_srgb[pixel_color][2];
-	pixdata[3] = 255;
-}}
+#if defined(__SSE2__)
+	__m128i yvecs[4];
+	for (size_t j = 0; j < 4; j++) {
+		yvecs[j] = _mm_loadu_si128((const __m128i *)&ys[j * 16]);
+	}
+	__m128i maxoffs = _mm_set1_epi8((char)(height - 1));
+
+	for (size_t slnum = 0; slnum < PPU_OUTPUT_HEIGHT; slnum++) {
+		__m128i slvec = _mm_set1_epi8((char)slnum);
+		uint64_t mask = 0;
+		for (size_t j = 0; j < 4; j++) {
+			// A sprite overlaps if `ypos <= slnum` and
+			// `slnum - ypos < height`, both compared unsigned
+			__m128i offs = _mm_sub_epi8(slvec, yvecs[j]);
+			__m128i above = _mm_cmpeq_epi8(_mm_max_epu8(yvecs[j], slvec), slvec);
+			__m128i within = _mm_cmpeq_epi8(_mm_min_epu8(offs, maxoffs), offs);
+			uint64_t bits = (uint16_t)_mm_movemask_epi8(_mm_and_si128(above, within));
+			mask |= bits << (j * 16);
+		}
+		ppu->sprite_lines[slnum] = mask;
+	}
+#else
+	for (size_t slnum = 0; slnum < PPU_OUTPUT_HEIGHT; slnum++) {
+		uint64_t mask = 0;
+		for (size_t i = 0; i < 64; i++) {
+			if (slnum >= ys[i] && slnum < (size_t)ys[i] + height) {
+				mask |= (uint64_t)1 << i;
+			}
+		}
+		ppu->sprite_lines[slnum] = mask;
+	}
+#endif
+}
 
 // Perform the sprite evaluation process in a single step. This involves
 // determining which sprites overlap the next scanline (at most 8), saving
 // their information separately, and computing when (and if) the sprite
-// overflow flag should be set along the current scanline.
+// overflow flag should be set along the current scanline. This is performed
+// on the first dot of each visible scanline.
 static inline void
 spriteeval (ppu_t * nonnull ppu)
 {
-	// This process is only performed on the first dot of each visible
-	// scanline, when rendering is enabled
-	if (!(ppu->bg_en || ppu->sprite_en) || ppu->dotnum != 0 || ppu->slnum >= 240) {
-		return;
-	}
-
 	// Clear the state set by the last sprite evaluation
 	memset(ppu->eval_sprites, 0xFF, sizeof(ppu->eval_sprites));
 	ppu->eval_nsprites = 0;
@@ -322,35 +511,29 @@ spriteeval (ppu_t * nonnull ppu)
 	ppu->scanline_has_sprite0 = ppu->next_scanline_has_sprite0;
 	ppu->next_scanline_has_sprite0 = false;
 
-	// Evaluate sprites
-	size_t spriteheight = ppu->spritesize == PPU_SPRITESIZE_8x8 ? 8 : 16;
+	// Evaluate sprites, taking the first 8 that overlap this scanline
+	uint64_t overlapping = ppu->sprite_lines[ppu->slnum];
 	size_t spritenum = 0;
-	for (; ppu->eval_nsprites < 8 && spritenum < 64; spritenum++) {
-		ppu_sprite_t sprite = ppu->sprites[spritenum];
-		if (ppu->slnum < sprite.ypos || ppu->slnum >= sprite.ypos + spriteheight) {
-			continue;
-		}
-
+	for (; ppu->eval_nsprites < 8 && overlapping; overlapping &= overlapping - 1) {
+		spritenum = (size_t)__builtin_ctzll(overlapping);
 		if (!spritenum) {
 			ppu->next_scanline_has_sprite0 = true;
 		}
 
-		ppu->eval_sprites[ppu->eval_nsprites] = sprite;
+		ppu->eval_sprites[ppu->eval_nsprites] = ppu->sprites[spritenum];
 		ppu->eval_nsprites++;
 	}
 
-	// Check excess sprites for overflow
-	for (; spritenum < 64; spritenum++) {
-		if (ppu->slnum >= ppu->sprites[spritenum].ypos || ppu->slnum < ppu->sprites[spritenum].ypos + spriteheight) {
-			// [https://forums.nesdev.com/viewtopic.php?f=2&t=15870]
-			// Eight cycles pass for each of the 8 sprites that we
-			// *will* render, along with 2 cycles for each of the
-			// sprites that we found not to overlap this scanline,
-			// and finally 2 cycles while examining the overflowing
-			// sprite before the overflow flag is set.
-			ppu->overflow_dotnum = 8 * 8 + (spritenum + 1 - 8) * 2;
-			break;
-		}
+	// Check excess sprites for overflow. The first sprite examined after
+	// the eighth overlapping one always sets the flag.
+	if (ppu->eval_nsprites == 8 && spritenum + 1 < 64) {
+		// [https://forums.nesdev.com/viewtopic.php?f=2&t=15870]
+		// Eight cycles pass for each of the 8 sprites that we
+		// *will* render, along with 2 cycles for each of the
+		// sprites that we found not to overlap this scanline,
+		// and finally 2 cycles while examining the overflowing
+		// sprite before the overflow flag is set.
+		ppu->overflow_dotnum = 8 * 8 + (spritenum + 2 - 8) * 2;
 	}
 }
 
@@ -367,13 +550,87 @@ bg_bmp_addr (ppu_t * nonnull ppu)
 	return addr;
 }
 
-// Bitswap a byte in-place, using a small number of efficient integer
-// operations (no divisions). Stolen from
-// [https://graphics.stanford.edu/~seander/bithacks.html#ReverseByteWith64Bits].
+// Reads the byte at `addr` on the PPU's memory bus, straight from memory if
+// it's mapped there
+static inline uint8_t
+bus_read (ppu_t * nonnull ppu, uint16_t addr)
+{
+	size_t windownum = addr / PPU_WINDOW_SIZE;
+	if (LIKELY(windownum < PPU_NWINDOWS && ppu->windows[windownum])) {
+		return ppu->windows[windownum][addr % PPU_WINDOW_SIZE];
+	}
+	return membus_read(ppu->bus, addr);
+}
+
+// Reads the byte at `addr` in the nametables ($2000-$2FFF), the same as
+// `bus_read`
+static inline uint8_t
+nt_read (ppu_t * nonnull ppu, uint16_t addr)
+{
+	const uint8_t * window = ppu->windows[addr / PPU_WINDOW_SIZE];
+	if (LIKELY(window)) {
+		return window[addr % PPU_WINDOW_SIZE];
+	}
+	return membus_read(ppu->bus, addr);
+}
+
+// Performs a read at `addr` in the nametables whose value is thrown away. This
+// only has to reach the bus if a mapper might be watching it.
 static inline void
-bitswap (uint8_t * nonnull val)
+nt_dummy_read (ppu_t * nonnull ppu, uint16_t addr)
+{
+	if (UNLIKELY(!ppu->windows[addr / PPU_WINDOW_SIZE])) {
+		membus_read(ppu->bus, addr);
+	}
+}
+
+// Reads the two bitmap bytes at `addr` and `addr + 8` from the PPU's memory bus,
+// and decodes them into a row of pixels as laid out in `ppu_chr_tile_t`
+static uint64_t
+decode_chr_row (ppu_t * nonnull ppu, uint16_t addr)
+{
+	uint8_t plane0 = bus_read(ppu, addr);
+	uint8_t plane1 = bus_read(ppu, addr + 8);
+
+	uint64_t pixels = 0;
+	for (unsigned x = 0; x < 8; x++) {
+		uint64_t color = ((plane0 >> (7 - x)) & 0x1) | (((plane1 >> (7 - x)) & 0x1) << 1);
+		pixels |= color << (x * 8);
+	}
+	return pixels;
+}
+
+// Decodes CHR tile number `tilenum` into `ppu->chr_tiles`
+static void
+decode_chr_tile (ppu_t * nonnull ppu, size_t tilenum)
+{
+	ppu_chr_tile_t * tile = &ppu->chr_tiles[tilenum];
+	for (uint16_t row = 0; row < 8; row++) {
+		tile->rows[row] = decode_chr_row(ppu, (uint16_t)(tilenum * 16 + row));
+		tile->flipped_rows[row] = __builtin_bswap64(tile->rows[row]);
+	}
+	tile->valid = true;
+}
+
+// Fetches the pre-decoded row of pixels whose first-plane bitmap byte is at
+// `addr`, decoding its tile first if needed. This stands in for fetching both
+// bitmap bytes, and takes care of horizontal flipping.
+static inline uint64_t
+chr_row (ppu_t * nonnull ppu, uint16_t addr, bool flipped)
 {
-	*val = ((*val * 0x80200802ULL) & 0x0884422110ULL) * 0x0101010101ULL >> 32;
+	// Garbage fetches (e.g. of sprites on the pre-render scanline) can land
+	// outside the first plane of any tile, and so bypass the cache
+	if (UNLIKELY(addr % 16 >= 8 || addr >= PPU_CHR_NTILES * 16)) {
+		uint64_t pixels = decode_chr_row(ppu, addr);
+		return flipped ? __builtin_bswap64(pixels) : pixels;
+	}
+
+	size_t tilenum = addr / 16;
+	ppu_chr_tile_t * tile = &ppu->chr_tiles[tilenum];
+	if (UNLIKELY(!tile->valid)) {
+		decode_chr_tile(ppu, tilenum);
+	}
+	return flipped ? tile->flipped_rows[addr % 8] : tile->rows[addr % 8];
 }
 
 // Compute the address of the nametable byte to be fetched, based on the
@@ -394,43 +651,33 @@ attr_addr (ppu_t * nonnull ppu)
 	return 0x23C0 | (ppu->vram_addr & 0x0C00) | ((ppu->vram_addr >> 4) & 0x38) | ((ppu->vram_addr >> 2) & 0x07);
 }
 
-// Read background bitmap, nametable, and attribute table data as appropriate
+// Read background bitmap, nametable, and attribute table data as appropriate.
+// Background data is fetched constantly during normal rendering, and also at
+// the end of each visible scanline, to prepare for the next.
 static inline void
 bg_memfetch (ppu_t * nonnull ppu)
 {
-	// Background data is fetched constantly during normal rendering, and
-	// also at the end of each visible scanline, to prepare for the next
-	if ((ppu->dotnum < 1 || ppu->dotnum > 256) && (ppu->dotnum < 321 || ppu->dotnum > 336)) {
-		return;
-	}
-
 	switch ((ppu->dotnum - 1) % 8) {
 	case 1:
-		ppu->nt_latch = membus_read(ppu->bus, nt_addr(ppu));
+		ppu->nt_latch = nt_read(ppu, nt_addr(ppu));
 		break;
 	case 3:
-		ppu->attr_latch = membus_read(ppu->bus, attr_addr(ppu));
+		ppu->attr_latch = nt_read(ppu, attr_addr(ppu));
 		break;
 	case 5:
-		ppu->bmp_latch[0] = membus_read(ppu->bus, bg_bmp_addr(ppu));
-		break;
-	case 7:
-		ppu->bmp_latch[1] = membus_read(ppu->bus, bg_bmp_addr(ppu) + 8);
+		// Both bitmap planes are taken from the CHR cache at once
+		ppu->bmp_latch = chr_row(ppu, bg_bmp_addr(ppu), false);
 		break;
 	}
 }
 
 // Read sprite bitmap data as appropriate, along with some garbage bytes from
 // nametable memory. Horizontal sprite flipping is handled at this time by
-// bitswapping the loaded bitmap data.
+// fetching the flipped form of the row from the CHR cache. Sprite information
+// is only fetched from dots 257 through 320.
 static inline void
 sprite_memfetch (ppu_t * nonnull ppu)
 {
-	// Sprite information is only fetched from dots 257 through 320
-	if (ppu->dotnum < 257 || ppu->dotnum > 320) {
-		return;
-	}
-
 	size_t spritenum = (ppu->dotnum - 257) / 8;
 	ppu_sprite_t sprite = ppu->eval_sprites[spritenum];
 
@@ -457,105 +704,37 @@ sprite_memfetch (ppu_t * nonnull ppu)
 
 	switch ((ppu->dotnum - 1) % 8) {
 	case 1:
-		membus_read(ppu->bus, nt_addr(ppu));
+		nt_dummy_read(ppu, nt_addr(ppu));
 		break;
 	case 3:
-		membus_read(ppu->bus, attr_addr(ppu));
+		nt_dummy_read(ppu, attr_addr(ppu));
 		break;
 	case 5:
-		ppu->sprite_bmp_shiftregs[spritenum][0] = membus_read(ppu->bus, bmp_addr);
-		if (sprite.attr.horiz_flipped) {
-			bitswap(&ppu->sprite_bmp_shiftregs[spritenum][0]);
-		}
+		ppu->sprite_bmp_shiftregs[spritenum] = chr_row(ppu, bmp_addr, sprite.attr.horiz_flipped);
 		if (spritenum >= ppu->eval_nsprites) {
-			ppu->sprite_bmp_shiftregs[spritenum][0] = 0;
+			ppu->sprite_bmp_shiftregs[spritenum] = 0;
 		}
 		break;
 	case 7:
-		ppu->sprite_bmp_shiftregs[spritenum][1] = membus_read(ppu->bus, bmp_addr + 8);
-		if (sprite.attr.horiz_flipped) {
-			bitswap(&ppu->sprite_bmp_shiftregs[spritenum][1]);
-		}
-		if (spritenum >= ppu->eval_nsprites) {
-			ppu->sprite_bmp_shiftregs[spritenum][1] = 0;
-		}
-
 		ppu->sprite_xs[spritenum] = sprite.xpos;
 		ppu->sprite_attrs[spritenum] = sprite.attr;
 		break;
 	}
 }
 
-// Perform the garbage reads that occur at the end of each visible scanline,
-// since some mappers track these reads for timing
-static inline void
-dummy_memfetch (ppu_t * nonnull ppu)
-{
-	// TODO implement
-}
-
-// Perform read transfers for background and sprite data, as appropriate
-static inline void
-memfetch (ppu_t * nonnull ppu)
-{
-	// Don't perform any transfers when rendering is disabled, or within
-	// vblank
-	if (!(ppu->bg_en || ppu->sprite_en) || (ppu->slnum >= 240 && ppu->slnum != 261)) {
-		return;
-	}
-	bg_memfetch(ppu);
-	sprite_memfetch(ppu);
-	dummy_memfetch(ppu);
-}
-
-// Update the VRAM address register as appropriate for the current clock cycle
-// See [https://wiki.nesdev.com/w/index.php/PPU_scrolling] for more details
-static inline void
-update_vram_addr (ppu_t * nonnull ppu)
+// The number of dots on the current scanline. The pre-render scanline is one
+// dot shorter on odd frames.
+static inline size_t
+sl_length (const ppu_t * nonnull ppu)
 {
-	// Do nothing if rendering is disabled
-	if (!ppu->bg_en && !ppu->sprite_en) {
-		return;
-	}
-
-	// Only do x and y increments outside of vblank
-	if (ppu->slnum < 240) {
-		// Check if it's time for an increment of the coarse x-scroll
-		if ((ppu->dotnum >= 328 || ppu->dotnum <= 257) && ppu->dotnum != 1 &&
-		    !((ppu->dotnum - 1) % 8)) {
-			inc_coarse_x(ppu);
-			// Check if it's also time for an increment of the
-			// y-scroll
-			if (ppu->dotnum == 257) {
-				inc_y(ppu);
-			}
-		}
-		// Do weird stuff on dot 258
-		else if (ppu->dotnum == 258) {
-			ppu->vram_addr &= ~0x041F;
-			ppu->vram_addr |= ppu->tmp_vram_addr & 0x041F;
-		}
-	}
-	// Do more weird stuff from dots 280 to 304 of the pre-render scanline
-	else if (ppu->slnum == 261 && ppu->dotnum >= 280 && ppu->dotnum <= 304) {
-		ppu->vram_addr &= ~0x3BE0;
-		ppu->vram_addr |= ppu->tmp_vram_addr & 0x3BE0;
-	}
+	return ppu->slnum == 261 && ppu->framenum % 2 ? 340 : 341;
 }
 
 // Update the `dotnum` and `slnum`
 static inline void
 move_cursor (ppu_t * nonnull ppu)
 {
-	size_t sl_length;
-	if (ppu->slnum == 261 && ppu->framenum % 2) {
-		sl_length = 340;
-	}
-	else {
-		sl_length = 341;
-	}
-
-	if (++ppu->dotnum != sl_length) {
+	if (++ppu->dotnum != sl_length(ppu)) {
 		return;
 	}
 
@@ -572,20 +751,9 @@ move_cursor (ppu_t * nonnull ppu)
 // Loads the background bitmap shift registers with new bytes previously loaded
 // from memory, and updates the attribute bit latches
 static inline void
-load_shiftregs (ppu_t * nonnull ppu)
+reload_bg_shiftregs (ppu_t * nonnull ppu)
 {
-	// Check if reloading actually occurs during this cycle
-	if ((ppu->dotnum - 1) % 8 ||
-	    ppu->dotnum == 1 ||
-	    ppu->dotnum == 321 ||
-	    (ppu->dotnum >= 257 && ppu->dotnum <= 320)) {
-		return;
-	}
-
-	ppu->bg_bmp_shiftregs[0] &= 0xFF00;
-	ppu->bg_bmp_shiftregs[1] &= 0xFF00;
-	ppu->bg_bmp_shiftregs[0] |= ppu->bmp_latch[0];
-	ppu->bg_bmp_shiftregs[1] |= ppu->bmp_latch[1];
+	ppu->bg_bmp_shiftregs[1] = ppu->bmp_latch;
 
 	uint8_t attr_x = (ppu->coarse_xscroll / 2) % 2;
 	uint8_t attr_y = (ppu->coarse_yscroll / 2) % 2;
@@ -594,108 +762,971 @@ load_shiftregs (ppu_t * nonnull ppu)
 	ppu->bg_palette = (ppu->attr_latch >> attr_shift) & 0x3;
 }
 
-// Performs the actual shift of the background shift registers
+// Shifts the background shift registers by `n` pixels, where `n` is between 1
+// and 7. This is the same as shifting by one pixel `n` times.
 static inline void
-shift_shiftregs (ppu_t * nonnull ppu)
+shift_bg_shiftregs (ppu_t * nonnull ppu, unsigned n)
 {
-	// Check if shifting actually occurs during this cycle
-	if (!(ppu->dotnum >= 2 && ppu->dotnum <= 257) && !(ppu->dotnum >= 322 && ppu->dotnum <= 337)) {
-		return;
-	}
-
-	// Shift zeros into the bitmap registers
-	ppu->bg_bmp_shiftregs[0] <<= 1;
-	ppu->bg_bmp_shiftregs[1] <<= 1;
+	// Shift transparent pixels into the bitmap registers
+	ppu->bg_bmp_shiftregs[0] >>= n * 8;
+	ppu->bg_bmp_shiftregs[0] |= ppu->bg_bmp_shiftregs[1] << (64 - n * 8);
+	ppu->bg_bmp_shiftregs[1] >>= n * 8;
 
 	// Shift the values from the attribute latches into the attribute
 	// registers
-	ppu->bg_attr_shiftregs[0] = (uint8_t)(ppu->bg_attr_shiftregs[0] << 1) | (ppu->bg_palette & 0x1);
-	ppu->bg_attr_shiftregs[1] = (uint8_t)(ppu->bg_attr_shiftregs[1] << 1) | (ppu->bg_palette >> 1);
+	uint8_t fill = (uint8_t)((1u << n) - 1);
+	ppu->bg_attr_shiftregs[0] = (uint8_t)(ppu->bg_attr_shiftregs[0] << n) | (ppu->bg_palette & 0x1 ? fill : 0);
+	ppu->bg_attr_shiftregs[1] = (uint8_t)(ppu->bg_attr_shiftregs[1] << n) | (ppu->bg_palette & 0x2 ? fill : 0);
 }
 
-static void
-step (ppu_t * nonnull ppu)
+// Fetches the nametable, attribute, and bitmap bytes of the next background
+// tile all at once, the same as `bg_memfetch` does over the course of 8 dots
+static inline void
+bg_fetch_tile (ppu_t * nonnull ppu)
 {
-	ppu->clk_countdown = PPU_CLKDIVISOR;
+	ppu->nt_latch     = nt_read(ppu, nt_addr(ppu));
+	ppu->attr_latch   = nt_read(ppu, attr_addr(ppu));
+	ppu->bmp_latch    = chr_row(ppu, bg_bmp_addr(ppu), false);
+}
 
-	if (ppu->slnum == 241 && ppu->dotnum == 1) {
-		ppu->vblank = true;
-		if (ppu->nmi_en) {
-			mos6502_raise_nmi(ppu->cpu);
+// Everything that the visible pixels of a scanline are worked out from, as
+// captured by the scanline renderer while passing over it
+typedef struct line_input {
+	// The background shiftregs at the start of each group of 8 dots
+	struct {
+		uint64_t bmp_shiftregs[2];
+		uint8_t attr_shiftregs[2];
+		uint8_t palette;
+	} bg[SCANLINE_DEFERRED_DOTS / 8];
+	uint8_t fine_xscroll;
+
+	// The sprites fetched for the scanline
+	uint64_t sprite_bmp_shiftregs[8];
+	ppu_spriteattr_t sprite_attrs[8];
+	uint8_t sprite_xs[8];
+	bool has_sprite0;
+
+	uint8_t mask;
+	uint16_t palette_cache[32];
+} line_input_t;
+
+// The worker threads for `PPU_RENDERER_PARALLEL`, and the log of scanlines
+// that they draw. Lines are logged into `lines` in order over the course of a
+// frame, and handed off in batches of `WORKER_BATCH_LINES` through `batches`;
+// all of them are drawn by the time the frame is presented.
+typedef struct ppu_workers {
+	line_input_t lines[PPU_OUTPUT_HEIGHT];
+
+	// Which of the `lines` have been logged (and have yet to be drawn)
+	bool logged[PPU_OUTPUT_HEIGHT];
+
+	// The frame to draw into
+	uint16_t * nonnull /*unowned*/ frame;
+
+	// The work queue: the batches handed off so far this frame, by number,
+	// of which the first `ntaken` have been taken by a worker. `work` is
+	// posted once for each batch, and `done` once a batch has been drawn.
+	size_t batches[PPU_OUTPUT_HEIGHT / WORKER_BATCH_LINES];
+	size_t nbatches;
+	atomic_size_t ntaken;
+	SDL_sem * nullable work;
+	SDL_sem * nullable done;
+
+	// The batch with logged lines that has yet to be handed off, if any
+	size_t pending_batch;
+
+	atomic_bool quit;
+	size_t nthreads;
+	SDL_Thread * nullable threads[];
+} ppu_workers_t;
+
+// Fetches the color and palette bits of 8 background pixels at once, from the
+// background shiftregs at the start of `group` of `line`. This gives the same
+// pixels as `bg_pixel` would over the group's 8 dots.
+static inline void
+bg_pixels (const line_input_t * nonnull line, size_t group, uint8_t * nonnull colors, uint8_t * nonnull palettes)
+{
+	uint64_t pixels = line->bg[group].bmp_shiftregs[0];
+	if (line->fine_xscroll) {
+		pixels >>= line->fine_xscroll * 8;
+		pixels |= line->bg[group].bmp_shiftregs[1] << (64 - line->fine_xscroll * 8);
+	}
+
+	for (unsigned i = 0; i < 8; i++) {
+		colors[i] = (pixels >> (i * 8)) & 0x3;
+
+		// Past the end of the attribute shiftregs, the bits shifted in
+		// come straight from the palette latch
+		unsigned pos = line->fine_xscroll + i;
+		if (pos < 8) {
+			palettes[i] = 0;
+			palettes[i] |= (line->bg[group].attr_shiftregs[0] >> (7 - pos)) & 0x1;
+			palettes[i] |= ((line->bg[group].attr_shiftregs[1] >> (7 - pos)) & 0x1) << 1;
+		}
+		else {
+			palettes[i] = line->bg[group].palette;
 		}
-		present_frame(ppu);
 	}
+}
 
-	set_delayed_regs(ppu);
-	clear_regs(ppu);
+// Works out the visible pixels of a scanline from `line`, drawing them into
+// `row` if given, and returns whether there was a sprite 0 hit on any of them.
+// Without a `row`, only enough is worked out to find a sprite 0 hit: since
+// sprite 0 always has the highest priority, that only takes its own pixels and
+// the background's.
+static bool
+draw_line (const line_input_t * nonnull line, uint16_t * nullable row)
+{
+	bool draw = row != NULL;
 
-	memfetch(ppu);
-	shift_shiftregs(ppu);
-	load_shiftregs(ppu);
-	update_vram_addr(ppu);
-	spriteeval(ppu);
+	uint8_t bg_colors[SCANLINE_DEFERRED_DOTS];
+	uint8_t bg_palettes[SCANLINE_DEFERRED_DOTS];
+	for (size_t group = 0; group < SCANLINE_DEFERRED_DOTS / 8; group++) {
+		bg_pixels(line, group, &bg_colors[group * 8], &bg_palettes[group * 8]);
+	}
 
-	draw_pixel(ppu);
+	// Lay out the sprites into a line buffer, going from lowest to highest
+	// priority so that higher priority opaque pixels win. A sprite becomes
+	// active on the dot its x-position counts down to zero, and shifts out
+	// one pixel per dot from then on. Each entry holds the winning sprite's
+	// color along with everything about it that composition needs.
+	uint8_t sprite_line[SCANLINE_DEFERRED_DOTS];
+	memset(sprite_line, 0, sizeof(sprite_line));
 
-	move_cursor(ppu);
-}
+	for (size_t i = 8; i-- > 0;) {
+		if (!draw && i) {
+			continue;
+		}
 
-// TODO handle latent values in PPU registers
-static uint8_t
-read (ppu_t * nonnull ppu, uint16_t addr)
-{
-	uint8_t val = 0, *palloc = NULL;
-	uint16_t regnum = addr % 8;
-	switch (regnum) {
-	case 2: // PPUSTATUS
-		val |= ppu->vblank << 7;
-		val |= ppu->sprite0_hit << 6;
-		val |= ppu->sprite_overflow << 5;
+		size_t first_dot = line->sprite_xs[i] ? line->sprite_xs[i] : 1;
+		size_t nactive = SCANLINE_DEFERRED_DOTS + 1 - first_dot;
+		size_t nshifts = nactive < 8 ? nactive : 8;
 
-		ppu->write_toggle = false;
-		ppu->vblank = false;
-		break;
+		uint8_t info = (uint8_t)(line->sprite_attrs[i].palette << SPRITE_LINE_PALETTE_SHIFT);
+		if (line->sprite_attrs[i].behind_bg) {
+			info |= SPRITE_LINE_BEHIND_BG;
+		}
+		if (!i && line->has_sprite0) {
+			info |= SPRITE_LINE_SPRITE0;
+		}
 
-	case 4: // OAMDATA
-		val = ppu->oam[ppu->oam_addr];
-		break;
+		for (size_t k = 0; k < nshifts; k++) {
+			uint8_t color = (line->sprite_bmp_shiftregs[i] >> (k * 8)) & 0x3;
+			if (color) {
+				sprite_line[first_dot - 1 + k] = info | color;
+			}
+		}
+	}
 
-	case 7: // PPUDATA
-		if ((palloc = palette_loc(ppu, ppu->vram_addr))) {
-			val = *palloc;
+	// Compose and output every pixel, or just enough to find a hit
+	bool sprite0_hit = false;
+	for (size_t dotnum = 1; dotnum <= SCANLINE_DEFERRED_DOTS; dotnum++) {
+		if (!draw && sprite0_hit) {
+			break;
 		}
-		else {
-			val = ppu->vram_read_buf; // pass back the buffered value
-			if (ppu->vram_addr >= 0x3000 && ppu->vram_addr < 0x3F00) 
-				ppu->vram_read_buf = membus_read(ppu->bus, ppu->vram_addr - 0x1000);
-			else 
-				ppu->vram_read_buf = membus_read(ppu->bus, ppu->vram_addr); // update internal buffer
+
+		uint8_t sprite = sprite_line[dotnum - 1];
+		uint16_t paladdr = compose_pixel(line->mask, dotnum,
+						 bg_colors[dotnum - 1], bg_palettes[dotnum - 1],
+						 sprite & 0x3, sprite >> SPRITE_LINE_PALETTE_SHIFT & 0x3,
+						 sprite & SPRITE_LINE_BEHIND_BG, sprite & SPRITE_LINE_SPRITE0,
+						 &sprite0_hit);
+		if (draw) {
+			row[dotnum - 1] = line->palette_cache[paladdr % 32];
 		}
-		inc_vram_addr_rw(ppu);
-		break;
+	}
 
-	default:
-		val = 0xFF;
-		break;
+	return sprite0_hit;
+}
+
+// Hands batch number `batch` of logged scanlines off to the render workers
+static inline void
+push_batch (ppu_workers_t * nonnull workers, size_t batch)
+{
+	workers->batches[workers->nbatches++] = batch;
+	SDL_SemPost((SDL_sem * nonnull)workers->work);
+}
+
+// Notes that scanline `slnum` has been logged for the render workers, handing
+// off its batch once the last scanline of the batch has been logged
+static inline void
+log_line (ppu_workers_t * nonnull workers, size_t slnum)
+{
+	size_t batch = slnum / WORKER_BATCH_LINES;
+	if (workers->pending_batch != SIZE_MAX && workers->pending_batch != batch) {
+		push_batch(workers, workers->pending_batch);
 	}
+	workers->logged[slnum] = true;
+	workers->pending_batch = batch;
 
-	return val;
+	if (slnum % WORKER_BATCH_LINES == WORKER_BATCH_LINES - 1) {
+		push_batch(workers, batch);
+		workers->pending_batch = SIZE_MAX;
+	}
 }
 
+// Hands off any logged scanlines left, and waits for every one handed off to
+// be drawn into the frame
 static void
-write (ppu_t * nonnull ppu, uint16_t addr, uint8_t val)
+finish_lines (ppu_workers_t * nonnull workers)
 {
-	uint8_t * palloc = NULL;
-	uint16_t regnum = addr % 8;
-	switch (regnum) {
-	case 0: // PPUCTRL
-		ppu->tmp_nt_baseaddr     = val & 0x3;
-		ppu->vram_addr_inc       = !!(val & 0x4);
-		ppu->sprite_chr_baseaddr = !!(val & 0x8);
-		ppu->bg_chr_baseaddr     = !!(val & 0x10);
-		ppu->spritesize          = !!(val & 0x20);
+	if (workers->pending_batch != SIZE_MAX) {
+		push_batch(workers, workers->pending_batch);
+		workers->pending_batch = SIZE_MAX;
+	}
+
+	for (size_t i = 0; i < workers->nbatches; i++) {
+		SDL_SemWait((SDL_sem * nonnull)workers->done);
+	}
+	workers->nbatches = 0;
+	atomic_store(&workers->ntaken, 0);
+}
+
+// A render worker: draws batches of logged scanlines as they are handed off
+static int
+render_worker (void * data)
+{
+	ppu_workers_t * workers = data;
+
+	for (;;) {
+		SDL_SemWait((SDL_sem * nonnull)workers->work);
+		if (atomic_load(&workers->quit)) {
+			return 0;
+		}
+
+		size_t batch = workers->batches[atomic_fetch_add(&workers->ntaken, 1)];
+		for (size_t slnum = batch * WORKER_BATCH_LINES; slnum < (batch + 1) * WORKER_BATCH_LINES; slnum++) {
+			if (workers->logged[slnum]) {
+				draw_line(&workers->lines[slnum], workers->frame + slnum * PPU_OUTPUT_WIDTH);
+				workers->logged[slnum] = false;
+			}
+		}
+
+		SDL_SemPost((SDL_sem * nonnull)workers->done);
+	}
+}
+
+// Renders the visible part (dots 1 through 256) of the current scanline in one
+// go, leaving the cursor at dot 257. This is only valid if nothing has
+// interacted with the PPU since dot 1, since it takes every register to be
+// constant over the scanline. It leaves the PPU in exactly the state that the
+// per-dot state machine would have, so the two can be freely interleaved.
+static void
+render_scanline (ppu_t * nonnull ppu)
+{
+	// Any sprite 0 hit from the last scanline is noted on dot 1, and
+	// overflow is always due (if at all) within the visible dots
+	set_delayed_regs(ppu);
+	if (ppu->overflow_dotnum && ppu->overflow_dotnum <= SCANLINE_DEFERRED_DOTS) {
+		ppu->sprite_overflow = true;
+		ppu->overflow_dotnum = 0;
+	}
+
+	if (!(ppu->bg_en || ppu->sprite_en)) {
+		ppu->dotnum = SCANLINE_DEFERRED_DOTS + 1;
+		return;
+	}
+
+	// On skipped frames, pixels only need working out if they could still
+	// produce a sprite 0 hit. With render workers, drawn scanlines are
+	// logged for them to draw, and only checked for a hit here.
+	bool draw = !ppu->skip_frame;
+	bool find_sprite0_hit = ppu->scanline_has_sprite0 && !ppu->sprite0_hit;
+	bool capture = draw || find_sprite0_hit;
+
+	line_input_t local_line;
+	line_input_t * line = &local_line;
+	if (draw && ppu->workers) {
+		line = &ppu->workers->lines[ppu->slnum];
+	}
+
+	// Run the background shift registers across the scanline 8 dots at a
+	// time, fetching each tile one group of 8 dots ahead of when it's
+	// loaded
+	for (size_t group = 0; group < SCANLINE_DEFERRED_DOTS / 8; group++) {
+		if (group) {
+			shift_bg_shiftregs(ppu, 1);
+			reload_bg_shiftregs(ppu);
+			inc_coarse_x(ppu);
+		}
+		bg_fetch_tile(ppu);
+		if (capture) {
+			memcpy(line->bg[group].bmp_shiftregs, ppu->bg_bmp_shiftregs, sizeof(ppu->bg_bmp_shiftregs));
+			memcpy(line->bg[group].attr_shiftregs, ppu->bg_attr_shiftregs, sizeof(ppu->bg_attr_shiftregs));
+			line->bg[group].palette = ppu->bg_palette;
+		}
+		shift_bg_shiftregs(ppu, 7);
+	}
+
+	if (capture) {
+		line->fine_xscroll = ppu->fine_xscroll;
+		memcpy(line->sprite_bmp_shiftregs, ppu->sprite_bmp_shiftregs, sizeof(line->sprite_bmp_shiftregs));
+		memcpy(line->sprite_attrs, ppu->sprite_attrs, sizeof(line->sprite_attrs));
+		memcpy(line->sprite_xs, ppu->sprite_xs, sizeof(line->sprite_xs));
+		line->has_sprite0 = ppu->scanline_has_sprite0;
+		line->mask = ppu->mask;
+		memcpy(line->palette_cache, ppu->palette_cache, sizeof(line->palette_cache));
+	}
+
+	if (draw && ppu->workers) {
+		log_line(ppu->workers, ppu->slnum);
+		draw = false;
+	}
+	if (draw || find_sprite0_hit) {
+		uint16_t * row = draw ? ppu->frame + ppu->slnum * PPU_OUTPUT_WIDTH : NULL;
+		if (draw_line(line, row)) {
+			ppu->sprite0_hit_shouldset = true;
+		}
+	}
+
+	// Every sprite has been shifted out as far as it will be by dot 256
+	for (size_t i = 0; i < 8; i++) {
+		size_t first_dot = ppu->sprite_xs[i] ? ppu->sprite_xs[i] : 1;
+		size_t nactive = SCANLINE_DEFERRED_DOTS + 1 - first_dot;
+		size_t nshifts = nactive < 8 ? nactive : 8;
+
+		ppu->sprite_xs[i] = 0;
+		ppu->sprite_bmp_shiftregs[i] = nshifts < 8 ? ppu->sprite_bmp_shiftregs[i] >> (nshifts * 8) : 0;
+	}
+
+	// A sprite 0 hit on any visible dot becomes visible no later than dot
+	// 256, and so by the time anyone can look
+	if (ppu->sprite0_hit_shouldset) {
+		ppu->sprite0_hit = true;
+		ppu->sprite0_hit_shouldset = false;
+	}
+
+	ppu->dotnum = SCANLINE_DEFERRED_DOTS + 1;
+}
+
+// The things that can happen on a dot, as determined by its position alone.
+// Most of these are additionally only done while rendering is enabled.
+enum {
+	DOT_VBLANK           = 1 << 0,
+	DOT_SET_DELAYED_REGS = 1 << 1,
+	DOT_CLEAR_REGS       = 1 << 2,
+	DOT_BG_FETCH         = 1 << 3,
+	DOT_SPRITE_FETCH     = 1 << 4,
+	DOT_SHIFT            = 1 << 5,
+	DOT_RELOAD           = 1 << 6,
+	DOT_INC_X            = 1 << 7,
+	DOT_INC_Y            = 1 << 8,
+	DOT_COPY_X           = 1 << 9,
+	DOT_COPY_Y           = 1 << 10,
+	DOT_SPRITE_EVAL      = 1 << 11,
+	DOT_DRAW             = 1 << 12,
+	DOT_A12              = 1 << 13,
+};
+
+typedef uint16_t dot_events_t;
+
+// The kinds of scanline, as far as which events happen on their dots
+enum {
+	SL_VISIBLE,   // Scanlines 0 through 239
+	SL_IDLE,      // The post-render scanline and all but the first of vblank
+	SL_VBLANK,    // The first scanline of vblank
+	SL_PRERENDER, // Scanline 261
+	SL_NCLASSES,
+};
+
+#define SL_MAX_LENGTH 341
+
+// The events of every dot on the 341x262 grid, via each scanline's kind, and
+// for each dot, the first dot at or after it on the same kind of scanline that
+// has any events (or `SL_MAX_LENGTH` if there are none)
+static bool dot_events_built;
+static uint8_t sl_classes[262];
+static dot_events_t dot_events[SL_NCLASSES][SL_MAX_LENGTH];
+static uint16_t next_events[SL_NCLASSES][SL_MAX_LENGTH];
+
+// Works out the events of a dot on the given kind of scanline.
+//
+// The background shift registers aren't run outside of the visible and
+// pre-render scanlines. Their contents are entirely shifted out by dot 337 of
+// the pre-render scanline, before anything is drawn from them, so this can't
+// be observed, and it leaves vblank free of events.
+static inline dot_events_t
+events_for_dot (unsigned sl_class, size_t dotnum)
+{
+	dot_events_t events = 0;
+	bool rendered = sl_class == SL_VISIBLE || sl_class == SL_PRERENDER;
+	size_t phase = (dotnum - 1) % 8;
+
+	if (sl_class == SL_VBLANK && dotnum == 1) {
+		events |= DOT_VBLANK;
+	}
+	if (sl_class == SL_PRERENDER && dotnum == 1) {
+		events |= DOT_CLEAR_REGS;
+	}
+
+	// Sprite 0 hits and overflows only happen within the visible dots
+	if (sl_class == SL_VISIBLE && dotnum >= 1 && dotnum <= 257) {
+		events |= DOT_SET_DELAYED_REGS;
+	}
+
+	if (rendered) {
+		if (((dotnum >= 1 && dotnum <= 256) || (dotnum >= 321 && dotnum <= 336)) &&
+		    (phase == 1 || phase == 3 || phase == 5)) {
+			events |= DOT_BG_FETCH;
+		}
+		if (dotnum >= 257 && dotnum <= 320 && phase % 2) {
+			events |= DOT_SPRITE_FETCH;
+		}
+
+		if ((dotnum >= 2 && dotnum <= 257) || (dotnum >= 322 && dotnum <= 337)) {
+			events |= DOT_SHIFT;
+		}
+		if (!phase && dotnum != 1 && dotnum != 321 && !(dotnum >= 257 && dotnum <= 320)) {
+			events |= DOT_RELOAD;
+		}
+
+		// The dots that A12 can rise on (see `a12_rise_dotnum`), which
+		// already have fetches on them
+		if (dotnum == 260 || dotnum == 324) {
+			events |= DOT_A12;
+		}
+	}
+
+	if (sl_class == SL_VISIBLE) {
+		if ((dotnum >= 328 || dotnum <= 257) && dotnum != 1 && !phase) {
+			events |= DOT_INC_X;
+		}
+		if (dotnum == 257) {
+			events |= DOT_INC_Y;
+		}
+		if (dotnum == 258) {
+			events |= DOT_COPY_X;
+		}
+		if (dotnum == 0) {
+			events |= DOT_SPRITE_EVAL;
+		}
+		if (dotnum >= 1 && dotnum <= 256) {
+			events |= DOT_DRAW;
+		}
+	}
+
+	if (sl_class == SL_PRERENDER && dotnum >= 280 && dotnum <= 304) {
+		events |= DOT_COPY_Y;
+	}
+
+	return events;
+}
+
+static void
+build_dot_events (void)
+{
+	for (size_t slnum = 0; slnum < 262; slnum++) {
+		if (slnum < 240) {
+			sl_classes[slnum] = SL_VISIBLE;
+		}
+		else if (slnum == 241) {
+			sl_classes[slnum] = SL_VBLANK;
+		}
+		else if (slnum == 261) {
+			sl_classes[slnum] = SL_PRERENDER;
+		}
+		else {
+			sl_classes[slnum] = SL_IDLE;
+		}
+	}
+
+	for (unsigned sl_class = 0; sl_class < SL_NCLASSES; sl_class++) {
+		uint16_t next = SL_MAX_LENGTH;
+		for (size_t dotnum = SL_MAX_LENGTH; dotnum-- > 0;) {
+			dot_events[sl_class][dotnum] = events_for_dot(sl_class, dotnum);
+			if (dot_events[sl_class][dotnum]) {
+				next = (uint16_t)dotnum;
+			}
+			next_events[sl_class][dotnum] = next;
+		}
+	}
+
+	dot_events_built = true;
+}
+
+// The dot of a rendered scanline that the A12 address line rises on, or 0 if it
+// stays put. It goes high for fetches from the pattern table at $1000, so it
+// rises once a scanline if the background and sprites are fetched from
+// different tables: when sprite fetches start (on the first sprite's pattern
+// fetch), or when background fetches for the next scanline do. Unused sprite
+// slots fetch tile $FF, which for 8x16 sprites is at $1000.
+static inline size_t
+a12_rise_dotnum (const ppu_t * nonnull ppu)
+{
+	bool bg_high = ppu->bg_chr_baseaddr == PPU_CHR_BASEADDR_1000;
+	bool sprites_high = ppu->spritesize == PPU_SPRITESIZE_8x16 ||
+			    ppu->sprite_chr_baseaddr == PPU_CHR_BASEADDR_1000;
+
+	if (sprites_high && !bg_high) {
+		return 260;
+	}
+	if (bg_high && !sprites_high) {
+		return 324;
+	}
+	return 0;
+}
+
+// Runs the dot at the cursor, performing each of its events in order
+static void
+step (ppu_t * nonnull ppu)
+{
+	ppu->clk_countdown = PPU_CLKDIVISOR;
+
+	dot_events_t events = dot_events[sl_classes[ppu->slnum]][ppu->dotnum];
+	bool rendering = ppu->bg_en || ppu->sprite_en;
+
+	if (events & DOT_VBLANK) {
+		ppu->vblank = true;
+		if (ppu->nmi_en) {
+			mos6502_raise_nmi(ppu->cpu);
+		}
+		present_frame(ppu);
+	}
+
+	if (events & DOT_SET_DELAYED_REGS) {
+		set_delayed_regs(ppu);
+	}
+	if (events & DOT_CLEAR_REGS) {
+		clear_regs(ppu);
+	}
+
+	// Memory is only accessed when rendering is enabled
+	if (rendering) {
+		if (events & DOT_BG_FETCH) {
+			bg_memfetch(ppu);
+		}
+		if (events & DOT_SPRITE_FETCH) {
+			sprite_memfetch(ppu);
+		}
+		if ((events & DOT_A12) && ppu->a12_rise && ppu->dotnum == a12_rise_dotnum(ppu)) {
+			ppu->a12_rise((void * nonnull)ppu->a12_obj);
+		}
+	}
+
+	if (events & DOT_SHIFT) {
+		shift_bg_shiftregs(ppu, 1);
+	}
+	if (events & DOT_RELOAD) {
+		reload_bg_shiftregs(ppu);
+	}
+
+	// See [https://wiki.nesdev.com/w/index.php/PPU_scrolling] for more on
+	// how the VRAM address is updated during rendering
+	if (rendering) {
+		if (events & DOT_INC_X) {
+			inc_coarse_x(ppu);
+		}
+		if (events & DOT_INC_Y) {
+			inc_y(ppu);
+		}
+		if (events & DOT_COPY_X) {
+			ppu->vram_addr &= ~0x041F;
+			ppu->vram_addr |= ppu->tmp_vram_addr & 0x041F;
+		}
+		if (events & DOT_COPY_Y) {
+			ppu->vram_addr &= ~0x3BE0;
+			ppu->vram_addr |= ppu->tmp_vram_addr & 0x3BE0;
+		}
+		if (events & DOT_SPRITE_EVAL) {
+			spriteeval(ppu);
+		}
+		if (events & DOT_DRAW) {
+			draw_pixel(ppu);
+		}
+	}
+
+	move_cursor(ppu);
+}
+
+// Moves the cursor `ndots` dots ahead, without running any of them
+static inline void
+advance_cursor (ppu_t * nonnull ppu, size_t ndots)
+{
+	while (ndots) {
+		size_t remaining = sl_length(ppu) - ppu->dotnum;
+		if (ndots < remaining) {
+			ppu->dotnum += ndots;
+			return;
+		}
+		ndots -= remaining;
+
+		ppu->dotnum = 0;
+		if (++ppu->slnum == 262) {
+			ppu->slnum = 0;
+			ppu->framenum++;
+		}
+	}
+}
+
+// Counts the dots from the cursor up to the next dot with any events
+static inline size_t
+count_idle_dots (const ppu_t * nonnull ppu)
+{
+	size_t slnum = ppu->slnum;
+	size_t dotnum = ppu->dotnum;
+	size_t length = sl_length(ppu);
+	size_t nidle = 0;
+
+	for (;;) {
+		size_t next = next_events[sl_classes[slnum]][dotnum];
+		if (next < length) {
+			return nidle + next - dotnum;
+		}
+		nidle += length - dotnum;
+
+		// Every frame has events, so this ends within one
+		dotnum = 0;
+		slnum = (slnum + 1) % 262;
+		length = 341;
+	}
+}
+
+// Arranges for the timer to fire next on the next dot with any events, rather
+// than on each of the idle dots before it
+static inline void
+skip_idle_dots (ppu_t * nonnull ppu)
+{
+	if (LIKELY(dot_events[sl_classes[ppu->slnum]][ppu->dotnum])) {
+		return;
+	}
+
+	size_t nidle = count_idle_dots(ppu);
+	if (nidle) {
+		ppu->nidle_dots = nidle;
+		ppu->clk_countdown = (nidle + 1) * PPU_CLKDIVISOR;
+	}
+}
+
+// Renders the deferred part of the current scanline with the scanline
+// renderer, and also runs a copy of the PPU through the same dots with the
+// per-dot state machine (drawing into `verify_frame`) to check that the two
+// end up in the same state
+static void
+verify_scanline (ppu_t * nonnull ppu)
+{
+	ppu_t dot_ppu;
+	memcpy(&dot_ppu, ppu, sizeof(dot_ppu));
+	dot_ppu.frame = (uint16_t * nonnull)ppu->verify_frame;
+	for (size_t i = 0; i < SCANLINE_DEFERRED_DOTS; i++) {
+		step(&dot_ppu);
+	}
+
+	render_scanline(ppu);
+	ppu->verify_rows[ppu->slnum] = ppu->bg_en || ppu->sprite_en;
+
+	dot_ppu.frame         = ppu->frame;
+	dot_ppu.clk_countdown = ppu->clk_countdown;
+	memcpy(dot_ppu.verify_rows, ppu->verify_rows, sizeof(dot_ppu.verify_rows));
+	if (memcmp(&dot_ppu, ppu, sizeof(dot_ppu))) {
+		WARNING_PRINT("Frame %zu, scanline %zu: scanline renderer state differs from dot renderer state",
+			      ppu->framenum, ppu->slnum);
+	}
+}
+
+// The PPU's timer handler. With the scanline renderers, this skips over the
+// visible part of each visible scanline in virtual time, and renders it in one
+// go once it's been passed by. If anything interacts with the PPU in the
+// meantime, `ppu_sync()` replays the skipped dots with the per-dot state
+// machine instead. With any renderer, stretches of dots without any events
+// (such as most of vblank) are passed over in a single timer period.
+static void
+tick (ppu_t * nonnull ppu)
+{
+	if (ppu->nidle_dots) {
+		advance_cursor(ppu, ppu->nidle_dots);
+		ppu->nidle_dots = 0;
+	}
+
+	if (ppu->scanline_deferred) {
+		ppu->scanline_deferred = false;
+		if (ppu->renderer == PPU_RENDERER_VERIFY) {
+			verify_scanline(ppu);
+		}
+		else {
+			render_scanline(ppu);
+		}
+	}
+	else if (ppu->renderer != PPU_RENDERER_DOT && ppu->slnum < 240 && ppu->dotnum == 1) {
+		ppu->scanline_deferred = true;
+		ppu->sprite0_hit_predicted = false;
+		ppu->ndeferred_scanlines++;
+		ppu->clk_countdown = SCANLINE_DEFERRED_DOTS * PPU_CLKDIVISOR;
+		return;
+	}
+
+	step(ppu);
+	skip_idle_dots(ppu);
+}
+
+// Brings the PPU up to date with virtual time, as `ppu_sync()` does, noting
+// `cause` if it has to catch up partway through a deferred scanline
+static void
+catch_up (ppu_t * nonnull ppu, ppu_sync_cause_t cause)
+{
+	// Move the cursor over the idle dots that have passed by now. Those
+	// still to come stay skipped.
+	if (ppu->nidle_dots) {
+		uint64_t elapsed = (ppu->nidle_dots + 1) * PPU_CLKDIVISOR - ppu->clk_countdown;
+		size_t ndots = elapsed / PPU_CLKDIVISOR;
+		advance_cursor(ppu, ndots);
+		ppu->nidle_dots -= ndots;
+		return;
+	}
+
+	if (!ppu->scanline_deferred) {
+		return;
+	}
+	ppu->scanline_deferred = false;
+	ppu->nsyncs[cause]++;
+
+	// Run every dot that would have been run by now had we not deferred,
+	// and leave the countdown where the per-dot state machine would have
+	uint64_t elapsed = SCANLINE_DEFERRED_DOTS * PPU_CLKDIVISOR - ppu->clk_countdown;
+	for (uint64_t i = 0; i <= elapsed / PPU_CLKDIVISOR; i++) {
+		step(ppu);
+	}
+	ppu->clk_countdown = PPU_CLKDIVISOR - elapsed % PPU_CLKDIVISOR;
+}
+
+void
+ppu_set_a12_handler (ppu_t * ppu, void * obj, void * handler)
+{
+	ppu->a12_obj = rc_retain(obj);
+	ppu->a12_rise = handler;
+}
+
+void
+ppu_sync (ppu_t * ppu)
+{
+	catch_up(ppu, PPU_SYNC_MAPPER);
+}
+
+// The flag bits of PPUSTATUS
+static inline uint8_t
+status_bits (const ppu_t * nonnull ppu)
+{
+	return (uint8_t)(ppu->vblank << 7 | ppu->sprite0_hit << 6 | ppu->sprite_overflow << 5);
+}
+
+// Works out which dot of the deferred scanline will have a sprite 0 hit, if
+// any, without running any of its dots. Only sprite 0's own pixels matter, and
+// the background pixels under them: the first two tiles of those are already
+// in the shiftregs, and the rest are the ones that the coarse x-position will
+// be incremented to. Returns false if any of those would have to be read
+// through the bus, since a mapper might be watching it.
+static bool
+predict_sprite0_hit (ppu_t * nonnull ppu, size_t * nonnull hit_dotnum)
+{
+	*hit_dotnum = 0;
+	if (!ppu->scanline_has_sprite0 || !ppu->bg_en || !ppu->sprite_en) {
+		return true;
+	}
+
+	// Sprite 0 is laid out the same way that `draw_line` does, and its
+	// last pixel can't hit on dot 256
+	size_t first_dot = ppu->sprite_xs[0] ? ppu->sprite_xs[0] : 1;
+	uint64_t tiles[2] = {ppu->bg_bmp_shiftregs[0], ppu->bg_bmp_shiftregs[1]};
+	size_t fetched_tile = SIZE_MAX;
+	uint64_t fetched = 0;
+
+	for (size_t k = 0; k < 8 && first_dot + k < SCANLINE_DEFERRED_DOTS; k++) {
+		size_t dotnum = first_dot + k;
+		if (!((ppu->sprite_bmp_shiftregs[0] >> (k * 8)) & 0x3)) {
+			continue;
+		}
+		if (dotnum <= 8 && !(ppu->left_bg_en && ppu->left_sprite_en)) {
+			continue;
+		}
+
+		size_t pos = dotnum - 1 + ppu->fine_xscroll;
+		size_t tilenum = pos / 8;
+		uint64_t pixels;
+		if (tilenum < 2) {
+			pixels = tiles[tilenum];
+		}
+		else if (tilenum == fetched_tile) {
+			pixels = fetched;
+		}
+		else {
+			uint16_t vram_addr = ppu->vram_addr;
+			for (size_t i = 2; i < tilenum; i++) {
+				if ((vram_addr & 0x001F) == 31) {
+					vram_addr &= ~0x001F;
+					vram_addr ^= 0x0400;
+				}
+				else {
+					vram_addr += 1;
+				}
+			}
+
+			uint16_t addr = 0x2000 | (vram_addr & 0x0FFF);
+			if (!ppu->windows[addr / PPU_WINDOW_SIZE]) {
+				return false;
+			}
+			uint8_t tile = ppu->windows[addr / PPU_WINDOW_SIZE][addr % PPU_WINDOW_SIZE];
+
+			uint16_t bmp_addr = ppu->bg_chr_baseaddr == PPU_CHR_BASEADDR_1000 ? 0x1000 : 0x0000;
+			bmp_addr += tile * 16 + (vram_addr >> 12);
+			if (!ppu->chr_tiles[bmp_addr / 16].valid && !ppu->windows[bmp_addr / PPU_WINDOW_SIZE]) {
+				return false;
+			}
+
+			pixels = fetched = chr_row(ppu, bmp_addr, false);
+			fetched_tile = tilenum;
+		}
+
+		if ((pixels >> (pos % 8 * 8)) & 0x3) {
+			*hit_dotnum = dotnum;
+			return true;
+		}
+	}
+	return true;
+}
+
+// Works out what a PPUSTATUS read would return at this point of the deferred
+// scanline, as if it had been caught up with. Only the sprite 0 hit and sprite
+// overflow flags can change over the visible dots, the first on the dot after
+// the hit and the second on `overflow_dotnum`. Returns false if this can't be
+// predicted.
+static bool
+predict_status (ppu_t * nonnull ppu, uint8_t * nonnull val)
+{
+	if (!ppu->sprite0_hit_predicted) {
+		if (!predict_sprite0_hit(ppu, &ppu->sprite0_hit_dotnum)) {
+			return false;
+		}
+		ppu->sprite0_hit_predicted = true;
+	}
+
+	// The last dot that catching up would run
+	uint64_t elapsed = SCANLINE_DEFERRED_DOTS * PPU_CLKDIVISOR - ppu->clk_countdown;
+	size_t dotnum = 1 + elapsed / PPU_CLKDIVISOR;
+
+	bool sprite0_hit = ppu->sprite0_hit || ppu->sprite0_hit_shouldset ||
+		(ppu->sprite0_hit_dotnum && ppu->sprite0_hit_dotnum + 1 <= dotnum);
+	bool sprite_overflow = ppu->sprite_overflow ||
+		(ppu->overflow_dotnum && ppu->overflow_dotnum <= dotnum);
+
+	*val = (uint8_t)(ppu->vblank << 7 | sprite0_hit << 6 | sprite_overflow << 5);
+	return true;
+}
+
+// Checks a predicted PPUSTATUS value against what catching up a copy of the
+// PPU gives, for `PPU_RENDERER_VERIFY`
+static void
+verify_status (const ppu_t * nonnull ppu, uint8_t val)
+{
+	// The copy's dots can't be allowed to reach a mapper through the bus
+	for (size_t i = 0; i < PPU_NWINDOWS; i++) {
+		if (!ppu->windows[i]) {
+			return;
+		}
+	}
+
+	ppu_t dot_ppu;
+	memcpy(&dot_ppu, ppu, sizeof(dot_ppu));
+	dot_ppu.frame = (uint16_t * nonnull)ppu->verify_frame;
+	catch_up(&dot_ppu, PPU_SYNC_STATUS_READ);
+
+	if (status_bits(&dot_ppu) != val) {
+		WARNING_PRINT("Frame %zu, scanline %zu, dot %zu: predicted PPUSTATUS $%02X, but it was $%02X",
+			      ppu->framenum, ppu->slnum, dot_ppu.dotnum - 1, val, status_bits(&dot_ppu));
+	}
+}
+
+// The sync cause for a read of PPU register `regnum`
+static inline ppu_sync_cause_t
+read_sync_cause (uint16_t regnum)
+{
+	switch (regnum) {
+	case 2:
+		return PPU_SYNC_STATUS_READ;
+	case 4:
+		return PPU_SYNC_OAMDATA_READ;
+	case 7:
+		return PPU_SYNC_PPUDATA_READ;
+	default:
+		return PPU_SYNC_OTHER_READ;
+	}
+}
+
+// TODO handle latent values in PPU registers
+static uint8_t
+read (ppu_t * nonnull ppu, uint16_t addr)
+{
+	uint8_t val = 0, *palloc = NULL;
+	uint16_t regnum = addr % 8;
+
+	// Games poll PPUSTATUS in tight loops while waiting for a sprite 0 hit,
+	// so these reads leave deferred scanlines deferred where they can.
+	// Clearing the flags below doesn't affect rendering.
+	bool predicted = regnum == 2 && ppu->scanline_deferred && predict_status(ppu, &val);
+	if (predicted) {
+		ppu->npredicted_reads++;
+		if (ppu->renderer == PPU_RENDERER_VERIFY) {
+			verify_status(ppu, val);
+		}
+	}
+	else {
+		catch_up(ppu, read_sync_cause(regnum));
+	}
+
+	switch (regnum) {
+	case 2: // PPUSTATUS
+		if (!predicted) {
+			val = status_bits(ppu);
+		}
+
+		ppu->write_toggle = false;
+		ppu->vblank = false;
+		break;
+
+	case 4: // OAMDATA
+		val = ppu->oam[ppu->oam_addr];
+		break;
+
+	case 7: // PPUDATA
+		if ((palloc = palette_loc(ppu, ppu->vram_addr))) {
+			val = *palloc;
+		}
+		else {
+			val = ppu->vram_read_buf; // pass back the buffered value
+			if (ppu->vram_addr >= 0x3000 && ppu->vram_addr < 0x3F00) 
+				ppu->vram_read_buf = bus_read(ppu, ppu->vram_addr - 0x1000);
+			else 
+				ppu->vram_read_buf = bus_read(ppu, ppu->vram_addr); // update internal buffer
+		}
+		inc_vram_addr_rw(ppu);
+		break;
+
+	default:
+		val = 0xFF;
+		break;
+	}
+
+	return val;
+}
+
+static void
+write (ppu_t * nonnull ppu, uint16_t addr, uint8_t val)
+{
+	catch_up(ppu, PPU_SYNC_WRITE);
+
+	uint8_t * palloc = NULL;
+	uint16_t regnum = addr % 8;
+	switch (regnum) {
+	case 0: // PPUCTRL
+		ppu->tmp_nt_baseaddr     = val & 0x3;
+		ppu->vram_addr_inc       = !!(val & 0x4);
+		ppu->sprite_chr_baseaddr = !!(val & 0x8);
+		ppu->bg_chr_baseaddr     = !!(val & 0x10);
 		// ignore EXT mode select
 
+		if (ppu->spritesize != !!(val & 0x20)) {
+			ppu->spritesize = !!(val & 0x20);
+			rebuild_sprite_lines(ppu);
+		}
+
 		bool old_nmi_en = ppu->nmi_en;
 		ppu->nmi_en = !!(val & 0x80);
 		if (ppu->nmi_en && !old_nmi_en && ppu->vblank) {
@@ -706,6 +1737,7 @@ write (ppu_t * nonnull ppu, uint16_t addr, uint8_t val)
 
 	case 1: // PPUMASK
 		ppu->mask = val;
+		refresh_palette_cache(ppu);
 		break;
 
 	case 3: // OAMADDR
@@ -713,7 +1745,17 @@ write (ppu_t * nonnull ppu, uint16_t addr, uint8_t val)
 		break;
 
 	case 4: // OAMDATA
-		ppu->oam[ppu->oam_addr++] = val;
+		if (ppu->oam_addr % sizeof(ppu_sprite_t) == 0 && ppu->oam[ppu->oam_addr] != val) {
+			// Move the sprite to the scanlines at its new y-position
+			size_t spritenum = ppu->oam_addr / sizeof(ppu_sprite_t);
+			index_sprite(ppu, spritenum, false);
+			ppu->oam[ppu->oam_addr] = val;
+			index_sprite(ppu, spritenum, true);
+		}
+		else {
+			ppu->oam[ppu->oam_addr] = val;
+		}
+		ppu->oam_addr++;
 		break;
 
 	case 5: // PPUSCROLL
@@ -745,6 +1787,7 @@ write (ppu_t * nonnull ppu, uint16_t addr, uint8_t val)
 	case 7: // PPUDATA
 		if ((palloc = palette_loc(ppu, ppu->vram_addr))) {
 			*palloc = val;
+			refresh_palette_cache(ppu);
 		}
 		else {
 			// this is a mirror
@@ -752,6 +1795,12 @@ write (ppu_t * nonnull ppu, uint16_t addr, uint8_t val)
 				membus_write(ppu->bus, ppu->vram_addr - 0x1000, val);
 			else
 				membus_write(ppu->bus, ppu->vram_addr, val);
+
+			// The write may have landed in CHR RAM, so the cached
+			// copy of the tile has to be decoded again
+			if (ppu->vram_addr < 0x2000) {
+				ppu->chr_tiles[ppu->vram_addr / 16].valid = false;
+			}
 		}
 
 		inc_vram_addr_rw(ppu);
@@ -765,6 +1814,11 @@ write (ppu_t * nonnull ppu, uint16_t addr, uint8_t val)
 static void
 reset (ppu_t * nonnull ppu)
 {
+	// Scanlines logged before the reset still go to the current frame
+	if (ppu->workers) {
+		finish_lines((ppu_workers_t * nonnull)ppu->workers);
+	}
+
 	ppu->framenum      = 0;
 	ppu->clk_countdown = PPU_CLKDIVISOR;
 
@@ -772,6 +1826,12 @@ reset (ppu_t * nonnull ppu)
 	ppu->dotnum          = 0;
 	ppu->overflow_dotnum = 0;
 
+	ppu->scanline_deferred = false;
+	ppu->nidle_dots        = 0;
+
+	ppu->skip_frame = false;
+	ppu->nskipped   = 0;
+
 	ppu->mask = 0;
 
 	ppu->vram_addr_inc       = 0;
@@ -797,28 +1857,115 @@ reset (ppu_t * nonnull ppu)
 	ppu->fine_xscroll = 0;
 
 	memset(ppu->oam, 0x00, sizeof(ppu->oam));
+	rebuild_sprite_lines(ppu);
 	memset(ppu->palette_mem, 0x00, sizeof(ppu->palette_mem));
+	refresh_palette_cache(ppu);
+
+	// CHR RAM may be cleared along with everything else
+	for (size_t i = 0; i < PPU_CHR_NTILES; i++) {
+		ppu->chr_tiles[i].valid = false;
+	}
+}
+
+// Stops the render workers, once they've drawn everything handed off to them
+static void
+workers_free (ppu_workers_t * nonnull workers)
+{
+	if (workers->nthreads) {
+		finish_lines(workers);
+		atomic_store(&workers->quit, true);
+		for (size_t i = 0; i < workers->nthreads; i++) {
+			SDL_SemPost((SDL_sem * nonnull)workers->work);
+		}
+		for (size_t i = 0; i < workers->nthreads; i++) {
+			SDL_WaitThread(workers->threads[i], NULL);
+		}
+	}
+
+	if (workers->work) {
+		SDL_DestroySemaphore(workers->work);
+	}
+	if (workers->done) {
+		SDL_DestroySemaphore(workers->done);
+	}
+	free(workers);
+}
+
+// Starts `nthreads` render workers drawing into `ppu`'s frame. Returns NULL if
+// they can't all be started.
+static ppu_workers_t * nullable
+workers_new (ppu_t * nonnull ppu, size_t nthreads)
+{
+	ppu_workers_t * workers = calloc(1, sizeof(ppu_workers_t) + nthreads * sizeof(SDL_Thread *));
+	if (!workers) {
+		ERROR_PRINT("Could not allocate the render workers");
+		return NULL;
+	}
+
+	workers->frame = ppu->frame;
+	workers->pending_batch = SIZE_MAX;
+	atomic_init(&workers->ntaken, 0);
+	atomic_init(&workers->quit, false);
+
+	workers->work = SDL_CreateSemaphore(0);
+	workers->done = SDL_CreateSemaphore(0);
+	if (!workers->work || !workers->done) {
+		ERROR_PRINT("Could not create the render workers' semaphores: %s", SDL_GetError());
+		goto error;
+	}
+
+	for (; workers->nthreads < nthreads; workers->nthreads++) {
+		SDL_Thread * thread = SDL_CreateThread(render_worker, "ppu-render", workers);
+		if (!thread) {
+			ERROR_PRINT("Could not start a render worker: %s", SDL_GetError());
+			goto error;
+		}
+		workers->threads[workers->nthreads] = thread;
+	}
+
+	return workers;
+error:
+	workers_free(workers);
+	return NULL;
 }
 
 static void
 deinit (ppu_t * nonnull ppu)
 {
+	if (ppu->workers) {
+		workers_free((ppu_workers_t * nonnull)ppu->workers);
+	}
 	rc_release(ppu->bus);
-
-	SDL_DestroyTexture(ppu->tex);
-	SDL_DestroyRenderer(ppu->rend);
-	SDL_DestroyWindow(ppu->win);
-	SDL_QuitSubSystem(SDL_INIT_VIDEO);
+	rc_release(ppu->sink);
+	if (ppu->a12_obj) {
+		rc_release((void * nonnull)ppu->a12_obj);
+	}
+	free(ppu->frame);
+	free(ppu->verify_frame);
+	free(ppu->chr_tiles);
 }
 
 ppu_t *
-ppu_new (reset_manager_t * rm, mos6502_t * cpu, int scale)
+ppu_new (reset_manager_t * rm, mos6502_t * cpu, const ppu_options_t * opts)
 {
+	if (!dot_events_built) {
+		build_dot_events();
+	}
+
 	ppu_t * ppu = rc_alloc(sizeof(ppu_t), deinit);
 	reset_manager_add_device(rm, ppu, reset);
-	timekeeper_add_timer(cpu->tk, ppu, step, &ppu->clk_countdown);
+	timekeeper_add_timer(cpu->tk, ppu, tick, &ppu->clk_countdown);
 
 	ppu->cpu = cpu;
+	ppu->sink = rc_retain(opts->sink);
+	ppu->renderer = opts->renderer;
+	ppu->frame_interval = opts->frame_interval;
+	ppu->adaptive_skip = opts->adaptive_skip;
+	if (ppu->renderer == PPU_RENDERER_VERIFY && (ppu->frame_interval > 1 || ppu->adaptive_skip)) {
+		WARNING_PRINT("Frame skipping is disabled while verifying the renderer");
+		ppu->frame_interval = 0;
+		ppu->adaptive_skip = false;
+	}
 
 	membus_t * nullable bus = membus_new(rm);
 	if (!bus) {
@@ -826,59 +1973,47 @@ ppu_new (reset_manager_t * rm, mos6502_t * cpu, int scale)
 	}
 	ppu->bus = (membus_t * nonnull)bus;
 
-	if (SDL_InitSubSystem(SDL_INIT_VIDEO)) {
-		ERROR_PRINT("Could not init SDL video: %s", SDL_GetError());
-		goto initerror;
+	uint16_t * nullable frame = malloc(PPU_OUTPUT_WIDTH * PPU_OUTPUT_HEIGHT * sizeof(uint16_t));
+	if (!frame) {
+		ERROR_PRINT("Could not allocate a frame");
+		goto allocerror;
 	}
-
-	ppu->win = SDL_CreateWindow(
-		"Hawknest",
-		SDL_WINDOWPOS_CENTERED,
-		SDL_WINDOWPOS_CENTERED,
-		PPU_OUTPUT_WIDTH * scale,
-		PPU_OUTPUT_HEIGHT * scale,
-		SDL_WINDOW_ALLOW_HIGHDPI);
-
-	if (!ppu->win) {
-		ERROR_PRINT("Could not create window: %s", SDL_GetError());
-		goto winerror;
+	ppu->frame = (uint16_t * nonnull)frame;
+	for (size_t i = 0; i < PPU_OUTPUT_WIDTH * PPU_OUTPUT_HEIGHT; i++) {
+		ppu->frame[i] = PPU_PIXEL_BLANK;
 	}
 
-	ppu->rend = SDL_CreateRenderer(ppu->win, -1, SDL_RENDERER_PRESENTVSYNC);
-	if (!ppu->rend) {
-		ERROR_PRINT("Could not create renderer: %s", SDL_GetError());
-		goto renderror;
+	ppu_chr_tile_t * nullable chr_tiles = calloc(PPU_CHR_NTILES, sizeof(ppu_chr_tile_t));
+	if (!chr_tiles) {
+		ERROR_PRINT("Could not allocate the CHR tile cache");
+		goto allocerror;
 	}
+	ppu->chr_tiles = (ppu_chr_tile_t * nonnull)chr_tiles;
 
-	// Make sure the texture stays pixelated if `scale > 1`.
-	SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "nearest");
-
-	// Create the texture, setting the access mode to `STREAMING` so that
-	// we can efficiently replace its contents.
-	ppu->tex = SDL_CreateTexture(
-		ppu->rend,
-		SDL_PIXELFORMAT_RGBA32,
-		SDL_TEXTUREACCESS_STREAMING,
-		PPU_OUTPUT_WIDTH,
-		PPU_OUTPUT_HEIGHT);
+	if (ppu->renderer == PPU_RENDERER_PARALLEL) {
+		size_t nthreads = opts->nrender_threads;
+		if (!nthreads) {
+			int ncpus = SDL_GetCPUCount();
+			nthreads = ncpus > 1 ? (size_t)ncpus - 1 : 1;
+		}
 
-	if (!ppu->tex) {
-		ERROR_PRINT("Could not create texture: %s", SDL_GetError());
-		goto texerror;
+		ppu->workers = workers_new(ppu, nthreads);
+		if (!ppu->workers) {
+			goto allocerror;
+		}
 	}
 
-	int pitch;
-	SDL_LockTexture(ppu->tex, NULL, (void **)&ppu->texdata, &pitch);
-	ppu->texpitch = (size_t)pitch;
+	if (ppu->renderer == PPU_RENDERER_VERIFY) {
+		ppu->verify_frame = calloc(PPU_OUTPUT_WIDTH * PPU_OUTPUT_HEIGHT, sizeof(uint16_t));
+		if (!ppu->verify_frame) {
+			ERROR_PRINT("Could not allocate a frame for renderer verification");
+			goto allocerror;
+		}
+	}
 
 	return ppu;
-texerror:
-	SDL_DestroyRenderer(ppu->rend);
-renderror:
-	SDL_DestroyWindow(ppu->win);
-winerror:
+allocerror:
 	rc_release(ppu);
-	SDL_QuitSubSystem(SDL_INIT_VIDEO);
 initerror:
 	return NULL;
 }
@@ -891,3 +2026,107 @@ ppu_map (ppu_t * ppu)
 		membus_set_write_handler(ppu->cpu->bus, i, ppu, 0, write);
 	}
 }
+
+void
+ppu_load_palette_rgba (ppu_t * ppu)
+{
+	for (size_t i = 0; i < PPU_NCOLORS; i++) {
+		uint8_t rgba[4] = {ppu->palette_srgb[i][0], ppu->palette_srgb[i][1], ppu->palette_srgb[i][2], 255};
+		memcpy(&ppu->palette_rgba[i], rgba, sizeof(rgba));
+	}
+	ppu->palette_rgba[PPU_PIXEL_BLANK] = 0;
+}
+
+// Converts one row of `frame` pixels into RGBA32 pixels through `palette`,
+// eight or four pixels at a time where the target supports it
+static inline void
+row_to_rgba (const uint32_t * nonnull palette, const uint16_t * nonnull src, uint8_t * nonnull dst)
+{
+	size_t x = 0;
+#if defined(__AVX2__)
+	for (; x + 8 <= PPU_OUTPUT_WIDTH; x += 8) {
+		__m256i idx = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(src + x)));
+		__m256i rgba = _mm256_i32gather_epi32((const int *)palette, idx, 4);
+		_mm256_storeu_si256((__m256i *)(dst + x * 4), rgba);
+	}
+#elif defined(__SSE4_1__)
+	for (; x + 4 <= PPU_OUTPUT_WIDTH; x += 4) {
+		__m128i idx = _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i *)(src + x)));
+		__m128i rgba = _mm_setr_epi32((int)palette[_mm_extract_epi32(idx, 0)],
+					      (int)palette[_mm_extract_epi32(idx, 1)],
+					      (int)palette[_mm_extract_epi32(idx, 2)],
+					      (int)palette[_mm_extract_epi32(idx, 3)]);
+		_mm_storeu_si128((__m128i *)(dst + x * 4), rgba);
+	}
+#endif
+	for (; x < PPU_OUTPUT_WIDTH; x++) {
+		memcpy(dst + x * 4, &palette[src[x]], sizeof(*palette));
+	}
+}
+
+void
+ppu_frame_to_rgba (const uint32_t * palette_rgba, const uint16_t * frame, uint8_t * dst, size_t pitch)
+{
+	for (size_t row = 0; row < PPU_OUTPUT_HEIGHT; row++) {
+		row_to_rgba(palette_rgba, frame + row * PPU_OUTPUT_WIDTH, dst + row * pitch);
+	}
+}
+
+void
+ppu_chr_rebuild (ppu_t * ppu, uint16_t addr, uint16_t size)
+{
+	ASSERT(addr % 16 == 0 && size % 16 == 0);
+	ASSERT(addr + size <= PPU_CHR_NTILES * 16);
+
+	uint16_t window_start = addr / PPU_WINDOW_SIZE * PPU_WINDOW_SIZE;
+	uint16_t window_end = (addr + size + PPU_WINDOW_SIZE - 1) / PPU_WINDOW_SIZE * PPU_WINDOW_SIZE;
+	ppu_remap_windows(ppu, window_start, window_end - window_start);
+
+	for (size_t tilenum = addr / 16; tilenum < (size_t)(addr + size) / 16; tilenum++) {
+		decode_chr_tile(ppu, tilenum);
+	}
+}
+
+void
+ppu_remap_windows (ppu_t * ppu, uint16_t addr, uint16_t size)
+{
+	ASSERT(addr % PPU_WINDOW_SIZE == 0 && size % PPU_WINDOW_SIZE == 0);
+	ASSERT(addr + size <= PPU_NWINDOWS * PPU_WINDOW_SIZE);
+
+	for (size_t windownum = addr / PPU_WINDOW_SIZE; windownum < (size_t)(addr + size) / PPU_WINDOW_SIZE; windownum++) {
+		// The window can only be read directly if all of its pages are
+		// mapped, in order, to one contiguous region of memory
+		size_t pagenum = windownum * PPU_WINDOW_SIZE / MEMBUS_PAGESIZE;
+		const uint8_t * window = membus_read_memory(ppu->bus, pagenum);
+		for (size_t i = 1; window && i < PPU_WINDOW_SIZE / MEMBUS_PAGESIZE; i++) {
+			if (membus_read_memory(ppu->bus, pagenum + i) != window + i * MEMBUS_PAGESIZE) {
+				window = NULL;
+			}
+		}
+		ppu->windows[windownum] = window;
+	}
+}
+
+void
+ppu_print_stats (const ppu_t * ppu)
+{
+	size_t nsyncs = 0;
+	for (size_t i = 0; i < PPU_NSYNC_CAUSES; i++) {
+		nsyncs += ppu->nsyncs[i];
+	}
+
+	INFO_PRINT("PPU: %zu scanlines deferred, %zu caught up early (%.1f%%), %zu status reads predicted",
+		   ppu->ndeferred_scanlines,
+		   nsyncs,
+		   ppu->ndeferred_scanlines ? 100.0 * (double)nsyncs / (double)ppu->ndeferred_scanlines : 0.0,
+		   ppu->npredicted_reads);
+	if (nsyncs) {
+		INFO_PRINT("  by reads of $2002: %zu, $2004: %zu, $2007: %zu, others: %zu; by writes: %zu; by the mapper: %zu",
+			   ppu->nsyncs[PPU_SYNC_STATUS_READ],
+			   ppu->nsyncs[PPU_SYNC_OAMDATA_READ],
+			   ppu->nsyncs[PPU_SYNC_PPUDATA_READ],
+			   ppu->nsyncs[PPU_SYNC_OTHER_READ],
+			   ppu->nsyncs[PPU_SYNC_WRITE],
+			   ppu->nsyncs[PPU_SYNC_MAPPER]);
+	}
+}
@@ -0,0 +1,443 @@
+#include <rc.h>
+#include <base.h>
+#include <fileio.h>
+#include <nes/ppu.h>
+#include <nes/audiosink.h>
+#include <nes/recorder.h>
+#include <SDL2/SDL.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+
+// The number of frames and sample batches that can be waiting for the writer
+// thread before more are dropped
+#define RECORDER_NFRAME_SLOTS 16
+#define RECORDER_NSAMPLE_SLOTS 64
+
+// The most samples a single sample slot holds. Larger batches from the APU are
+// split across several slots.
+#define RECORDER_SLOT_NSAMPLES 1024
+
+// The NTSC frame rate, as a fraction
+#define Y4M_FRAMERATE "F60099:1000"
+
+// A bounded single-producer, single-consumer queue over preallocated slots.
+// The producer only advances `head`, and the consumer (the writer thread) only
+// advances `tail`. Frames are produced by the emulation thread and samples by
+// the APU synthesis thread, so each queue still has exactly one producer.
+typedef struct record_queue {
+	uint8_t * nullable /*owned*/ slots;
+	size_t slot_size;
+	size_t nslots;
+
+	atomic_size_t head;
+	atomic_size_t tail;
+	atomic_size_t ndropped;
+} record_queue_t;
+
+// Each slot also carries how much was dropped (or skipped) just before it, so
+// that the writer thread can fill the gap in its place and keep video and
+// audio in step with each other
+typedef struct frame_slot {
+	size_t nskipped;
+	uint16_t frame[PPU_OUTPUT_WIDTH * PPU_OUTPUT_HEIGHT];
+} frame_slot_t;
+
+typedef struct sample_slot {
+	size_t nskipped;
+	size_t nsamples;
+	float samples[RECORDER_SLOT_NSAMPLES];
+} sample_slot_t;
+
+typedef struct recorder {
+	framesink_t sink;
+
+	framesink_t * nonnull /*strong*/ next;
+
+	char * nullable /*owned*/ video_path;
+	char * nullable /*owned*/ audio_path;
+	FILE * nullable /*owned*/ video;
+	FILE * nullable /*owned*/ audio;
+	uint32_t sample_rate;
+
+	record_queue_t frames;
+	record_queue_t sample_batches;
+
+	SDL_Thread * nullable /*owned*/ thread;
+	SDL_sem * nullable /*owned*/ work;
+	atomic_bool running;
+
+	// Written once by the emulation thread, before the first frame is
+	// queued, and then only read by the writer thread
+	bool have_palette;
+	uint32_t palette_rgba[PPU_NCOLORS + 1];
+
+	// How many frames and samples have been dropped (or frames skipped by
+	// the PPU) since the last ones that were queued. Each is only touched by
+	// its queue's producer: the emulation thread for frames, and the APU
+	// synthesis thread for samples
+	size_t nframes_skipped;
+	size_t nsamples_skipped;
+
+	// Only touched by the writer thread
+	bool have_yuv;
+	uint8_t palette_yuv[PPU_NCOLORS + 1][3];
+	uint8_t planes[3][PPU_OUTPUT_WIDTH * PPU_OUTPUT_HEIGHT];
+	size_t nframes_written;
+	size_t nsamples_written;
+} recorder_t;
+
+static inline int
+queue_init (record_queue_t * nonnull q, size_t slot_size, size_t nslots)
+{
+	q->slots = calloc(nslots, slot_size);
+	if (!q->slots) {
+		return -1;
+	}
+	q->slot_size = slot_size;
+	q->nslots = nslots;
+	atomic_init(&q->head, 0);
+	atomic_init(&q->tail, 0);
+	atomic_init(&q->ndropped, 0);
+	return 0;
+}
+
+// Returns the next free slot for the producer to fill, or NULL if the queue is
+// full. The slot is handed over to the consumer with `queue_push()`.
+static inline void * nullable
+queue_reserve (record_queue_t * nonnull q)
+{
+	size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+	size_t tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+	if (head - tail == q->nslots) {
+		return NULL;
+	}
+	return q->slots + (head % q->nslots) * q->slot_size;
+}
+
+static inline void
+queue_push (record_queue_t * nonnull q)
+{
+	size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+	atomic_store_explicit(&q->head, head + 1, memory_order_release);
+}
+
+// Returns the oldest filled slot for the consumer, or NULL if the queue is
+// empty. The slot is given back to the producer with `queue_pop()`.
+static inline const void * nullable
+queue_peek (record_queue_t * nonnull q)
+{
+	size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+	size_t head = atomic_load_explicit(&q->head, memory_order_acquire);
+	if (head == tail) {
+		return NULL;
+	}
+	return q->slots + (tail % q->nslots) * q->slot_size;
+}
+
+static inline void
+queue_pop (record_queue_t * nonnull q)
+{
+	size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+	atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+}
+
+// Computes the BT.601 (limited range) YUV color of every frame pixel value
+static void
+build_palette_yuv (recorder_t * nonnull rec)
+{
+	for (size_t i = 0; i < PPU_NCOLORS + 1; i++) {
+		uint8_t rgba[4];
+		memcpy(rgba, &rec->palette_rgba[i], sizeof(rgba));
+		int r = rgba[0], g = rgba[1], b = rgba[2];
+
+		rec->palette_yuv[i][0] = (uint8_t)(16 + ((66 * r + 129 * g + 25 * b + 128) >> 8));
+		rec->palette_yuv[i][1] = (uint8_t)(128 + ((-38 * r - 74 * g + 112 * b + 128) >> 8));
+		rec->palette_yuv[i][2] = (uint8_t)(128 + ((112 * r - 94 * g - 18 * b + 128) >> 8));
+	}
+	rec->have_yuv = true;
+}
+
+// Writes the last frame converted into `planes` again, `n` times over
+static void
+repeat_frame (recorder_t * nonnull rec, size_t n)
+{
+	FILE * f = (FILE * nonnull)rec->video;
+	for (size_t i = 0; i < n; i++) {
+		fputs("FRAME\n", f);
+		fwrite(rec->planes, sizeof(rec->planes), 1, f);
+	}
+	rec->nframes_written += n;
+}
+
+// Writes `n` samples of silence
+static void
+write_silence (recorder_t * nonnull rec, size_t n)
+{
+	static const float zeros[RECORDER_SLOT_NSAMPLES];
+	while (n) {
+		size_t chunk = n < RECORDER_SLOT_NSAMPLES ? n : RECORDER_SLOT_NSAMPLES;
+		fwrite(zeros, sizeof(float), chunk, (FILE * nonnull)rec->audio);
+		rec->nsamples_written += chunk;
+		n -= chunk;
+	}
+}
+
+// Writes `frame`, after repeating the previous frame in place of the
+// `nskipped` that were dropped before it (or `frame` itself, if they were
+// dropped before any was written)
+static void
+write_frame (recorder_t * nonnull rec, const uint16_t * nonnull frame, size_t nskipped)
+{
+	if (!rec->have_yuv) {
+		build_palette_yuv(rec);
+	}
+
+	if (rec->nframes_written) {
+		repeat_frame(rec, nskipped);
+		nskipped = 0;
+	}
+
+	for (size_t i = 0; i < PPU_OUTPUT_WIDTH * PPU_OUTPUT_HEIGHT; i++) {
+		const uint8_t * yuv = rec->palette_yuv[frame[i]];
+		rec->planes[0][i] = yuv[0];
+		rec->planes[1][i] = yuv[1];
+		rec->planes[2][i] = yuv[2];
+	}
+
+	repeat_frame(rec, nskipped + 1);
+}
+
+// Empties both queues to disk
+static void
+drain (recorder_t * nonnull rec)
+{
+	bool wrote = false;
+
+	const frame_slot_t * frame;
+	while ((frame = queue_peek(&rec->frames))) {
+		write_frame(rec, frame->frame, frame->nskipped);
+		queue_pop(&rec->frames);
+		wrote = true;
+	}
+
+	bool wrote_samples = false;
+	const sample_slot_t * slot;
+	while ((slot = queue_peek(&rec->sample_batches))) {
+		write_silence(rec, slot->nskipped);
+		fwrite(slot->samples, sizeof(float), slot->nsamples, (FILE * nonnull)rec->audio);
+		rec->nsamples_written += slot->nsamples;
+		queue_pop(&rec->sample_batches);
+		wrote_samples = true;
+	}
+
+	// Keep the WAV header current, so that the file stays playable even if
+	// the emulator exits without shutting the recorder down
+	if (wrote_samples) {
+		audiosink_write_wav_header((FILE * nonnull)rec->audio, rec->sample_rate, rec->nsamples_written * sizeof(float));
+	}
+
+	if (wrote || wrote_samples) {
+		fflush((FILE * nonnull)rec->video);
+		fflush((FILE * nonnull)rec->audio);
+	}
+}
+
+static int
+writer_thread (void * nonnull data)
+{
+	recorder_t * rec = data;
+
+	while (atomic_load(&rec->running)) {
+		SDL_SemWait((SDL_sem * nonnull)rec->work);
+		drain(rec);
+	}
+
+	// Write out whatever was queued before shutdown
+	drain(rec);
+	return 0;
+}
+
+static void
+recorder_present (framesink_t * nonnull sink, const ppu_t * nonnull ppu)
+{
+	recorder_t * rec = (recorder_t *)sink;
+
+	if (!rec->have_palette) {
+		memcpy(rec->palette_rgba, ppu->palette_rgba, sizeof(rec->palette_rgba));
+		rec->have_palette = true;
+	}
+
+	frame_slot_t * slot = queue_reserve(&rec->frames);
+	if (slot) {
+		slot->nskipped = rec->nframes_skipped;
+		memcpy(slot->frame, ppu->frame, sizeof(slot->frame));
+		queue_push(&rec->frames);
+		rec->nframes_skipped = 0;
+		SDL_SemPost((SDL_sem * nonnull)rec->work);
+	}
+	else {
+		atomic_fetch_add(&rec->frames.ndropped, 1);
+		rec->nframes_skipped++;
+	}
+
+	framesink_present(rec->next, ppu);
+}
+
+// Skipped frames are filled in like dropped ones, by repeating the last frame,
+// so that the video keeps time with the audio
+static void
+recorder_skip (framesink_t * nonnull sink, const ppu_t * nonnull ppu)
+{
+	recorder_t * rec = (recorder_t *)sink;
+	rec->nframes_skipped++;
+	framesink_skip(rec->next, ppu);
+}
+
+void
+recorder_push_samples (void * ctx, const float * samples, size_t nsamples)
+{
+	recorder_t * rec = ctx;
+
+	while (nsamples) {
+		size_t n = nsamples < RECORDER_SLOT_NSAMPLES ? nsamples : RECORDER_SLOT_NSAMPLES;
+
+		sample_slot_t * slot = queue_reserve(&rec->sample_batches);
+		if (!slot) {
+			atomic_fetch_add(&rec->sample_batches.ndropped, nsamples);
+			rec->nsamples_skipped += nsamples;
+			break;
+		}
+		slot->nskipped = rec->nsamples_skipped;
+		slot->nsamples = n;
+		memcpy(slot->samples, samples, n * sizeof(float));
+		queue_push(&rec->sample_batches);
+		rec->nsamples_skipped = 0;
+
+		samples += n;
+		nsamples -= n;
+	}
+
+	SDL_SemPost((SDL_sem * nonnull)rec->work);
+}
+
+framesink_t *
+recorder_sink (recorder_t * recorder)
+{
+	return &recorder->sink;
+}
+
+static inline char * nullable
+path_with_ext (const char * nonnull path, const char * nonnull ext)
+{
+	size_t size = strlen(path) + strlen(ext) + 1;
+	char * result = malloc(size);
+	if (result) {
+		snprintf(result, size, "%s%s", path, ext);
+	}
+	return result;
+}
+
+static void
+deinit (recorder_t * nonnull rec)
+{
+	if (rec->thread) {
+		atomic_store(&rec->running, false);
+		SDL_SemPost((SDL_sem * nonnull)rec->work);
+		SDL_WaitThread(rec->thread, NULL);
+
+		// Fill in for whatever was dropped after the last frame and
+		// samples that were queued
+		if (rec->nframes_skipped && rec->nframes_written) {
+			repeat_frame(rec, rec->nframes_skipped);
+		}
+		if (rec->nsamples_skipped) {
+			write_silence(rec, rec->nsamples_skipped);
+			audiosink_write_wav_header((FILE * nonnull)rec->audio, rec->sample_rate, rec->nsamples_written * sizeof(float));
+		}
+
+		INFO_PRINT("Recorded %zu frames to %s and %zu samples to %s",
+			   rec->nframes_written, rec->video_path,
+			   rec->nsamples_written, rec->audio_path);
+
+		size_t nframes_dropped = atomic_load(&rec->frames.ndropped);
+		size_t nsamples_dropped = atomic_load(&rec->sample_batches.ndropped);
+		if (nframes_dropped || nsamples_dropped) {
+			WARNING_PRINT("Dropped %zu frames and %zu samples while recording, which were filled in with repeated frames and silence",
+				      nframes_dropped, nsamples_dropped);
+		}
+	}
+
+	if (rec->work) {
+		SDL_DestroySemaphore((SDL_sem * nonnull)rec->work);
+	}
+	if (rec->video) {
+		fclose((FILE * nonnull)rec->video);
+	}
+	if (rec->audio) {
+		fclose((FILE * nonnull)rec->audio);
+	}
+	free(rec->video_path);
+	free(rec->audio_path);
+	free(rec->frames.slots);
+	free(rec->sample_batches.slots);
+	rc_release(rec->next);
+}
+
+recorder_t *
+recorder_new (const char * path, uint32_t sample_rate, framesink_t * next)
+{
+	recorder_t * rec = rc_alloc(sizeof(recorder_t), deinit);
+	rec->sink.present = recorder_present;
+	rec->sink.skip = recorder_skip;
+	rec->next = rc_retain(next);
+	rec->sample_rate = sample_rate;
+
+	if (queue_init(&rec->frames, sizeof(frame_slot_t), RECORDER_NFRAME_SLOTS) ||
+	    queue_init(&rec->sample_batches, sizeof(sample_slot_t), RECORDER_NSAMPLE_SLOTS)) {
+		ERROR_PRINT("Could not allocate the recording queues");
+		goto error;
+	}
+
+	rec->video_path = path_with_ext(path, ".y4m");
+	rec->audio_path = path_with_ext(path, ".wav");
+	if (!rec->video_path || !rec->audio_path) {
+		ERROR_PRINT("Could not allocate recording paths");
+		goto error;
+	}
+
+	rec->video = try_fopen((char * nonnull)rec->video_path, "wb");
+	if (!rec->video) {
+		goto error;
+	}
+	rec->audio = try_fopen((char * nonnull)rec->audio_path, "wb");
+	if (!rec->audio) {
+		goto error;
+	}
+
+	fprintf((FILE * nonnull)rec->video, "YUV4MPEG2 W%d H%d " Y4M_FRAMERATE " Ip A8:7 C444\n",
+		PPU_OUTPUT_WIDTH, PPU_OUTPUT_HEIGHT);
+	if (audiosink_write_wav_header((FILE * nonnull)rec->audio, rec->sample_rate, 0)) {
+		ERROR_PRINT("Could not write to %s", rec->audio_path);
+		goto error;
+	}
+
+	rec->work = SDL_CreateSemaphore(0);
+	if (!rec->work) {
+		ERROR_PRINT("Could not create a semaphore: %s", SDL_GetError());
+		goto error;
+	}
+
+	atomic_init(&rec->running, true);
+	rec->thread = SDL_CreateThread(writer_thread, "recorder", rec);
+	if (!rec->thread) {
+		ERROR_PRINT("Could not create the recording thread: %s", SDL_GetError());
+		goto error;
+	}
+
+	return rec;
+error:
+	rc_release(rec);
+	return NULL;
+}
@@ -0,0 +1,143 @@
+#include <rc.h>
+#include <base.h>
+#include <nes/ppu.h>
+#include <nes/shmsink.h>
+
+#include <time.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+typedef struct shmsink {
+	framesink_t sink;
+
+	framesink_t * nonnull /*strong*/ next;
+
+	char * nullable /*owned*/ name;
+	shm_frames_t * nullable /*owned*/ frames;
+	bool have_palette;
+} shmsink_t;
+
+static inline uint64_t
+monotonic_ns (void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// Writes the frame from `ppu` into the next slot, under the slot's seqlock
+static void
+shmsink_present (framesink_t * nonnull sink, const ppu_t * nonnull ppu)
+{
+	shmsink_t * shm = (shmsink_t *)sink;
+	shm_frames_t * frames = (shm_frames_t * nonnull)shm->frames;
+
+	if (!shm->have_palette) {
+		memcpy(frames->palette_rgba, ppu->palette_rgba, sizeof(frames->palette_rgba));
+		shm->have_palette = true;
+	}
+
+	// Only this thread ever writes `npublished` and `seq`, so they can be
+	// read back plainly
+	uint64_t n = frames->npublished;
+	shm_frame_slot_t * slot = &frames->slots[n % SHM_FRAMES_NSLOTS];
+	uint32_t seq = slot->seq;
+
+	// Mark the slot as being written before touching any of it
+	__atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	slot->framenum = ppu->framenum;
+	slot->timestamp_ns = monotonic_ns();
+	if (frames->formats & SHM_FRAMES_INDEXED) {
+		memcpy(slot->indexed, ppu->frame, sizeof(slot->indexed));
+	}
+	if (frames->formats & SHM_FRAMES_RGBA) {
+		ppu_frame_to_rgba(ppu->palette_rgba, ppu->frame, (uint8_t *)slot->rgba, PPU_OUTPUT_WIDTH * sizeof(uint32_t));
+	}
+
+	__atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+	__atomic_store_n(&frames->npublished, n + 1, __ATOMIC_RELEASE);
+
+	framesink_present(shm->next, ppu);
+}
+
+// Consumers can tell skipped frames by the gaps in `framenum`, so they're
+// only passed on
+static void
+shmsink_skip (framesink_t * nonnull sink, const ppu_t * nonnull ppu)
+{
+	shmsink_t * shm = (shmsink_t *)sink;
+	framesink_skip(shm->next, ppu);
+}
+
+static void
+deinit (shmsink_t * nonnull shm)
+{
+	if (shm->frames) {
+		munmap(shm->frames, sizeof(shm_frames_t));
+		shm_unlink((char * nonnull)shm->name);
+	}
+	free(shm->name);
+	rc_release(shm->next);
+}
+
+framesink_t *
+shmsink_new (const char * name, uint32_t formats, framesink_t * next)
+{
+	shmsink_t * shm = rc_alloc(sizeof(shmsink_t), deinit);
+	shm->sink.present = shmsink_present;
+	shm->sink.skip = shmsink_skip;
+	shm->next = rc_retain(next);
+
+	// Portable shared memory object names start with a slash
+	size_t size = strlen(name) + 2;
+	shm->name = malloc(size);
+	if (!shm->name) {
+		ERROR_PRINT("Could not allocate a shared memory name");
+		goto error;
+	}
+	snprintf((char * nonnull)shm->name, size, "%s%s", name[0] == '/' ? "" : "/", name);
+	name = (char * nonnull)shm->name;
+
+	int fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		ERROR_PRINT("Could not open shared memory object '%s': %s", name, strerror(errno));
+		goto error;
+	}
+
+	if (ftruncate(fd, sizeof(shm_frames_t))) {
+		ERROR_PRINT("Could not size shared memory object '%s': %s", name, strerror(errno));
+		close(fd);
+		shm_unlink(name);
+		goto error;
+	}
+
+	void * map = mmap(NULL, sizeof(shm_frames_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		ERROR_PRINT("Could not map shared memory object '%s': %s", name, strerror(errno));
+		shm_unlink(name);
+		goto error;
+	}
+	shm->frames = map;
+
+	// The object starts out zeroed, so only the header needs filling in.
+	// The magic goes last, so that readers that check it see the rest.
+	shm_frames_t * frames = (shm_frames_t * nonnull)shm->frames;
+	frames->version = SHM_FRAMES_VERSION;
+	frames->width = PPU_OUTPUT_WIDTH;
+	frames->height = PPU_OUTPUT_HEIGHT;
+	frames->nslots = SHM_FRAMES_NSLOTS;
+	frames->formats = formats;
+	__atomic_store_n(&frames->magic, SHM_FRAMES_MAGIC, __ATOMIC_RELEASE);
+
+	return &shm->sink;
+error:
+	rc_release(shm);
+	return NULL;
+}
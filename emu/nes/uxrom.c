@@ -0,0 +1,41 @@
+#include <rc.h>
+#include <base.h>
+#include <nes/uxrom.h>
+#include <nes/mapper.h>
+
+// UxROM switches a 16K PRGROM bank into $8000-$BFFF, with the last bank fixed
+// at $C000-$FFFF. CHR is a single 8K bank (usually CHRRAM).
+static void
+reset (mapper_t * mapper)
+{
+	mapper_map_prg(mapper, 0, 0);
+	mapper_map_prg(mapper, 1, mapper_prg_nbanks(mapper) - 1);
+	mapper_map_chr(mapper, 0, 0);
+}
+
+// Any write to $8000-$FFFF selects the switchable bank
+static void
+reg_write (mapper_t * mapper, uint16_t addr, uint8_t val)
+{
+	(void)addr;
+	mapper_map_prg(mapper, 0, val);
+}
+
+static const mapper_ops_t ops = {
+	.name = "UxROM",
+	.prg_window_size = 0x4000,
+	.chr_window_size = 0x2000,
+	.reset = reset,
+	.write = reg_write,
+};
+
+int
+uxrom_setup (rominfo_t * info)
+{
+	mapper_t * cart = mapper_new(info, &ops, sizeof(mapper_t));
+	if (!cart) {
+		return -1;
+	}
+	rc_release(cart);
+	return 0;
+}
@@ -0,0 +1,113 @@
+#include <rc.h>
+#include <base.h>
+#include <romimage.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Every open image, so that identical ROMs can share a mapping
+static romimage_t * cache;
+
+// FNV-1a, taken a word at a time rather than a byte at a time, since every
+// open hashes the whole ROM
+static uint64_t
+hash_bytes (const uint8_t * bytes, size_t size)
+{
+	uint64_t hash = 0xCBF29CE484222325u;
+	size_t i = 0;
+	for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+		uint64_t word;
+		memcpy(&word, bytes + i, sizeof(word));
+		hash ^= word;
+		hash *= 0x100000001B3u;
+	}
+	for (; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 0x100000001B3u;
+	}
+	return hash;
+}
+
+static romimage_t *
+cache_find (const uint8_t * bytes, size_t size, uint64_t hash)
+{
+	for (romimage_t * image = cache; image; image = image->next) {
+		if (image->hash == hash &&
+		    image->size == size &&
+		    !memcmp(image->bytes, bytes, size)) {
+			return image;
+		}
+	}
+	return NULL;
+}
+
+static void
+deinit (romimage_t * image)
+{
+	for (romimage_t ** link = &cache; *link; link = &(*link)->next) {
+		if (*link == image) {
+			*link = image->next;
+			break;
+		}
+	}
+	munmap((void *)image->bytes, image->size);
+}
+
+romimage_t *
+romimage_open (const char * path)
+{
+	romimage_t * retval = NULL;
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		ERROR_PRINT("Error opening %s: %s", path, strerror(errno));
+		goto ret;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st)) {
+		ERROR_PRINT("Error reading %s: %s", path, strerror(errno));
+		goto close_fd;
+	}
+	if (st.st_size == 0) {
+		ERROR_PRINT("Unexpected EOF while reading %s", path);
+		goto close_fd;
+	}
+	size_t size = (size_t)st.st_size;
+
+	// Being private doesn't stop the ROM from changing under us: pages
+	// that we've never written to (which is all of them) still show later
+	// writes to the file, and once the file is truncated, fetches from
+	// past its new end raise SIGBUS. See the header on keeping ROM files
+	// intact.
+	void * map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		ERROR_PRINT("Could not map %s: %s", path, strerror(errno));
+		goto close_fd;
+	}
+
+	uint64_t hash = hash_bytes(map, size);
+	romimage_t * image = cache_find(map, size, hash);
+	if (image) {
+		munmap(map, size);
+		retval = rc_retain(image);
+		goto close_fd;
+	}
+
+	image = rc_alloc(sizeof(romimage_t), deinit);
+	image->bytes = map;
+	image->size = size;
+	image->hash = hash;
+	image->next = cache;
+	cache = image;
+	retval = image;
+
+close_fd:
+	close(fd);
+ret:
+	return retval;
+}
@@ -0,0 +1,148 @@
+#include <rc.h>
+#include <base.h>
+#include <memory.h>
+#include <savefile.h>
+#include <SDL2/SDL.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+typedef struct savefile {
+	uint8_t * nonnull bytes;
+	size_t size;
+
+	SDL_Thread * nullable /*owned*/ thread;
+	SDL_sem * nullable /*owned*/ stop;
+
+	struct savefile * nullable /*unowned*/ next;
+} savefile_t;
+
+// Every open save file, so that they can all be synced at exit. Since the
+// emulator exits from wherever it's asked to, saves are usually never
+// released.
+static savefile_t * saves;
+
+static void
+sync_all (void)
+{
+	for (savefile_t * save = saves; save; save = save->next) {
+		msync(save->bytes, save->size, MS_SYNC);
+	}
+}
+
+static int
+sync_thread (void * nonnull data)
+{
+	savefile_t * save = data;
+
+	while (SDL_SemWaitTimeout((SDL_sem * nonnull)save->stop, SAVEFILE_SYNC_INTERVAL_MS) == SDL_MUTEX_TIMEDOUT) {
+		msync(save->bytes, save->size, MS_SYNC);
+	}
+	return 0;
+}
+
+static void
+deinit (savefile_t * save)
+{
+	for (savefile_t ** link = &saves; *link; link = &(*link)->next) {
+		if (*link == save) {
+			*link = save->next;
+			break;
+		}
+	}
+
+	if (save->thread) {
+		SDL_SemPost((SDL_sem * nonnull)save->stop);
+		SDL_WaitThread(save->thread, NULL);
+	}
+	if (save->stop) {
+		SDL_DestroySemaphore((SDL_sem * nonnull)save->stop);
+	}
+
+	msync(save->bytes, save->size, MS_SYNC);
+	munmap(save->bytes, save->size);
+}
+
+memory_t *
+savefile_open (const char * path, size_t size)
+{
+	static bool registered_atexit = false;
+	memory_t * retval = NULL;
+
+	int fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd < 0) {
+		ERROR_PRINT("Error opening %s: %s", path, strerror(errno));
+		goto ret;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st)) {
+		ERROR_PRINT("Error reading %s: %s", path, strerror(errno));
+		goto close_fd;
+	}
+	size_t old_size = (size_t)st.st_size;
+	if (old_size && old_size != size) {
+		// e.g. a save from another emulator, with a header or a footer
+		WARNING_PRINT("%s is %zu bytes, but the cartridge has %zu bytes of battery-backed RAM", path, old_size, size);
+		if (old_size > size) {
+			WARNING_PRINT("  Only its first %zu bytes are used, as they are", size);
+		}
+		else {
+			WARNING_PRINT("  It's extended with bytes of $FF");
+		}
+	}
+	if (old_size < size && ftruncate(fd, (off_t)size)) {
+		ERROR_PRINT("Error resizing %s: %s", path, strerror(errno));
+		goto close_fd;
+	}
+
+	// The RAM is only as safe as the file: if another process truncates
+	// it while it's mapped, the next access to WRAM past its new end
+	// raises SIGBUS. Replacing it by renaming another file over it is
+	// harmless, but leaves this mapping saving to the old file.
+	void * map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		ERROR_PRINT("Could not map %s: %s", path, strerror(errno));
+		goto close_fd;
+	}
+
+	savefile_t * save = rc_alloc(sizeof(savefile_t), deinit);
+	save->bytes = map;
+	save->size = size;
+	if (old_size < size) {
+		memset(save->bytes + old_size, 0xFF, size - old_size);
+	}
+
+	save->stop = SDL_CreateSemaphore(0);
+	if (!save->stop) {
+		ERROR_PRINT("Could not create a semaphore: %s", SDL_GetError());
+		goto release_save;
+	}
+	save->thread = SDL_CreateThread(sync_thread, "savefile", save);
+	if (!save->thread) {
+		ERROR_PRINT("Could not create the save file thread: %s", SDL_GetError());
+		goto release_save;
+	}
+
+	save->next = saves;
+	saves = save;
+	if (!registered_atexit) {
+		atexit(sync_all);
+		registered_atexit = true;
+	}
+
+	retval = memory_new_persistent(save->bytes, size, save);
+
+release_save:
+	rc_release(save);
+close_fd:
+	close(fd);
+ret:
+	return retval;
+}
@@ -16,8 +16,14 @@ timekeeper_advance_clk (timekeeper_t * tk, uint64_t ncycles)
 
 	tk->clk_cyclenum += mincount;
 
+	// Every timer is counted down before any fires, so that a routine can
+	// arm any other timer (e.g. on behalf of a device it drives) without
+	// the new countdown then being counted down for time that has already
+	// passed
 	for (size_t i = 0; i < tk->ntimers; i++) {
 		tk->timers[i].countdown[0] -= mincount;
+	}
+	for (size_t i = 0; i < tk->ntimers; i++) {
 		if (tk->timers[i].countdown[0] == 0) {
 			tk->timers[i].fire((void * nonnull)tk->timers[i].obj);
 		}
@@ -40,16 +46,31 @@ timekeeper_add_timer (timekeeper_t * tk, void * timer, void * fire, uint64_t * c
 	tk->ntimers++;
 }
 
+// The real time (in SDL ticks) corresponding to the current virtual time
+static inline uint32_t
+target_ticks (const timekeeper_t * nonnull tk)
+{
+	return (uint32_t)(tk->clk_period * tk->clk_cyclenum * 1e3 + tk->t_ref);
+}
+
 void
 timekeeper_sync (timekeeper_t * tk)
 {
-	uint32_t t_target = (uint32_t)(tk->clk_period * tk->clk_cyclenum * 1e3 + tk->t_ref);
+	uint32_t t_target = target_ticks(tk);
 	uint32_t t_now = SDL_GetTicks();
 	if (t_now < t_target) {
 		SDL_Delay(t_target - t_now);
 	}
 }
 
+uint32_t
+timekeeper_lag_ms (timekeeper_t * tk)
+{
+	uint32_t t_target = target_ticks(tk);
+	uint32_t t_now = SDL_GetTicks();
+	return t_now > t_target ? t_now - t_target : 0;
+}
+
 void
 timekeeper_pause (timekeeper_t * tk)
 {